@@ -41,8 +41,265 @@ extern "C" {
 	values change across a call.
 
 	The input and output blocks must not overlap.
+
+	lz4_dec_stream_run treats all of [out, out + avail_out) as
+	scratch space: it may leave junk past the point it reports
+	having decoded up to, which later output will overwrite.
+
+	If the output buffer has spare room past out + avail_out, call
+	lz4_dec_stream_run_slack instead, passing how many bytes there
+	are to spare. It works just like lz4_dec_stream_run, and still
+	reports exactly what it decoded, but it may also scribble over
+	up to slack bytes past out + avail_out. That lets it use its
+	fast path (which copies in fixed 16 and 32 byte chunks) right up
+	to the end of the buffer, rather than dropping to exact copies
+	for the last few sequences. Slack beyond 32 bytes is never used.
+
+	lz4_dec_stream_run_dst_uncached is interchangeable with
+	lz4_dec_stream_run, even from one call to the next. It's meant for
+	output in uncached or write-combined memory, but on ordinary memory
+	it's also a little quicker for stretches of data that are mostly
+	literals, given a few KiB of output per call. lz4_dec_stream_run_auto
+	picks one or the other for each call, going by how much room for
+	output it's given and how well the stream has been compressing
+	lately. (For output that really is uncached, call run_dst_uncached
+	directly.)
+
+	Retained output:
+
+	When decoding into one big buffer a piece at a time (to report
+	progress, or to be able to cancel), everything already decoded is
+	still sitting right behind out. Initialize the decoder with
+	lz4_dec_stream_init_ex and LZ4_DEC_STREAM_RETAIN_OUTPUT to promise
+	that it stays there: each call's out must pick up exactly where the
+	last one left off, and the output decoded so far (since init) must
+	be left untouched. lz4_dec_stream_run then reads matches straight out
+	of the earlier output, and never copies any of it into its history
+	window. Only lz4_dec_stream_run and lz4_dec_stream_run_slack (and
+	lz4_dec_stream_run_auto, which sticks to the former) work this way;
+	the other decoders keep their history in the window, so they can't
+	be used with LZ4_DEC_STREAM_RETAIN_OUTPUT (and neither can
+	lz4_dec_stream_runv or the checkpoint index).
+
+	Pulling output:
+
+	If you'd rather read the decoded data where it lies than have it
+	copied into a buffer of yours, call lz4_dec_stream_peek instead
+	of lz4_dec_stream_run (out and avail_out are then ignored). It
+	decodes as much input as fits into the decoder's own history
+	window and fills in two spans covering everything decoded but
+	not yet consumed (two, since the window is a ring; the second is
+	empty unless the data wraps around). Once you're done with some
+	of it, call lz4_dec_stream_consume with how many bytes you used,
+	and the next peek will make room for more. Peeking again without
+	consuming anything just returns the same data, plus whatever
+	more input fit in. Spans remain valid until the next call to
+	lz4_dec_stream_peek. Stick to one style or the other for the
+	life of the stream; lz4_dec_stream_run doesn't know about
+	unconsumed data.
+
+	Scanning:
+
+	To look at the compressed data without decoding it (to audit how
+	well it compresses, to re-encode it, or to find out how much to
+	allocate), call lz4_dec_stream_next_seq in place of
+	lz4_dec_stream_run. It parses the input one sequence at a time,
+	returning 1 with the sequence's literal (pointing into the input)
+	and its match's length and offset, or 0 once it needs more input
+	(or the block's done), or -1 on bad data. A sequence split across
+	input buffers comes back in pieces: whatever of the literal this
+	input held, with no match, and the rest on later calls. The last
+	sequence of a block has no match either (mat_len is 0). out and
+	avail_out are ignored, as is the dictionary.
+
+	lz4_dec_stream_scan does the same over all the input it's given,
+	but only adds up how much it decodes to in *out_len, which makes it
+	much faster than decoding. Block boundaries and declared block sizes
+	(see below) are checked just as when decoding. Neither one fills in
+	the history window, so a stream that's been scanned can't then be
+	decoded; start over with lz4_dec_stream_init for that. Nor can they
+	be used with LZ4_DEC_STREAM_XXH32 or LZ4_DEC_STREAM_RETAIN_OUTPUT.
+
+	Block boundaries:
+
+	By default the input is treated as one (arbitrarily long) LZ4
+	block, and the decoder will read as far into it as it can. If
+	the input is instead a series of LZ4 blocks, call
+	lz4_dec_stream_begin_block with each block's compressed size
+	before feeding it to the decoder. The decoder will then not read
+	past the end of the block, and it'll be ready for the next one
+	once it has consumed the block's last byte. So avail_in may run
+	on past the block (into the next one, or whatever else follows
+	it in a container), and a series of blocks can be decoded
+	straight out of one big buffer.
+
+	Without a size, the decoder can't tell a block that's been cut
+	short from one that's still arriving. Once the input runs out,
+	lz4_dec_stream_may_end returns nonzero if what's been decoded so
+	far could be a whole block, that is, if the input stopped right
+	before a match offset (a block's last sequence has no match). That
+	catches a good share of truncations, but not one which happens to
+	fall just there: after a literal, or after a token with none. (Nor
+	does the size given to lz4_dec_stream_begin_block do any better,
+	when the block was cut short before the size was taken.)
+
+	If you also know how much a block decodes to, pass that to
+	lz4_dec_stream_begin_block_ex as well (SIZE_MAX if you don't).
+	A block which turns out to decode to more or less than that is
+	reported as an error. lz4_dec_stream_block_done returns nonzero
+	once the current block has been decoded completely, that is,
+	when the decoder is ready for the next lz4_dec_stream_begin_block.
+	(With lz4_dec_stream_peek, the block's tail may still be waiting
+	to be consumed at that point.)
+
+	If the blocks were compressed independently of one another,
+	initialize the decoder with lz4_dec_stream_init_ex, passing
+	LZ4_DEC_STREAM_INDEPENDENT_BLOCKS. The decoder then doesn't bother
+	saving history at the end of a block, as nothing later can refer
+	back to it. This saves lz4_dec_stream_run a copy of up to a full
+	history window (see below) for every block.
+
+	Scatter/gather:
+
+	If the input arrives as a chain of separate buffers, or the output
+	is to go into one, call lz4_dec_stream_runv with arrays of input
+	and output segments instead of setting in, avail_in, out, and
+	avail_out. It walks them in order, decoding as far as it can in
+	one call; matches may straddle any number of output segments. It
+	returns the total number of bytes it consumed and produced in
+	*in_len and *out_len, and leaves in, avail_in, out, and avail_out
+	pointing into the segments it stopped in. Matches reaching back
+	into earlier segments are read from there, so the output segments
+	must all stay put (and not overlap) for the duration of the call;
+	the history window is only filled in once, as it returns, rather
+	than every time a segment fills up.
+
+	Batches:
+
+	Lots of tiny messages, each in a stream of its own, spend most of
+	their time waiting for memory: every state is over 64 KiB, so the
+	next one's fields are rarely in the cache. Set up each stream as
+	usual and hand them all to lz4_dec_stream_run_prefetched, which runs
+	lz4_dec_stream_run on each in turn while prefetching the states
+	(and inputs and outputs) of the next few. That's all it does: each
+	stream is still decoded start to finish before the next one, not
+	interleaved with the others, so it only helps when the states and
+	buffers are cold. It returns nonzero if any stream failed; pass a
+	results array (or null) to find out which. The streams must all be
+	distinct.
+
+	Dictionaries:
+
+	To decode data compressed against a dictionary (the equivalent of
+	liblz4's LZ4_decompress_safe_usingDict), call
+	lz4_dec_stream_set_dict right after initializing the decoder.
+	Matches reaching back past the start of the stream then read from
+	the dictionary in place; it isn't copied, so setting one costs
+	nothing, and the same dictionary can back any number of decoders
+	on any number of threads at once. It must stay put and unchanged
+	until the first window's worth of output (64 KiB, see below; or
+	the whole stream, if it's shorter) has been decoded. A match reaching past the start of
+	the dictionary is an error.
+
+	History window:
+
+	The decoder keeps the last 64 KiB of output in its state, since
+	that's as far back as an LZ4 match can reach. If you control the
+	encoder and know it never emits offsets past some smaller window
+	(liblz4 built with LZ4_DISTANCE_MAX, say), define
+	LZ4_STREAM_WINDOW_LOG (10 to 16, the CMake option of the same
+	name sets it) to shrink the state to match. The decoder then
+	reports an error for any offset reaching beyond the window
+	instead of reading garbage. The encoder below respects the same
+	window. The define must be the same everywhere this header is
+	included, since it changes the size of lz4_dec_stream_state.
+
+	Checksums:
+
+	Pass LZ4_DEC_STREAM_XXH32 to lz4_dec_stream_init_ex and the decoder
+	keeps a running xxHash32 (seed 0) of everything it decodes, which
+	lz4_dec_stream_xxh32 returns at any point. The hashing is folded
+	into decoding rather than done as a second pass over the output:
+	lz4_dec_stream_run hashes each stretch of out right after writing
+	it (while it's still in the cache), and the decoders that work
+	through o_buf (run_dst_uncached, run_dst_nt, and peek) hash it
+	there, so out is never read back.
+
+	On x86, the decoder checks the CPU at init time and uses SSSE3 or
+	AVX2 for repeating short patterns and for long copies if it can.
+	Pass LZ4_DEC_STREAM_NO_SIMD to lz4_dec_stream_init_ex to stick to
+	plain C, which is what other platforms always get.
+
+	Statistics:
+
+	To find out why some stream decodes slowly (tiny chunks of input,
+	short repeating matches, long literals, lots of history copying),
+	define LZ4_STREAM_STATS (the CMake option LZ4STREAM_STATS does) and
+	the decoder counts what it does: tokens, literal and match bytes and
+	histograms of their lengths, match offsets, which copy routine each
+	match went to, how often it suspended in each phase, and how much it
+	copied into its history window. lz4_dec_stream_get_stats returns
+	the counts so far (since lz4_dec_stream_init; for the frame decoder,
+	lz4_frame_dec_get_stats, since lz4_frame_dec_init), or null if the
+	library was built without them. lz4_dec_stream_stats_format writes
+	them out as text, one "name value" pair per line, and returns the
+	text's full length as snprintf does. Counting costs a little speed,
+	and nothing at all when it's off. Like the window, the define must
+	be the same everywhere this header is included.
 */
 
+#ifndef LZ4_STREAM_WINDOW_LOG
+#define LZ4_STREAM_WINDOW_LOG				16
+#endif
+
+#if LZ4_STREAM_WINDOW_LOG < 10 || LZ4_STREAM_WINDOW_LOG > 16
+#error "LZ4_STREAM_WINDOW_LOG must be between 10 and 16"
+#endif
+
+#define LZ4_STREAM_WINDOW_LEN				(1u << LZ4_STREAM_WINDOW_LOG)
+
+#define LZ4_DEC_STREAM_INDEPENDENT_BLOCKS	0x1
+#define LZ4_DEC_STREAM_NO_SIMD				0x2
+#define LZ4_DEC_STREAM_XXH32				0x4
+#define LZ4_DEC_STREAM_RETAIN_OUTPUT		0x8
+
+//private: an incremental xxHash32
+typedef struct lz4_stream_xxh32
+{
+	uint32_t			v[4];
+	uint64_t			total_len;
+	uint8_t				mem[16];
+	unsigned int		mem_len;
+} lz4_stream_xxh32;
+
+#define LZ4_DEC_STREAM_STATS_BUCKETS		18
+
+//see "Statistics" above; the histograms count powers of two:
+//bucket 0 is 0, bucket k is [2^(k-1), 2^k), and the last takes the rest
+typedef struct lz4_dec_stream_stats
+{
+	uint64_t			runs; //calls into the decoder
+	uint64_t			suspends[8]; //calls that returned for more input or output, by the phase they stopped in
+
+	uint64_t			tokens;
+	uint64_t			lit_bytes, mat_bytes;
+	uint64_t			hist_bytes; //copied into the history window
+
+	uint64_t			lit_lens[LZ4_DEC_STREAM_STATS_BUCKETS];
+	uint64_t			mat_lens[LZ4_DEC_STREAM_STATS_BUCKETS];
+	uint64_t			mat_dsts[LZ4_DEC_STREAM_STATS_BUCKETS];
+
+	//which routine copied each match (or each piece of a match split across calls)
+	uint64_t			cpy_mat_wild;
+	uint64_t			cpy_mat_history;
+	uint64_t			cpy_mat_dict;
+	uint64_t			cpy_mat_no_overlap;
+	uint64_t			cpy_mat_rle_simd;
+	uint64_t			cpy_mat_rle_long_dst;
+	uint64_t			cpy_mat_rle_short_dst;
+	uint64_t			cpy_mat_obuf;
+} lz4_dec_stream_stats;
+
 typedef struct lz4_dec_stream_state
 {
 	const uint8_t		*in;
@@ -55,17 +312,249 @@ typedef struct lz4_dec_stream_state
 
 	struct
 	{
-		uint8_t			o_buf[32 + 0x10000 + 32];
+		uint8_t			o_buf[32 + LZ4_STREAM_WINDOW_LEN + 32];
 
 		unsigned int	lit_len, mat_len;
 		unsigned int	o_pos, mat_dst;
 		unsigned int	phase;
+
+		unsigned int	flags;
+		size_t			blk_left, blk_out_left;
+
+		unsigned int	simd;
+		unsigned int	o_pending;
+		unsigned int	auto_in, auto_out; //lz4_dec_stream_run_auto's running averages
+
+		const uint8_t	*dict;
+		size_t			dict_len, dict_hist;
+
+		size_t			o_retained; //with LZ4_DEC_STREAM_RETAIN_OUTPUT, how much output lies behind out
+
+		lz4_stream_xxh32	xxh;
+
+#if LZ4_STREAM_STATS
+		lz4_dec_stream_stats	stats;
+#endif
 	} p_;
 } lz4_dec_stream_state;
 
+typedef struct lz4_dec_stream_span
+{
+	const uint8_t		*data;
+	size_t				len;
+} lz4_dec_stream_span;
+
+typedef struct lz4_dec_stream_iov
+{
+	uint8_t				*data;
+	size_t				len;
+} lz4_dec_stream_iov;
+
+//see "Scanning" above: copy lit_len bytes from lit, then mat_len
+//bytes from mat_dst bytes back (the copy may overlap itself)
+typedef struct lz4_dec_stream_seq
+{
+	const uint8_t		*lit;
+	size_t				lit_len;
+	size_t				mat_len;
+	unsigned int		mat_dst;
+} lz4_dec_stream_seq;
+
 void lz4_dec_stream_init(lz4_dec_stream_state *s);
+void lz4_dec_stream_init_ex(lz4_dec_stream_state *s, unsigned int flags);
+void lz4_dec_stream_begin_block(lz4_dec_stream_state *s, size_t blk_len);
+void lz4_dec_stream_begin_block_ex(lz4_dec_stream_state *s, size_t blk_len, size_t out_len);
+int lz4_dec_stream_block_done(const lz4_dec_stream_state *s);
+int lz4_dec_stream_may_end(const lz4_dec_stream_state *s);
+void lz4_dec_stream_set_dict(lz4_dec_stream_state *s, const uint8_t *dict, size_t dict_len);
 int lz4_dec_stream_run(lz4_dec_stream_state *s);
+int lz4_dec_stream_run_slack(lz4_dec_stream_state *s, size_t slack);
 int lz4_dec_stream_run_dst_uncached(lz4_dec_stream_state *s);
+int lz4_dec_stream_run_dst_nt(lz4_dec_stream_state *s);
+int lz4_dec_stream_run_auto(lz4_dec_stream_state *s);
+int lz4_dec_stream_runv(lz4_dec_stream_state *s,
+	const lz4_dec_stream_span *in, size_t in_cnt, size_t *in_len,
+	const lz4_dec_stream_iov *out, size_t out_cnt, size_t *out_len);
+int lz4_dec_stream_run_prefetched(lz4_dec_stream_state *const *s, size_t n, int *results);
+int lz4_dec_stream_peek(lz4_dec_stream_state *s, lz4_dec_stream_span span[2]);
+void lz4_dec_stream_consume(lz4_dec_stream_state *s, size_t len);
+int lz4_dec_stream_next_seq(lz4_dec_stream_state *s, lz4_dec_stream_seq *seq);
+int lz4_dec_stream_scan(lz4_dec_stream_state *s, size_t *out_len);
+uint32_t lz4_dec_stream_xxh32(const lz4_dec_stream_state *s);
+const lz4_dec_stream_stats *lz4_dec_stream_get_stats(const lz4_dec_stream_state *s);
+size_t lz4_dec_stream_stats_format(const lz4_dec_stream_stats *st, char *buf, size_t buf_len);
+
+/*
+	LZ4 frame format decoder.
+
+	This is used exactly like lz4_dec_stream_state, except that
+	the input is a sequence of LZ4 frames (as written by the lz4
+	command line tool or liblz4's lz4frame API) rather than a raw
+	LZ4 block. Skippable frames are skipped, uncompressed blocks
+	are copied through, and the blocks themselves are decoded by
+	one of the lz4_dec_stream_run functions, picked by whichever
+	lz4_frame_dec_run function is called.
+
+	Unlike the raw block decoder, the frame decoder knows where
+	its input ends. lz4_frame_dec_done returns nonzero when the
+	decoder sits between frames, which is where it should be once
+	the input's been exhausted. Anything following the last frame
+	will be parsed as the start of another frame.
+
+	Checksums (header, block, and content) are skipped over, but
+	are not verified, unless the decoder is initialized with
+	lz4_frame_dec_init_ex and LZ4_FRAME_DEC_VERIFY_CHECKSUMS. Then
+	any checksum that doesn't match is reported as an error. The
+	content checksum is computed as the blocks are decoded (see
+	"Checksums" above), block checksums as their input is read.
+	Frames which require a dictionary are not supported.
+*/
+
+#define LZ4_FRAME_DEC_VERIFY_CHECKSUMS		0x1
+
+typedef struct lz4_frame_dec_state
+{
+	const uint8_t		*in;
+	size_t				avail_in;
+
+	uint8_t				*out;
+	size_t				avail_out;
+
+	//private state - no touchy!
+
+	struct
+	{
+		lz4_dec_stream_state	blk;
+
+		uint32_t		len; //bytes left in the current block or skippable frame
+		uint32_t		max_blk_len;
+
+		uint8_t			hdr[16];
+		unsigned int	hdr_len, hdr_need;
+
+		unsigned int	flg;
+		unsigned int	phase;
+
+		unsigned int		flags;
+		lz4_stream_xxh32	blk_xxh; //the descriptor's or current block's checksum
+	} p_;
+} lz4_frame_dec_state;
+
+void lz4_frame_dec_init(lz4_frame_dec_state *s);
+void lz4_frame_dec_init_ex(lz4_frame_dec_state *s, unsigned int flags);
+int lz4_frame_dec_run(lz4_frame_dec_state *s);
+int lz4_frame_dec_run_dst_uncached(lz4_frame_dec_state *s);
+int lz4_frame_dec_done(const lz4_frame_dec_state *s);
+const lz4_dec_stream_stats *lz4_frame_dec_get_stats(const lz4_frame_dec_state *s);
+
+/*
+	LZ4 block encoder.
+
+	This is the decoder's mirror image, and it's used the same way:
+	call lz4_enc_stream_init, point in/avail_in at your input and
+	out/avail_out at your output buffer, and call lz4_enc_stream_run
+	as many times as you like, in whatever pieces are convenient.
+	The encoder consumes input into its own window, so the caller's
+	input buffer can be reused as soon as the call returns.
+
+	Since an LZ4 block has to end in a particular way, the encoder
+	must be told where the input ends. Once the last of the input has
+	been provided, call lz4_enc_stream_finish (instead of run) until
+	it returns 1, giving it more output space each time it returns 0.
+
+	The output is a single LZ4 block, which can be decoded by
+	lz4_dec_stream_run or by liblz4's LZ4_decompress_safe.
+
+	Like the decoder, the encoder allocates nothing, and holds no
+	external resources. It is, however, a rather big struct.
+
+	Limitations:
+
+	An LZ4 block stores the length of each run of literals ahead of
+	the literals themselves, so the encoder has to hold on to an
+	entire run before it can write any of it. Its window holds a
+	bit under 128 KiB, and it reports an error if the input has a
+	longer stretch in which it can't find any matches. Such data
+	doesn't compress; use the frame encoder below for input that may
+	hold any (random data, or data that's already been compressed).
+*/
+
+typedef struct lz4_enc_stream_state
+{
+	const uint8_t		*in;
+	size_t				avail_in;
+
+	uint8_t				*out;
+	size_t				avail_out;
+
+	//private state - no touchy!
+
+	struct
+	{
+		uint8_t			buf[0x20000];
+		uint32_t		hash[1 << 12];
+
+		uint32_t		base; //the stream position of buf[0]
+		uint32_t		anchor, pos, end;
+
+		uint32_t		mat_len, mat_ofs;
+		uint32_t		ex_len;
+
+		unsigned int	phase;
+	} p_;
+} lz4_enc_stream_state;
+
+void lz4_enc_stream_init(lz4_enc_stream_state *s);
+int lz4_enc_stream_run(lz4_enc_stream_state *s);
+int lz4_enc_stream_finish(lz4_enc_stream_state *s);
+
+/*
+	LZ4 frame format encoder.
+
+	This is used exactly like lz4_enc_stream_state, except that the
+	output is a single LZ4 frame, which lz4_frame_dec_run (or the lz4
+	command line tool, or liblz4's lz4frame API) can decode. The input
+	is split into 64 KiB blocks, each of which may refer back to the
+	ones before it, and any block that doesn't get smaller is stored
+	uncompressed, so there's no limit on what the input may hold.
+	There are no checksums.
+
+	Each block is encoded into a buffer of the encoder's own before
+	it's written out (since its size goes ahead of it), which makes
+	this struct bigger still.
+*/
+
+typedef struct lz4_frame_enc_state
+{
+	const uint8_t		*in;
+	size_t				avail_in;
+
+	uint8_t				*out;
+	size_t				avail_out;
+
+	//private state - no touchy!
+
+	struct
+	{
+		lz4_enc_stream_state	blk;
+
+		uint8_t			raw[0x10000]; //the current block's input
+		uint8_t			packed[0x10000]; //and what it encoded to
+
+		uint32_t		raw_len;
+		uint32_t		blk_len, blk_pos; //the block being written out
+		int				stored; //the block is raw, not packed
+
+		uint8_t			hdr[8]; //the frame header, a block size, or the end mark
+		unsigned int	hdr_len, hdr_pos;
+
+		unsigned int	phase;
+	} p_;
+} lz4_frame_enc_state;
+
+void lz4_frame_enc_init(lz4_frame_enc_state *s);
+int lz4_frame_enc_run(lz4_frame_enc_state *s);
+int lz4_frame_enc_finish(lz4_frame_enc_state *s);
 
 #ifdef __cplusplus
 }
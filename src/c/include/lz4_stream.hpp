@@ -0,0 +1,238 @@
+#ifndef LZ4_STREAM_HPP
+#define LZ4_STREAM_HPP
+
+#include "lz4_stream.h"
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <streambuf>
+
+/*
+	C++ wrappers (C++20, header-only).
+
+	lz4_stream::decoder owns an lz4_dec_stream_state (on the heap,
+	since it's big) and wraps the C calls. decode takes spans rather
+	than raw pointers and lengths, and returns how much of each it
+	used. Bad input throws lz4_stream::decode_error.
+
+	lz4_stream::istreambuf is a std::streambuf which reads a raw LZ4
+	block from another streambuf and decodes it. Its get area points
+	straight into the decoder's history window (see "Pulling output"
+	in lz4_stream.h), so the decoded bytes are copied exactly once:
+	from the window into whatever buffer a read asks for. The
+	compressed input is read in_buf_len bytes at a time. The get area
+	is read-only, so putting back a character other than the one just
+	read fails, and the stream can't seek. lz4_stream::istream is a
+	std::istream with one of these built in.
+
+	Since a raw block doesn't know where it ends, the stream ends when
+	the source does. If that leaves the block cut off mid-sequence, it's
+	a decode error (though not every cut is caught, see
+	lz4_dec_stream_may_end); an empty source is an empty stream. A
+	decode error is thrown out of underflow, which std::istream turns
+	into badbit (or rethrows, if asked to with exceptions()).
+*/
+
+namespace lz4_stream
+{
+
+class decode_error : public std::runtime_error
+{
+public:
+	decode_error() : std::runtime_error("lz4_stream: invalid input") {}
+};
+
+class decoder
+{
+public:
+	struct result
+	{
+		std::size_t in_used;
+		std::size_t out_used;
+	};
+
+	explicit decoder(unsigned int flags = 0)
+		: s_(std::make_unique<lz4_dec_stream_state>())
+	{
+		lz4_dec_stream_init_ex(s_.get(), flags);
+	}
+
+	void reset(unsigned int flags = 0)
+	{
+		lz4_dec_stream_init_ex(s_.get(), flags);
+	}
+
+	//the dictionary isn't copied, see lz4_dec_stream_set_dict
+	void set_dict(std::span<const std::uint8_t> dict)
+	{
+		lz4_dec_stream_set_dict(s_.get(), dict.data(), dict.size());
+	}
+
+	void begin_block(std::size_t blk_len)
+	{
+		lz4_dec_stream_begin_block(s_.get(), blk_len);
+	}
+
+	void begin_block(std::size_t blk_len, std::size_t out_len)
+	{
+		lz4_dec_stream_begin_block_ex(s_.get(), blk_len, out_len);
+	}
+
+	bool block_done() const noexcept
+	{
+		return lz4_dec_stream_block_done(s_.get()) != 0;
+	}
+
+	bool may_end() const noexcept
+	{
+		return lz4_dec_stream_may_end(s_.get()) != 0;
+	}
+
+	//decodes as much of in into out as it can
+	result decode(std::span<const std::uint8_t> in, std::span<std::uint8_t> out)
+	{
+		s_->in = in.data();
+		s_->avail_in = in.size();
+		s_->out = out.data();
+		s_->avail_out = out.size();
+
+		if (lz4_dec_stream_run(s_.get()))
+			throw decode_error();
+
+		return {in.size() - s_->avail_in, out.size() - s_->avail_out};
+	}
+
+	//decodes as much of in as fits into the window, and returns spans of
+	//everything there not yet consumed; in is advanced past what was used
+	std::array<std::span<const std::uint8_t>, 2> peek(std::span<const std::uint8_t>& in)
+	{
+		s_->in = in.data();
+		s_->avail_in = in.size();
+
+		lz4_dec_stream_span span[2];
+		if (lz4_dec_stream_peek(s_.get(), span))
+			throw decode_error();
+
+		in = in.subspan(in.size() - s_->avail_in);
+		return {{{span[0].data, span[0].len}, {span[1].data, span[1].len}}};
+	}
+
+	void consume(std::size_t len)
+	{
+		lz4_dec_stream_consume(s_.get(), len);
+	}
+
+	lz4_dec_stream_state* get() noexcept { return s_.get(); }
+	const lz4_dec_stream_state* get() const noexcept { return s_.get(); }
+
+private:
+	std::unique_ptr<lz4_dec_stream_state> s_;
+};
+
+class istreambuf : public std::streambuf
+{
+public:
+	static constexpr std::size_t default_in_buf_len = 0x4000;
+
+	explicit istreambuf(std::streambuf* source, std::size_t in_buf_len = default_in_buf_len)
+		: source_(source)
+		, in_buf_(std::make_unique<std::uint8_t[]>(in_buf_len ? in_buf_len : 1))
+		, in_buf_len_(in_buf_len ? in_buf_len : 1)
+	{
+	}
+
+	istreambuf(const istreambuf&) = delete;
+	istreambuf& operator=(const istreambuf&) = delete;
+
+	decoder& get_decoder() noexcept { return dec_; }
+
+protected:
+	int_type underflow() override
+	{
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+
+		//everything in the old get area has been read
+		dec_.consume((std::size_t)(egptr() - eback()));
+		setg(nullptr, nullptr, nullptr);
+
+		for (;;)
+		{
+			if (in_.empty() && !source_eof_)
+			{
+				auto n = source_->sgetn(reinterpret_cast<char*>(in_buf_.get()), (std::streamsize)in_buf_len_);
+				if (n > 0)
+				{
+					in_ = {in_buf_.get(), (std::size_t)n};
+					source_empty_ = false;
+				}
+				else
+					source_eof_ = true;
+			}
+
+			//nb: only the first span goes out, the second turns up
+			//as the first on the next call
+			auto span = dec_.peek(in_);
+			if (!span[0].empty())
+			{
+				auto p = const_cast<char*>(reinterpret_cast<const char*>(span[0].data()));
+				setg(p, p, p + span[0].size());
+				return traits_type::to_int_type(*p);
+			}
+
+			if (in_.empty() && source_eof_)
+			{
+				//the source ran out, make sure the block could end here
+				if (!source_empty_ && !dec_.may_end())
+					throw decode_error();
+				return traits_type::eof();
+			}
+		}
+	}
+
+	std::streamsize showmanyc() override
+	{
+		return egptr() - gptr();
+	}
+
+private:
+	std::streambuf* source_;
+	decoder dec_;
+
+	std::unique_ptr<std::uint8_t[]> in_buf_;
+	std::size_t in_buf_len_;
+	std::span<const std::uint8_t> in_;
+	bool source_eof_ = false;
+	bool source_empty_ = true;
+};
+
+class istream : public std::istream
+{
+public:
+	explicit istream(std::streambuf* source, std::size_t in_buf_len = istreambuf::default_in_buf_len)
+		: std::istream(nullptr)
+		, buf_(source, in_buf_len)
+	{
+		rdbuf(&buf_);
+	}
+
+	explicit istream(std::istream& source, std::size_t in_buf_len = istreambuf::default_in_buf_len)
+		: istream(source.rdbuf(), in_buf_len)
+	{
+	}
+
+	istreambuf* rdbuf() noexcept { return &buf_; }
+
+private:
+	using std::istream::rdbuf;
+
+	istreambuf buf_;
+};
+
+}
+
+#endif
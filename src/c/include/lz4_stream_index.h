@@ -0,0 +1,80 @@
+#ifndef LZ4_STREAM_INDEX_H
+#define LZ4_STREAM_INDEX_H
+
+#include "lz4_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Random access.
+
+	An index holds checkpoints into a long stream: every spacing bytes
+	of output, the decoder's complete state (where it was in the input,
+	what it was in the middle of, and the history window a later match
+	might reach back into). Seeking restores a decoder from the nearest
+	checkpoint at or before the wanted output offset, so reaching any
+	byte costs decoding at most spacing bytes rather than everything
+	before it.
+
+	To build one, create it with lz4_dec_index_create, initialize a
+	decoder as usual, and decode the stream from the start with
+	lz4_dec_index_run in place of lz4_dec_stream_run (or
+	lz4_frame_dec_index_run in place of lz4_frame_dec_run). They behave
+	exactly like the functions they stand in for, apart from noting a
+	checkpoint whenever the output crosses a multiple of spacing. Don't
+	mix raw and frame decoding in one index. A decoder initialized with
+	LZ4_DEC_STREAM_RETAIN_OUTPUT keeps no history window to save, so
+	it's refused (as an error) both here and when seeking.
+
+	lz4_dec_index_save writes the index into buf (returning how big it
+	is, or would be if buf_len is too small), and lz4_dec_index_load
+	reads it back, returning null if it isn't a valid index built
+	with the same LZ4_STREAM_WINDOW_LOG. The history windows are
+	compressed, so an index is usually a small fraction of the size
+	of the stream's output.
+
+	To seek, initialize a decoder exactly as for the original pass
+	(the same lz4_dec_stream_init_ex or lz4_frame_dec_init_ex flags,
+	and lz4_dec_stream_set_dict if the stream uses a dictionary) and
+	call lz4_dec_index_seek (or lz4_frame_dec_index_seek) with the
+	output offset you're after. It restores the decoder to the nearest
+	checkpoint and returns that checkpoint's input and output offsets.
+	The flags you initialized it with are kept (so the seeking decoder
+	may, say, add LZ4_DEC_STREAM_NO_SIMD); only where it was in the
+	stream comes from the checkpoint.
+	Feed the decoder input from *in_pos on, and throw away the first
+	out_pos - *at_out_pos bytes it produces. If out_pos comes before the
+	first checkpoint, the decoder is left as it was and both offsets
+	are 0. A checkpoint includes any running checksums, so
+	lz4_dec_stream_xxh32 and frame checksum verification carry on
+	from a seek as if the stream had been decoded from the start.
+
+	Like lz4_stream_mt.h, this allocates memory. The functions returning
+	int return nonzero on bad input, or if memory couldn't be allocated.
+*/
+
+typedef struct lz4_dec_index lz4_dec_index;
+
+lz4_dec_index *lz4_dec_index_create(uint64_t spacing);
+void lz4_dec_index_free(lz4_dec_index *idx);
+
+int lz4_dec_index_run(lz4_dec_index *idx, lz4_dec_stream_state *s);
+int lz4_frame_dec_index_run(lz4_dec_index *idx, lz4_frame_dec_state *s);
+
+size_t lz4_dec_index_count(const lz4_dec_index *idx);
+
+size_t lz4_dec_index_save(const lz4_dec_index *idx, uint8_t *buf, size_t buf_len);
+lz4_dec_index *lz4_dec_index_load(const uint8_t *buf, size_t len);
+
+int lz4_dec_index_seek(const lz4_dec_index *idx, uint64_t out_pos,
+	lz4_dec_stream_state *s, uint64_t *in_pos, uint64_t *at_out_pos);
+int lz4_frame_dec_index_seek(const lz4_dec_index *idx, uint64_t out_pos,
+	lz4_frame_dec_state *s, uint64_t *in_pos, uint64_t *at_out_pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
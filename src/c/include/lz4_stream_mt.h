@@ -0,0 +1,51 @@
+#ifndef LZ4_STREAM_MT_H
+#define LZ4_STREAM_MT_H
+
+#include "lz4_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Parallel frame decoding.
+
+	lz4_frame_dec_parallel decodes a buffer holding complete LZ4
+	frames into a single output buffer. Frames made of independent
+	blocks are split among n_threads threads (the calling thread
+	being one of them), each with its own lz4_dec_stream_state,
+	and each block is decoded straight into its final place in the
+	output buffer. The threads and their states are set up once per
+	call, the first time a frame can be split, and reused for every
+	frame after that.
+
+	Blocks are placed by assuming that every block in a frame but
+	the last decodes to the frame's maximum block size, which holds
+	for anything compressed in one go by the lz4 tool or by
+	LZ4F_compressFrame. Frames that turn out to break that rule, and
+	frames with linked blocks, are decoded on the calling thread with
+	lz4_frame_dec_run instead.
+
+	On entry *out_len holds the size of the output buffer, and on
+	success it's set to the number of bytes decoded and 0 is returned.
+	A nonzero return means the input was invalid or truncated, the
+	output buffer was too small, or memory couldn't be allocated.
+	Frame headers are checked just as lz4_frame_dec_run checks them,
+	so anything it rejects (a frame needing a dictionary, say) is
+	rejected here too.
+
+	Unlike everything in lz4_stream.h, this allocates memory (mainly
+	a lz4_dec_stream_state per thread) and creates threads. If the
+	platform has no C11 threads, it decodes on the calling thread.
+*/
+
+int lz4_frame_dec_parallel(
+	const uint8_t *in, size_t in_len,
+	uint8_t *out, size_t *out_len,
+	unsigned int n_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
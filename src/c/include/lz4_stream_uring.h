@@ -0,0 +1,82 @@
+#ifndef LZ4_STREAM_URING_H
+#define LZ4_STREAM_URING_H
+
+#include "lz4_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Asynchronous file decoding.
+
+	lz4_uring_dec_fd decodes everything from in_fd to its end, writing
+	the result to out_fd. Rather than alternating between reading,
+	decoding, and writing, it keeps up to queue_depth reads and
+	queue_depth writes of buf_len bytes apiece in flight through an
+	io_uring (with the buffers registered with the kernel), decoding
+	each input buffer as soon as its read completes into whichever
+	output buffer is free. The input is LZ4 frames, or with
+	LZ4_URING_RAW_BLOCK a single raw LZ4 block.
+
+	Regular files are read and written at explicit offsets, starting
+	from the descriptors' current positions (which are left just past
+	everything read and written). Pipes, sockets, and the like can't
+	be, so for those only one operation in each direction is kept in
+	flight.
+
+	lz4_uring_dec_file opens (creating or truncating) the files itself.
+
+	Pass 0 for queue_depth or buf_len to get the defaults (8 and
+	256 KiB). If stats isn't null, it's filled in with what happened:
+	how deep the queues actually got, and how often (and for how long)
+	decoding had to wait for a read to complete or for an output
+	buffer to become free. Lots of read stalls mean the input can't
+	keep up; lots of write stalls, the output.
+
+	Returns 0 on success. A nonzero return means the input was
+	invalid or truncated, an I/O operation failed (errno says why), or
+	memory couldn't be allocated. A raw block has no length of its
+	own, though, so it's taken to run to the end of in_fd (to its
+	size, if it's a regular file) and its truncation is only caught
+	roughly: one cut off right before a match offset looks complete
+	(see lz4_dec_stream_may_end).
+
+	Like lz4_stream_mt.h, this allocates memory. Where io_uring isn't
+	available (other platforms, old kernels, or sandboxes that forbid
+	it) it falls back to plain read and write calls, one at a time,
+	and stats->used_uring is 0.
+*/
+
+#define LZ4_URING_RAW_BLOCK		0x1
+
+typedef struct lz4_uring_stats
+{
+	uint64_t		in_bytes, out_bytes;
+
+	unsigned int	queue_depth;			//buffers in each direction
+	unsigned int	max_reads_in_flight;
+	unsigned int	max_writes_in_flight;
+	uint64_t		reads, writes;			//operations submitted
+
+	uint64_t		read_stalls, write_stalls;
+	uint64_t		read_stall_ns, write_stall_ns;
+
+	int				used_uring;
+} lz4_uring_stats;
+
+int lz4_uring_dec_fd(
+	int in_fd, int out_fd, unsigned int flags,
+	unsigned int queue_depth, size_t buf_len,
+	lz4_uring_stats *stats);
+
+int lz4_uring_dec_file(
+	const char *in_path, const char *out_path, unsigned int flags,
+	unsigned int queue_depth, size_t buf_len,
+	lz4_uring_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "lz4_stream-generators.hpp"
+
+#include "lz4.h"
+#include "lz4frame.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+//what lz4_stream-bench and lz4_stream-latency share: their corpora, and
+//how they're loaded, compressed, and named in the output
+
+//each tool's main sets this, so fail's messages say whose they are
+inline const char* bench_tool_name = "lz4_stream";
+
+inline void fail(const char* what, const std::string& detail)
+{
+	std::fprintf(stderr, "%s: %s: %s\n", bench_tool_name, what, detail.c_str());
+	std::exit(1);
+}
+
+struct corpus
+{
+	std::string name;
+	std::vector<uint8_t> input;
+	std::vector<uint8_t> block;		//one LZ4 block
+	std::vector<uint8_t> frame;		//an independent-block LZ4 frame, 256 KiB blocks (if compress_frame was called)
+};
+
+template <typename Generator>
+corpus generated(const char* name)
+{
+	corpus c;
+	c.name = name;
+	Generator{}(c.input);
+	return c;
+}
+
+inline corpus from_file(const std::string& path)
+{
+	std::ifstream f(path, std::ios::binary);
+	if (!f)
+		fail("can't open", path);
+
+	corpus c;
+	c.name = path;
+	c.input.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	if (c.input.size() > INT_MAX)
+		fail("file too big for a single LZ4 block", path);
+
+	return c;
+}
+
+inline void compress_block(corpus& c)
+{
+	c.block.resize((std::size_t)LZ4_compressBound((int)c.input.size()));
+	auto block_len = LZ4_compress_default((const char*)c.input.data(), (char*)c.block.data(), (int)c.input.size(), (int)c.block.size());
+	if (block_len <= 0 && !c.input.empty())
+		fail("LZ4_compress_default failed", c.name);
+	c.block.resize((std::size_t)block_len);
+}
+
+inline void compress_frame(corpus& c)
+{
+	LZ4F_preferences_t prefs{};
+	prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+	prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+
+	c.frame.resize(LZ4F_compressFrameBound(c.input.size(), &prefs));
+	auto frame_len = LZ4F_compressFrame(c.frame.data(), c.frame.size(), c.input.data(), c.input.size(), &prefs);
+	if (LZ4F_isError(frame_len))
+		fail("LZ4F_compressFrame failed", c.name);
+	c.frame.resize(frame_len);
+}
+
+//s as a JSON string
+inline std::string json_quoted(const std::string& s)
+{
+	std::string q = "\"";
+	for (char ch : s)
+	{
+		if (ch == '"' || ch == '\\')
+			q += '\\';
+		q += ch;
+	}
+	return q + "\"";
+}
@@ -0,0 +1,550 @@
+#include "lz4_stream.h"
+#include "lz4_stream.hpp"
+#include "lz4_stream_mt.h"
+#include "lz4_stream-bench-common.hpp"
+
+#include "lz4.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Decoding throughput, against liblz4.
+
+	usage: lz4_stream-bench [options] [files...]
+
+		--format csv|json	output format (default: csv)
+		--min-time SECONDS	time each measurement for at least this long (default: 0.25)
+		--reps N			best of N measurements (default: 3)
+		--threads N			thread counts to try for lz4_frame_dec_parallel go up to N
+							(default: the number of hardware threads)
+		--quick				one-shot and 4K chunks only
+
+	Every decoder runs over every corpus: the built-in generated ones,
+	plus any files named on the command line. The streaming decoders
+	are fed input and output in chunks of each size from 64 bytes up
+	to one shot (chunk = 0 in the output). MB/s is decompressed bytes
+	per second, msgs/s is how many times a second the whole corpus
+	is decoded.
+
+	The "messages" corpus is different: it's a pile of small, separate
+	messages with a decoder state each, decoded N at a time (batch = N
+	in the output) through lz4_dec_stream_run_prefetched, or by calling
+	lz4_dec_stream_run on each in a loop. There msgs/s counts single
+	messages.
+*/
+
+using big_mixed = chained_generators<
+	xorshift_uints<0x10000/4>,
+	constant_span<0x1000>,
+	xorshift_uints<0x10000/8>,
+	constant_span<0x1000, 0xF0>,
+	xorshift_uints<0x10000, 0xBAADCAFE>,
+	repeated_generator<
+		chained_generators<
+			counting_span<40, 255>,
+			counting_span<132, 0>,
+			counting_span<60, 140>
+		>, 128>,
+	constant_span<0x10000, 0x0F>,
+	repeated_generator<
+		chained_generators<
+			counting_span<0, 255>,
+			xorshift_uints<0x100000>,
+			counting_span<255, 0>
+		>, 4>,
+	constant_span<0x10000, 0xBA>
+>;
+
+using many_matches = repeated_generator<
+	chained_generators<
+		counting_span<0, 255>,
+		counting_span<255, 0>
+	>, 8 * 1024>;
+
+using short_runs = repeated_generator<
+	chained_generators<
+		repeated_generator<counting_span<1, 2>, 64>,
+		repeated_generator<counting_span<1, 3>, 64>,
+		repeated_generator<counting_span<1, 5>, 64>,
+		repeated_generator<counting_span<1, 7>, 64>,
+		repeated_generator<counting_span<1, 12>, 64>,
+		repeated_generator<counting_span<1, 15>, 64>,
+		xorshift_uints<0x40>
+	>, 512>;
+
+using noise = xorshift_uints<0x100000>;
+
+using zeroes = constant_span<0x1000000>;
+
+struct options
+{
+	bool json = false;
+	double min_time = 0.25;
+	int reps = 3;
+	unsigned int max_threads = 0;
+	bool quick = false;
+	std::vector<std::string> files;
+};
+
+struct result
+{
+	std::string corpus;
+	std::string decoder;
+	std::size_t chunk;
+	unsigned int threads;
+	std::size_t batch;
+	std::size_t input_len;
+	std::size_t compressed_len;
+	double mbps;
+	double msgs_per_s;
+};
+
+//a streambuf over bytes already in memory, so only the decoding gets measured
+struct memory_source : std::streambuf
+{
+	explicit memory_source(const std::vector<uint8_t>& data)
+	{
+		auto p = const_cast<char*>(reinterpret_cast<const char*>(data.data()));
+		setg(p, p, p + data.size());
+	}
+};
+
+//best-of-reps MB/s of decode(), which must fill output with input
+static double measure(const options& opt, const corpus& c, std::vector<uint8_t>& output, const std::function<bool()>& decode)
+{
+	using clock = std::chrono::steady_clock;
+
+	double best = 0;
+	for (int r = 0; r < opt.reps; r++)
+	{
+		std::size_t n = 0;
+		auto t0 = clock::now();
+		auto t1 = t0;
+		do
+		{
+			if (!decode())
+				fail("decode failed", c.name);
+			n++;
+			t1 = clock::now();
+		} while (std::chrono::duration<double>(t1 - t0).count() < opt.min_time);
+
+		double secs = std::chrono::duration<double>(t1 - t0).count();
+		best = std::max(best, (double)c.input.size() * (double)n / secs / 1e6);
+	}
+
+	if (!std::equal(c.input.begin(), c.input.end(), output.begin()))
+		fail("decoded data doesn't match", c.name);
+
+	return best;
+}
+
+static bool stream_decode(
+	int (*stream_run)(lz4_dec_stream_state*), lz4_dec_stream_state& dec,
+	const std::vector<uint8_t>& block, std::vector<uint8_t>& output, std::size_t out_len, std::size_t chunk,
+	unsigned int flags = 0)
+{
+	lz4_dec_stream_init_ex(&dec, flags);
+
+	dec.in = block.data();
+	auto in_end = block.data() + block.size();
+	dec.out = output.data();
+	auto out_end = output.data() + out_len;
+
+	while (dec.out < out_end)
+	{
+		dec.avail_in = std::min((std::size_t)(in_end - dec.in), chunk);
+		dec.avail_out = std::min((std::size_t)(out_end - dec.out), chunk);
+
+		if (stream_run(&dec))
+			return false;
+	}
+
+	return true;
+}
+
+static void add_result(const options& opt, std::vector<result>& results, result r)
+{
+	if (!opt.json)
+		std::printf("%s,%s,%zu,%u,%zu,%zu,%zu,%.1f,%.0f\n", r.corpus.c_str(), r.decoder.c_str(),
+			r.chunk, r.threads, r.batch, r.input_len, r.compressed_len, r.mbps, r.msgs_per_s);
+	else
+		std::fprintf(stderr, "%s %s %zu %u %zu: %.1f MB/s\n", r.corpus.c_str(), r.decoder.c_str(),
+			r.chunk, r.threads, r.batch, r.mbps);
+	std::fflush(stdout);
+
+	results.push_back(std::move(r));
+}
+
+static void bench_corpus(const options& opt, const corpus& c, std::vector<result>& results)
+{
+	std::vector<uint8_t> output(c.input.size() + 64);
+
+	auto add = [&](const char* decoder, std::size_t chunk, unsigned int threads, std::size_t compressed_len, double mbps)
+	{
+		double msgs_per_s = c.input.empty() ? 0 : mbps * 1e6 / (double)c.input.size();
+		add_result(opt, results, {c.name, decoder, chunk, threads, 1, c.input.size(), compressed_len, mbps, msgs_per_s});
+	};
+
+	add("LZ4_decompress_safe", 0, 1, c.block.size(), measure(opt, c, output, [&]
+	{
+		return LZ4_decompress_safe((const char*)c.block.data(), (char*)output.data(), (int)c.block.size(), (int)c.input.size()) == (int)c.input.size();
+	}));
+
+	std::vector<std::size_t> chunks;
+	if (opt.quick)
+		chunks = {4096, 0};
+	else
+		chunks = {64, 256, 1024, 4096, 16384, 65536, 0};
+
+	auto dec = std::make_unique<lz4_dec_stream_state>();
+
+	static const struct
+	{
+		const char* name;
+		int (*run)(lz4_dec_stream_state*);
+		unsigned int flags;
+	} stream_decoders[] =
+	{
+		{"lz4_dec_stream_run", lz4_dec_stream_run, 0},
+		{"lz4_dec_stream_run_dst_uncached", lz4_dec_stream_run_dst_uncached, 0},
+		{"lz4_dec_stream_run_dst_nt", lz4_dec_stream_run_dst_nt, 0},
+		{"lz4_dec_stream_run_auto", lz4_dec_stream_run_auto, 0},
+		//the same, hashing the output as they go (compare with the rows above)
+		{"lz4_dec_stream_run+xxh32", lz4_dec_stream_run, LZ4_DEC_STREAM_XXH32},
+		{"lz4_dec_stream_run_dst_uncached+xxh32", lz4_dec_stream_run_dst_uncached, LZ4_DEC_STREAM_XXH32},
+		{"lz4_dec_stream_run_dst_nt+xxh32", lz4_dec_stream_run_dst_nt, LZ4_DEC_STREAM_XXH32},
+	};
+
+	for (auto& sd : stream_decoders)
+		for (auto chunk : chunks)
+			add(sd.name, chunk, 1, c.block.size(), measure(opt, c, output, [&]
+			{
+				return stream_decode(sd.run, *dec, c.block, output, c.input.size(), chunk ? chunk : SIZE_MAX, sd.flags);
+			}));
+
+	add("lz4_dec_stream_run_slack", 0, 1, c.block.size(), measure(opt, c, output, [&]
+	{
+		return stream_decode([](lz4_dec_stream_state* s) { return lz4_dec_stream_run_slack(s, 64); },
+			*dec, c.block, output, c.input.size(), SIZE_MAX);
+	}));
+
+	//the whole message in one call, over chains of chunk-sized segments
+	for (auto chunk : chunks)
+	{
+		if (!chunk)
+			continue;
+
+		std::vector<lz4_dec_stream_span> in_segs;
+		for (std::size_t at = 0; at < c.block.size(); at += chunk)
+			in_segs.push_back({c.block.data() + at, std::min(chunk, c.block.size() - at)});
+
+		std::vector<lz4_dec_stream_iov> out_segs;
+		for (std::size_t at = 0; at < c.input.size(); at += chunk)
+			out_segs.push_back({output.data() + at, std::min(chunk, c.input.size() - at)});
+
+		add("lz4_dec_stream_runv", chunk, 1, c.block.size(), measure(opt, c, output, [&]
+		{
+			lz4_dec_stream_init(dec.get());
+
+			std::size_t in_len, out_len;
+			return !lz4_dec_stream_runv(dec.get(), in_segs.data(), in_segs.size(), &in_len,
+				out_segs.data(), out_segs.size(), &out_len) && out_len == c.input.size();
+		}));
+	}
+
+	//a consumer that reads the decoded bytes in place (checking them against the
+	//input) and never copies them anywhere, output is left as the decoders above left it
+	for (auto chunk : chunks)
+		add("lz4_dec_stream_peek", chunk, 1, c.block.size(), measure(opt, c, output, [&]
+		{
+			lz4_dec_stream_init(dec.get());
+
+			dec->in = c.block.data();
+			auto in_end = c.block.data() + c.block.size();
+			std::size_t in_chunk = chunk ? chunk : SIZE_MAX;
+
+			std::size_t n_done = 0;
+			while (n_done < c.input.size())
+			{
+				dec->avail_in = std::min((std::size_t)(in_end - dec->in), in_chunk);
+
+				lz4_dec_stream_span span[2];
+				if (lz4_dec_stream_peek(dec.get(), span))
+					return false;
+
+				std::size_t n = 0;
+				for (auto& sp : span)
+				{
+					if (sp.len > c.input.size() - n_done - n ||
+						std::memcmp(sp.data, c.input.data() + n_done + n, sp.len) != 0)
+						return false;
+					n += sp.len;
+				}
+
+				lz4_dec_stream_consume(dec.get(), n);
+				n_done += n;
+			}
+
+			return true;
+		}));
+
+	//only how much the data decodes to, and then the sequences themselves,
+	//with no output at all (output is again left as the decoders above left it)
+	auto scan = [&](std::size_t chunk, bool seqs)
+	{
+		lz4_dec_stream_init(dec.get());
+
+		dec->in = c.block.data();
+		auto in_end = c.block.data() + c.block.size();
+		std::size_t in_chunk = chunk ? chunk : SIZE_MAX;
+
+		std::size_t out_len = 0;
+		while (dec->in != in_end)
+		{
+			dec->avail_in = std::min((std::size_t)(in_end - dec->in), in_chunk);
+
+			if (!seqs)
+			{
+				if (lz4_dec_stream_scan(dec.get(), &out_len))
+					return false;
+				continue;
+			}
+
+			lz4_dec_stream_seq seq;
+			int ret;
+			while ((ret = lz4_dec_stream_next_seq(dec.get(), &seq)) > 0)
+				out_len += seq.lit_len + seq.mat_len;
+			if (ret)
+				return false;
+		}
+
+		return out_len == c.input.size();
+	};
+
+	for (auto chunk : chunks)
+		add("lz4_dec_stream_scan", chunk, 1, c.block.size(), measure(opt, c, output, [&] { return scan(chunk, false); }));
+	for (auto chunk : chunks)
+		add("lz4_dec_stream_next_seq", chunk, 1, c.block.size(), measure(opt, c, output, [&] { return scan(chunk, true); }));
+
+	//lz4_stream::istream, read in chunk-sized pieces (compare with lz4_dec_stream_run
+	//at the same chunk size, which is what a caller of the C API would write)
+	for (auto chunk : chunks)
+		add("lz4_stream::istream", chunk, 1, c.block.size(), measure(opt, c, output, [&]
+		{
+			memory_source src(c.block);
+			lz4_stream::istream in(&src);
+
+			std::size_t at = 0, read_len = chunk ? chunk : c.input.size();
+			while (at < c.input.size() && in.read((char*)output.data() + at, (std::streamsize)std::min(read_len, c.input.size() - at)))
+				at += (std::size_t)in.gcount();
+
+			return at == c.input.size();
+		}));
+
+	//powers of two, then max_threads itself
+	std::vector<unsigned int> thread_counts;
+	for (unsigned int n = 1; n < opt.max_threads; n *= 2)
+		thread_counts.push_back(n);
+	thread_counts.push_back(opt.max_threads);
+
+	for (auto n_threads : thread_counts)
+		add("lz4_frame_dec_parallel", 0, n_threads, c.frame.size(), measure(opt, c, output, [&]
+		{
+			auto out_len = output.size();
+			return !lz4_frame_dec_parallel(c.frame.data(), c.frame.size(), output.data(), &out_len, n_threads) &&
+				out_len == c.input.size();
+		}));
+}
+
+//many small messages, each with its own decoder state
+static void bench_messages(const options& opt, std::vector<result>& results)
+{
+	const std::size_t msg_len = 512;
+	const std::size_t n_msgs = 512; //with a state apiece that's over 32 MiB of them, well past the cache
+
+	std::vector<uint8_t> source;
+	short_runs{}(source);
+	std::vector<uint8_t> noise_bytes;
+	noise{}(noise_bytes);
+
+	//part structured, part noise, all different
+	std::vector<std::vector<uint8_t>> inputs(n_msgs), blocks(n_msgs);
+	std::size_t compressed_len = 0;
+	for (std::size_t i = 0; i < n_msgs; i++)
+	{
+		auto at = source.begin() + (std::ptrdiff_t)(i * 1531 % (source.size() - msg_len));
+		inputs[i].assign(at, at + (std::ptrdiff_t)(msg_len * 3 / 4));
+		auto nat = noise_bytes.begin() + (std::ptrdiff_t)(i * 97);
+		inputs[i].insert(inputs[i].end(), nat, nat + (std::ptrdiff_t)(msg_len - inputs[i].size()));
+
+		blocks[i].resize((std::size_t)LZ4_compressBound((int)msg_len));
+		blocks[i].resize((std::size_t)LZ4_compress_default((const char*)inputs[i].data(), (char*)blocks[i].data(), (int)msg_len, (int)blocks[i].size()));
+		compressed_len += blocks[i].size();
+	}
+
+	std::vector<uint8_t> output(n_msgs * msg_len);
+	auto states = std::make_unique<lz4_dec_stream_state[]>(n_msgs);
+	std::vector<lz4_dec_stream_state*> batch(n_msgs);
+
+	auto measure_msgs = [&](std::size_t n, bool use_batch)
+	{
+		using clock = std::chrono::steady_clock;
+
+		double best = 0;
+		for (int r = 0; r < opt.reps; r++)
+		{
+			std::size_t n_done = 0;
+			auto t0 = clock::now();
+			auto t1 = t0;
+			do
+			{
+				for (std::size_t i = 0; i < n_msgs; i += n)
+				{
+					std::size_t m = std::min(n, n_msgs - i);
+					for (std::size_t j = i; j < i + m; j++)
+					{
+						auto& dec = states[j];
+						lz4_dec_stream_init(&dec);
+						dec.in = blocks[j].data();
+						dec.avail_in = blocks[j].size();
+						dec.out = output.data() + j * msg_len;
+						dec.avail_out = msg_len;
+						batch[j] = &dec;
+					}
+
+					if (use_batch)
+					{
+						if (lz4_dec_stream_run_prefetched(batch.data() + i, m, nullptr))
+							fail("decode failed", "messages");
+					}
+					else
+					{
+						for (std::size_t j = i; j < i + m; j++)
+							if (lz4_dec_stream_run(batch[j]))
+								fail("decode failed", "messages");
+					}
+				}
+
+				n_done += n_msgs;
+				t1 = clock::now();
+			} while (std::chrono::duration<double>(t1 - t0).count() < opt.min_time);
+
+			best = std::max(best, (double)n_done / std::chrono::duration<double>(t1 - t0).count());
+		}
+
+		for (std::size_t i = 0; i < n_msgs; i++)
+			if (!std::equal(inputs[i].begin(), inputs[i].end(), output.begin() + (std::ptrdiff_t)(i * msg_len)))
+				fail("decoded data doesn't match", "messages");
+
+		return best;
+	};
+
+	std::vector<std::size_t> batch_sizes;
+	if (opt.quick)
+		batch_sizes = {1, 16};
+	else
+		batch_sizes = {1, 2, 4, 8, 16, 32, 64};
+
+	for (auto n : batch_sizes)
+		for (bool use_batch : {false, true})
+		{
+			double msgs_per_s = measure_msgs(n, use_batch);
+			add_result(opt, results, {"messages", use_batch ? "lz4_dec_stream_run_prefetched" : "lz4_dec_stream_run",
+				0, 1, n, msg_len, compressed_len / n_msgs, msgs_per_s * (double)msg_len / 1e6, msgs_per_s});
+		}
+}
+
+static void print_json(const std::vector<result>& results)
+{
+	std::printf("[\n");
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		auto& r = results[i];
+		std::printf("  {\"corpus\": %s, \"decoder\": %s, \"chunk\": %zu, \"threads\": %u, \"batch\": %zu, "
+			"\"input_bytes\": %zu, \"compressed_bytes\": %zu, \"mb_per_s\": %.1f, \"msgs_per_s\": %.0f}%s\n",
+			json_quoted(r.corpus).c_str(), json_quoted(r.decoder).c_str(), r.chunk, r.threads, r.batch,
+			r.input_len, r.compressed_len, r.mbps, r.msgs_per_s, i + 1 < results.size() ? "," : "");
+	}
+	std::printf("]\n");
+}
+
+int main(int argc, char** argv)
+{
+	bench_tool_name = "lz4_stream-bench";
+
+	options opt;
+	opt.max_threads = std::thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+				fail("missing value for", arg);
+			return argv[++i];
+		};
+
+		if (arg == "--format")
+		{
+			auto f = value();
+			if (f != "csv" && f != "json")
+				fail("unknown format", f);
+			opt.json = f == "json";
+		}
+		else if (arg == "--min-time")
+			opt.min_time = std::atof(value().c_str());
+		else if (arg == "--reps")
+			opt.reps = std::max(1, std::atoi(value().c_str()));
+		else if (arg == "--threads")
+			opt.max_threads = (unsigned int)std::atoi(value().c_str());
+		else if (arg == "--quick")
+			opt.quick = true;
+		else if (arg.size() > 1 && arg[0] == '-')
+			fail("unknown option", arg);
+		else
+			opt.files.push_back(arg);
+	}
+
+	if (opt.max_threads < 1)
+		opt.max_threads = 1;
+
+	std::vector<corpus> corpora;
+	corpora.push_back(generated<big_mixed>("big mixed"));
+	corpora.push_back(generated<many_matches>("many matches"));
+	corpora.push_back(generated<short_runs>("short runs"));
+	corpora.push_back(generated<noise>("noise"));
+	corpora.push_back(generated<zeroes>("zeroes"));
+	for (auto& f : opt.files)
+		corpora.push_back(from_file(f));
+
+	if (!opt.json)
+		std::printf("corpus,decoder,chunk,threads,batch,input_bytes,compressed_bytes,mb_per_s,msgs_per_s\n");
+
+	std::vector<result> results;
+	for (auto& c : corpora)
+	{
+		compress_block(c);
+		compress_frame(c);
+		bench_corpus(opt, c, results);
+	}
+
+	bench_messages(opt, results);
+
+	if (opt.json)
+		print_json(results);
+
+	return 0;
+}
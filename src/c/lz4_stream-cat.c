@@ -0,0 +1,451 @@
+#define _GNU_SOURCE
+
+#include "lz4_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+	Decompresses LZ4 data to stdout (or a file), like lz4 -dc.
+
+	usage: lz4stream-cat [options] [FILE]
+
+		-o FILE			write to FILE instead of stdout
+		-r, --raw		the input is a single raw LZ4 block, not frames
+		--direct		write to regular files with O_DIRECT
+		--no-vmsplice	write to pipes with plain write()
+		-v, --stats		print throughput and CPU time to stderr (and the
+						decoder's counts, if built with LZ4STREAM_STATS)
+
+	Without FILE (or with -), the input is read from stdin. Otherwise
+	it's mapped into memory and handed to the decoder in one piece.
+	Frames are detected by their magic number; anything else is taken
+	to be a raw block. A raw block carries no length or checksum of its
+	own, so truncation is only caught roughly: one that's cut off right
+	before a match offset looks complete (see lz4_dec_stream_may_end).
+
+	Output goes through a ring of large chunks, each filled completely
+	before it's written. When the output is a pipe, the chunks are
+	vmspliced into it instead of copied, and the ring is made big
+	enough that a chunk is only reused once the pipe can no longer
+	hold any of it. That's only safe if the reader copies the data out
+	of the pipe (rather than splicing it onward); pass --no-vmsplice if
+	it might not. With --direct the chunks (which are page aligned) go
+	straight to disk, bypassing the page cache; the final partial
+	chunk is written normally.
+*/
+
+#define CHUNK_LEN		((size_t)1 << 20)
+#define CHUNK_ALIGN		((size_t)4096)	//for O_DIRECT, also leaves room for run_slack
+#define READ_LEN		((size_t)1 << 20)
+
+#define FRAME_MAGIC					0x184D2204u
+#define FRAME_SKIPPABLE_MAGIC		0x184D2A50u
+#define FRAME_SKIPPABLE_MAGIC_MASK	0xFFFFFFF0u
+
+enum { OUT_WRITE, OUT_VMSPLICE, OUT_DIRECT };
+
+typedef struct output
+{
+	int			fd;
+	int			mode;
+
+	uint8_t		*ring;
+	unsigned	n_chunks, cur;
+	size_t		fill;		//how much of the current chunk is decoded
+
+	uint64_t	total;
+} output;
+
+typedef struct decoder
+{
+	int						frames;
+	lz4_dec_stream_state	raw;
+	lz4_frame_dec_state		frame;
+} decoder;
+
+static const char *prog = "lz4stream-cat";
+
+static void die(const char *what, const char *detail)
+{
+	if (detail)
+		fprintf(stderr, "%s: %s: %s\n", prog, what, detail);
+	else
+		fprintf(stderr, "%s: %s\n", prog, what);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *chunk_at(const output *o, unsigned i)
+{
+	return o->ring + (size_t)i * (CHUNK_LEN + CHUNK_ALIGN);
+}
+
+static void output_init(output *o, int fd, int direct, int vmsplice_ok)
+{
+	struct stat st;
+	if (fstat(fd, &st))
+		die("can't stat output", strerror(errno));
+
+	o->fd = fd;
+	o->mode = OUT_WRITE;
+	o->n_chunks = 1;
+	o->cur = 0;
+	o->fill = 0;
+	o->total = 0;
+
+#ifdef __linux__
+	if (S_ISFIFO(st.st_mode) && vmsplice_ok)
+	{
+		//once a pipe's worth of data has gone in after a chunk, the
+		//chunk's been read out of the pipe and may be reused
+		fcntl(fd, F_SETPIPE_SZ, (int)CHUNK_LEN);
+		int pipe_len = fcntl(fd, F_GETPIPE_SZ);
+		if (pipe_len > 0)
+		{
+			o->mode = OUT_VMSPLICE;
+			o->n_chunks = (unsigned)(((size_t)pipe_len + CHUNK_LEN - 1) / CHUNK_LEN) + 1;
+		}
+	}
+	else if (S_ISREG(st.st_mode) && direct)
+	{
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+		int fl = fcntl(fd, F_GETFL);
+		if (pos >= 0 && pos % (off_t)CHUNK_ALIGN == 0 && fl >= 0 && !fcntl(fd, F_SETFL, fl | O_DIRECT))
+			o->mode = OUT_DIRECT;
+		else
+			fprintf(stderr, "%s: O_DIRECT unavailable, writing normally\n", prog);
+	}
+#else
+	(void)st;
+	(void)direct;
+	(void)vmsplice_ok;
+#endif
+
+	//mapped rather than allocated: a vmspliced chunk is still read out
+	//of the pipe after we're done, and malloc would scribble on it
+	void *ring = mmap(NULL, o->n_chunks * (CHUNK_LEN + CHUNK_ALIGN),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED)
+		die("out of memory", NULL);
+	o->ring = ring;
+}
+
+//the pipe keeps its own references to vmspliced pages, so unmapping them is safe
+static void output_free(output *o)
+{
+	munmap(o->ring, o->n_chunks * (CHUNK_LEN + CHUNK_ALIGN));
+}
+
+static void write_all(int fd, const uint8_t *p, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			die("write failed", strerror(errno));
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+}
+
+//writes out the current chunk and moves on to the next
+static void output_flush(output *o)
+{
+	uint8_t *p = chunk_at(o, o->cur);
+	size_t len = o->fill;
+
+#ifdef __linux__
+	if (o->mode == OUT_VMSPLICE)
+	{
+		while (len)
+		{
+			struct iovec iov = { p, len };
+			ssize_t n = vmsplice(o->fd, &iov, 1, 0);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				die("vmsplice failed", strerror(errno));
+			}
+			p += n;
+			len -= (size_t)n;
+		}
+	}
+	else if (o->mode == OUT_DIRECT && len % CHUNK_ALIGN)
+	{
+		//O_DIRECT wants whole blocks, and only the last chunk isn't
+		size_t head = len - len % CHUNK_ALIGN;
+		write_all(o->fd, p, head);
+
+		fcntl(o->fd, F_SETFL, fcntl(o->fd, F_GETFL) & ~O_DIRECT);
+		o->mode = OUT_WRITE;
+		write_all(o->fd, p + head, len - head);
+	}
+	else
+#endif
+	{
+		write_all(o->fd, p, len);
+	}
+
+	o->total += o->fill;
+	o->fill = 0;
+	o->cur = (o->cur + 1) % o->n_chunks;
+}
+
+static void decoder_init(decoder *d, int frames)
+{
+	d->frames = frames;
+	if (frames)
+		lz4_frame_dec_init(&d->frame);
+	else
+		lz4_dec_stream_init(&d->raw);
+}
+
+//decodes all of [in, in + len), writing out every chunk that fills up
+static void decode(decoder *d, output *o, const uint8_t *in, size_t len)
+{
+	while (len)
+	{
+		uint8_t *out = chunk_at(o, o->cur) + o->fill;
+		size_t avail_out = CHUNK_LEN - o->fill;
+		size_t prev_len = len, prev_fill = o->fill;
+		int err;
+
+		if (d->frames)
+		{
+			d->frame.in = in;
+			d->frame.avail_in = len;
+			d->frame.out = out;
+			d->frame.avail_out = avail_out;
+
+			err = lz4_frame_dec_run(&d->frame);
+
+			in = d->frame.in;
+			len = d->frame.avail_in;
+			o->fill += avail_out - d->frame.avail_out;
+		}
+		else
+		{
+			d->raw.in = in;
+			d->raw.avail_in = len;
+			d->raw.out = out;
+			d->raw.avail_out = avail_out;
+
+			//every chunk has CHUNK_ALIGN bytes to spare after it
+			err = lz4_dec_stream_run_slack(&d->raw, CHUNK_ALIGN);
+
+			in = d->raw.in;
+			len = d->raw.avail_in;
+			o->fill += avail_out - d->raw.avail_out;
+		}
+
+		if (err)
+			die("corrupt input", NULL);
+
+		if (o->fill == CHUNK_LEN)
+			output_flush(o);
+		else if (len == prev_len && o->fill == prev_fill)
+			die("decoder is stuck", NULL);
+	}
+}
+
+static int looks_like_frames(const uint8_t *in, size_t len)
+{
+	if (len < 4)
+		return 0;
+
+	uint32_t magic = (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+	return magic == FRAME_MAGIC || (magic & FRAME_SKIPPABLE_MAGIC_MASK) == FRAME_SKIPPABLE_MAGIC;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: %s [-o FILE] [-r|--raw] [--direct] [--no-vmsplice] [-v|--stats] [FILE]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *in_path = NULL;
+	const char *out_path = NULL;
+	int raw = 0, direct = 0, vmsplice_ok = 1, stats = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "-o"))
+		{
+			if (++i >= argc)
+				usage();
+			out_path = argv[i];
+		}
+		else if (!strcmp(arg, "-r") || !strcmp(arg, "--raw"))
+			raw = 1;
+		else if (!strcmp(arg, "--direct"))
+			direct = 1;
+		else if (!strcmp(arg, "--no-vmsplice"))
+			vmsplice_ok = 0;
+		else if (!strcmp(arg, "-v") || !strcmp(arg, "--stats"))
+			stats = 1;
+		else if (arg[0] == '-' && arg[1])
+			usage();
+		else if (!in_path)
+			in_path = arg;
+		else
+			usage();
+	}
+
+	int in_fd = STDIN_FILENO;
+	if (in_path && strcmp(in_path, "-"))
+	{
+		in_fd = open(in_path, O_RDONLY);
+		if (in_fd < 0)
+			die(in_path, strerror(errno));
+	}
+
+	int out_fd = STDOUT_FILENO;
+	if (out_path)
+	{
+		out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (out_fd < 0)
+			die(out_path, strerror(errno));
+	}
+
+	output o;
+	output_init(&o, out_fd, direct, vmsplice_ok);
+	int out_mode = o.mode; //O_DIRECT gets turned off for the tail
+
+	decoder *d = malloc(sizeof(decoder));
+	if (!d)
+		die("out of memory", NULL);
+
+	double t0 = now();
+	uint64_t in_total = 0;
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (!fstat(in_fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+
+	if (map != MAP_FAILED)
+	{
+		size_t len = (size_t)st.st_size;
+		madvise(map, len, MADV_SEQUENTIAL);
+
+		decoder_init(d, !raw && looks_like_frames(map, len));
+		if (!d->frames)
+			lz4_dec_stream_begin_block(&d->raw, len);
+		decode(d, &o, map, len);
+		in_total = len;
+
+		if (!d->frames && !lz4_dec_stream_block_done(&d->raw))
+			die("truncated input", NULL);
+
+		munmap(map, len);
+	}
+	else
+	{
+		uint8_t *buf = malloc(READ_LEN);
+		if (!buf)
+			die("out of memory", NULL);
+
+		size_t have = 0;
+		int started = 0, eof = 0;
+		while (!eof)
+		{
+			ssize_t n = read(in_fd, buf + have, READ_LEN - have);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				die("read failed", strerror(errno));
+			}
+			if (!n)
+				eof = 1;
+			have += (size_t)n;
+			in_total += (uint64_t)n;
+
+			if (!started)
+			{
+				//a pipe may hand over the magic number a piece at a time
+				if (have < 4 && !eof)
+					continue;
+
+				decoder_init(d, !raw && looks_like_frames(buf, have));
+				started = 1;
+			}
+
+			decode(d, &o, buf, have);
+			have = 0;
+		}
+
+		if (!d->frames && in_total && !lz4_dec_stream_may_end(&d->raw))
+			die("truncated input", NULL);
+
+		free(buf);
+	}
+
+	if (d->frames && !lz4_frame_dec_done(&d->frame))
+		die("truncated input", NULL);
+
+	if (o.fill)
+		output_flush(&o);
+
+	if (out_path && close(out_fd))
+		die("close failed", strerror(errno));
+
+	if (stats)
+	{
+		double secs = now() - t0;
+
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		double user = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec * 1e-6;
+		double sys = (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec * 1e-6;
+
+		static const char *const modes[] = { "write", "vmsplice", "O_DIRECT" };
+		fprintf(stderr,
+			"%s: %llu -> %llu bytes (%s, %s) in %.3f s: %.1f MB/s, %.3f s user, %.3f s sys\n",
+			prog, (unsigned long long)in_total, (unsigned long long)o.total,
+			d->frames ? "frames" : "raw block", modes[out_mode],
+			secs, secs > 0 ? (double)o.total / secs / 1e6 : 0.0, user, sys);
+
+		//and what the decoder got up to, if the library counts that
+		const lz4_dec_stream_stats *st = d->frames ?
+			lz4_frame_dec_get_stats(&d->frame) :
+			lz4_dec_stream_get_stats(&d->raw);
+		if (st)
+		{
+			char text[4096];
+			lz4_dec_stream_stats_format(st, text, sizeof(text));
+			fputs(text, stderr);
+		}
+	}
+
+	free(d);
+	output_free(&o);
+	return 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//generators for test and benchmark input, each one appends
+//a deterministic sequence of bytes to the vector it's given
+
+template <std::size_t N, uint8_t Val = 0>
+struct constant_span
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		input.resize(input.size() + N, Val);
+	}
+};
+
+template <uint8_t Start, uint8_t End>
+struct counting_span
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		if constexpr (Start < End)
+		{
+			input.reserve(input.size() + (End - Start) + 1);
+			for (uint8_t i = Start; i != End; i++)
+				input.push_back(i);
+		}
+		else if constexpr (End < Start)
+		{
+			input.reserve(input.size() + (Start - End) + 1);
+			for (uint8_t i = Start; i != End; i--)
+				input.push_back(i);
+
+		}
+
+		input.push_back(End);
+	}
+};
+
+template <std::size_t N, std::uint32_t Seed = 0xDEADBEEF>
+struct xorshift_uints
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		input.reserve(input.size() + N * 4);
+
+		//https://en.wikipedia.org/wiki/Xorshift
+
+		std::uint32_t n = Seed;
+		for (std::size_t i = 0; i < N; i++)
+		{
+			n ^= n << 13;
+			n ^= n >> 17;
+			n ^= n << 5;
+
+			input.push_back((uint8_t)(n >> 0));
+			input.push_back((uint8_t)(n >> 8));
+			input.push_back((uint8_t)(n >> 16));
+			input.push_back((uint8_t)(n >> 24));
+		}
+	}
+};
+
+template <typename... Ts>
+struct chained_generators
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		(Ts{}(input),...);
+	}
+};
+
+//repeats the last Len bytes of whatever came before
+template <std::size_t Len>
+struct echo_tail
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		std::vector<uint8_t> tail(input.end() - (std::ptrdiff_t)Len, input.end());
+		input.insert(input.end(), tail.begin(), tail.end());
+	}
+};
+
+template <typename Gen, std::size_t Reps>
+struct repeated_generator
+{
+	void operator()(std::vector<uint8_t>& input) const
+	{
+		for (std::size_t i = 0; i < Reps; i++)
+			Gen{}(input);
+	}
+};
@@ -0,0 +1,502 @@
+#include "lz4_stream.h"
+#include "lz4_stream-bench-common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+	Per-call decoding latency, for consumers that take their output a
+	small window at a time.
+
+	usage: lz4_stream-latency [options] [files...]
+
+		--format csv|json	output format (default: csv)
+		--calls N			time at least N calls per measurement (default: 200000)
+		--no-counters		don't try to read hardware performance counters
+		--quick				256 and 4096 byte windows only
+
+	The decoder gets all of the compressed input up front, and decodes
+	it into the same chunk-byte window over and over, the way a real-time
+	consumer would. Every call is timed on its own, and the times (less
+	the clock's own overhead) are reported as percentiles, in ns.
+
+	On Linux, a second run over the same calls reads the CPU's counters
+	(cycles, instructions, branch misses, L1D and last-level cache read
+	misses) with perf_event_open, enabling them just around each call,
+	and reports averages per call. Only user-space events are counted,
+	and the cost of switching the counters on and off is measured and
+	subtracted. If the kernel won't hand out a counter (see
+	/proc/sys/kernel/perf_event_paranoid), or it doesn't exist on this
+	CPU, its column is left empty (null in JSON).
+*/
+
+using mixed = chained_generators<
+	xorshift_uints<0x10000/4>,
+	constant_span<0x1000>,
+	repeated_generator<
+		chained_generators<
+			counting_span<40, 255>,
+			counting_span<132, 0>,
+			counting_span<60, 140>
+		>, 128>,
+	constant_span<0x10000, 0x0F>,
+	repeated_generator<
+		chained_generators<
+			counting_span<0, 255>,
+			xorshift_uints<0x1000>,
+			counting_span<255, 0>
+		>, 16>
+>;
+
+using short_runs = repeated_generator<
+	chained_generators<
+		repeated_generator<counting_span<1, 2>, 64>,
+		repeated_generator<counting_span<1, 3>, 64>,
+		repeated_generator<counting_span<1, 7>, 64>,
+		repeated_generator<counting_span<1, 15>, 64>,
+		xorshift_uints<0x40>
+	>, 256>;
+
+using noise = xorshift_uints<0x40000>;
+
+struct options
+{
+	bool json = false;
+	std::size_t calls = 200000;
+	bool counters = true;
+	bool quick = false;
+	std::vector<std::string> files;
+};
+
+static const char* const counter_names[] =
+{
+	"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses",
+};
+
+static constexpr std::size_t n_counters = std::size(counter_names);
+
+struct result
+{
+	std::string corpus;
+	std::string decoder;
+	std::size_t chunk;
+	std::size_t calls;
+	double mean_ns;
+	double p50_ns, p99_ns, p999_ns, max_ns;
+	bool have[n_counters];
+	double per_call[n_counters];
+};
+
+/*
+	A group of hardware counters, switched on only around the code being
+	measured. Whichever counters can't be opened are simply missing.
+*/
+
+#if defined(__linux__)
+
+struct perf_counters
+{
+	int fds[n_counters];
+	uint64_t ids[n_counters];
+	int leader = -1;
+
+	explicit perf_counters(bool wanted)
+	{
+		static const struct
+		{
+			uint32_t type;
+			uint64_t config;
+		} events[n_counters] =
+		{
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+				(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+		};
+
+		int first_errno = 0;
+		for (std::size_t i = 0; i < n_counters; i++)
+		{
+			fds[i] = -1;
+			if (!wanted)
+				continue;
+
+			perf_event_attr attr{};
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.disabled = leader < 0; //the rest follow the leader
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+				PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fds[i] < 0)
+			{
+				if (!first_errno)
+					first_errno = errno;
+				continue;
+			}
+
+			if (ioctl(fds[i], PERF_EVENT_IOC_ID, &ids[i]) != 0)
+			{
+				close(fds[i]);
+				fds[i] = -1;
+				continue;
+			}
+
+			if (leader < 0)
+				leader = fds[i];
+		}
+
+		if (wanted && leader < 0)
+			std::fprintf(stderr, "lz4_stream-latency: no performance counters (%s), timing only\n",
+				std::strerror(first_errno));
+	}
+
+	~perf_counters()
+	{
+		for (int fd : fds)
+			if (fd >= 0)
+				close(fd);
+	}
+
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator=(const perf_counters&) = delete;
+
+	bool available() const { return leader >= 0; }
+
+	void reset() { ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP); }
+	void start() { ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP); }
+	void stop() { ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP); }
+
+	//the totals since reset, false for counters that didn't count
+	void read_totals(bool have[n_counters], double totals[n_counters]) const
+	{
+		for (std::size_t i = 0; i < n_counters; i++)
+		{
+			have[i] = false;
+			totals[i] = 0;
+		}
+
+		//nr, time_enabled, time_running, then {value, id} for each
+		uint64_t buf[3 + 2 * n_counters];
+		if (::read(leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)))
+			return;
+		if (!buf[2])
+			return; //the group never got onto the PMU
+
+		for (std::size_t j = 0; j < buf[0] && j < n_counters; j++)
+		{
+			uint64_t id = buf[4 + 2 * j];
+			for (std::size_t i = 0; i < n_counters; i++)
+				if (fds[i] >= 0 && ids[i] == id)
+				{
+					have[i] = true;
+					//scale up in case the group was multiplexed with something else
+					totals[i] = (double)buf[3 + 2 * j] * (double)buf[1] / (double)buf[2];
+				}
+		}
+	}
+};
+
+#else
+
+struct perf_counters
+{
+	explicit perf_counters(bool) {}
+
+	bool available() const { return false; }
+
+	void reset() {}
+	void start() {}
+	void stop() {}
+
+	void read_totals(bool have[n_counters], double totals[n_counters]) const
+	{
+		for (std::size_t i = 0; i < n_counters; i++)
+		{
+			have[i] = false;
+			totals[i] = 0;
+		}
+	}
+};
+
+#endif
+
+//decodes all of c through window, one call per window's worth; around(call)
+//wraps each call in whatever is doing the measuring, returns the number of calls
+template <typename Around>
+static std::size_t windowed_pass(
+	int (*run)(lz4_dec_stream_state*), lz4_dec_stream_state& dec, const corpus& c,
+	std::vector<uint8_t>& window, bool verify, Around&& around)
+{
+	lz4_dec_stream_init(&dec);
+	dec.in = c.block.data();
+	dec.avail_in = c.block.size();
+
+	std::size_t at = 0, calls = 0;
+	while (at < c.input.size())
+	{
+		dec.out = window.data();
+		dec.avail_out = std::min(window.size(), c.input.size() - at);
+
+		int err = 0;
+		around([&] { err = run(&dec); });
+		calls++;
+		if (err)
+			fail("decode failed", c.name);
+
+		auto n = (std::size_t)(dec.out - window.data());
+		if (!n)
+			fail("decoder stalled", c.name);
+		if (verify && !std::equal(window.data(), dec.out, c.input.begin() + (std::ptrdiff_t)at))
+			fail("decoded data doesn't match", c.name);
+		at += n;
+	}
+
+	return calls;
+}
+
+//what a pair of back-to-back clock reads costs, to take off every sample
+static double clock_overhead_ns()
+{
+	using clock = std::chrono::steady_clock;
+
+	std::vector<double> ns(10001);
+	for (auto& t : ns)
+	{
+		auto t0 = clock::now();
+		auto t1 = clock::now();
+		t = std::chrono::duration<double, std::nano>(t1 - t0).count();
+	}
+
+	std::sort(ns.begin(), ns.end());
+	return ns[ns.size() / 2];
+}
+
+static result measure(const options& opt, perf_counters& pc, double clock_ns,
+	const char* decoder, int (*run)(lz4_dec_stream_state*), const corpus& c, std::size_t chunk)
+{
+	using clock = std::chrono::steady_clock;
+
+	auto dec = std::make_unique<lz4_dec_stream_state>();
+	std::vector<uint8_t> window(chunk);
+
+	result r{};
+	r.corpus = c.name;
+	r.decoder = decoder;
+	r.chunk = chunk;
+
+	//check the output once, and warm everything up
+	windowed_pass(run, *dec, c, window, true, [](auto&& call) { call(); });
+
+	std::vector<double> ns;
+	ns.reserve(opt.calls + c.input.size() / chunk + 1);
+	while (ns.size() < opt.calls)
+		windowed_pass(run, *dec, c, window, false, [&](auto&& call)
+		{
+			auto t0 = clock::now();
+			call();
+			auto t1 = clock::now();
+			ns.push_back(std::max(0.0, std::chrono::duration<double, std::nano>(t1 - t0).count() - clock_ns));
+		});
+
+	r.calls = ns.size();
+
+	double sum = 0;
+	for (double t : ns)
+		sum += t;
+	r.mean_ns = sum / (double)ns.size();
+
+	std::sort(ns.begin(), ns.end());
+	auto pct = [&](double q) { return ns[std::min(ns.size() - 1, (std::size_t)(q * (double)ns.size()))]; };
+	r.p50_ns = pct(0.5);
+	r.p99_ns = pct(0.99);
+	r.p999_ns = pct(0.999);
+	r.max_ns = ns.back();
+
+	if (pc.available())
+	{
+		//the same calls again, counting
+		pc.reset();
+		std::size_t calls = 0;
+		while (calls < r.calls)
+			calls += windowed_pass(run, *dec, c, window, false, [&](auto&& call)
+			{
+				pc.start();
+				call();
+				pc.stop();
+			});
+
+		double totals[n_counters];
+		pc.read_totals(r.have, totals);
+
+		//and as many calls to nothing at all, for the cost of start and stop
+		pc.reset();
+		for (std::size_t i = 0; i < calls; i++)
+		{
+			pc.start();
+			pc.stop();
+		}
+
+		bool have_base[n_counters];
+		double base[n_counters];
+		pc.read_totals(have_base, base);
+
+		for (std::size_t i = 0; i < n_counters; i++)
+			if (r.have[i])
+				r.per_call[i] = std::max(0.0, totals[i] - (have_base[i] ? base[i] : 0)) / (double)calls;
+	}
+
+	return r;
+}
+
+static void print_csv(const result& r)
+{
+	std::printf("%s,%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f", r.corpus.c_str(), r.decoder.c_str(),
+		r.chunk, r.calls, r.mean_ns, r.p50_ns, r.p99_ns, r.p999_ns, r.max_ns);
+	for (std::size_t i = 0; i < n_counters; i++)
+		if (r.have[i])
+			std::printf(",%.1f", r.per_call[i]);
+		else
+			std::printf(",");
+	std::printf("\n");
+	std::fflush(stdout);
+}
+
+static void print_json(const std::vector<result>& results)
+{
+	std::printf("[\n");
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		auto& r = results[i];
+		std::printf("  {\"corpus\": %s, \"decoder\": %s, \"chunk\": %zu, \"calls\": %zu, "
+			"\"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f",
+			json_quoted(r.corpus).c_str(), json_quoted(r.decoder).c_str(), r.chunk, r.calls,
+			r.mean_ns, r.p50_ns, r.p99_ns, r.p999_ns, r.max_ns);
+		for (std::size_t j = 0; j < n_counters; j++)
+			if (r.have[j])
+				std::printf(", \"%s\": %.1f", counter_names[j], r.per_call[j]);
+			else
+				std::printf(", \"%s\": null", counter_names[j]);
+		std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	std::printf("]\n");
+}
+
+int main(int argc, char** argv)
+{
+	bench_tool_name = "lz4_stream-latency";
+
+	options opt;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto value = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+				fail("missing value for", arg);
+			return argv[++i];
+		};
+
+		if (arg == "--format")
+		{
+			auto f = value();
+			if (f != "csv" && f != "json")
+				fail("unknown format", f);
+			opt.json = f == "json";
+		}
+		else if (arg == "--calls")
+			opt.calls = (std::size_t)std::max(1, std::atoi(value().c_str()));
+		else if (arg == "--no-counters")
+			opt.counters = false;
+		else if (arg == "--quick")
+			opt.quick = true;
+		else if (arg.size() > 1 && arg[0] == '-')
+			fail("unknown option", arg);
+		else
+			opt.files.push_back(arg);
+	}
+
+	std::vector<corpus> corpora;
+	corpora.push_back(generated<mixed>("mixed"));
+	corpora.push_back(generated<short_runs>("short runs"));
+	corpora.push_back(generated<noise>("noise"));
+	for (auto& f : opt.files)
+		corpora.push_back(from_file(f));
+
+	std::vector<std::size_t> chunks;
+	if (opt.quick)
+		chunks = {256, 4096};
+	else
+		chunks = {256, 512, 1024, 2048, 4096};
+
+	static const struct
+	{
+		const char* name;
+		int (*run)(lz4_dec_stream_state*);
+	} stream_decoders[] =
+	{
+		{"lz4_dec_stream_run", lz4_dec_stream_run},
+		{"lz4_dec_stream_run_dst_uncached", lz4_dec_stream_run_dst_uncached},
+		{"lz4_dec_stream_run_auto", lz4_dec_stream_run_auto},
+	};
+
+	perf_counters pc(opt.counters);
+	double clock_ns = clock_overhead_ns();
+
+	if (!opt.json)
+	{
+		std::printf("corpus,decoder,chunk,calls,mean_ns,p50_ns,p99_ns,p999_ns,max_ns");
+		for (auto name : counter_names)
+			std::printf(",%s", name);
+		std::printf("\n");
+	}
+
+	std::vector<result> results;
+	for (auto& c : corpora)
+	{
+		compress_block(c);
+		if (c.input.empty())
+			continue;
+
+		for (auto& sd : stream_decoders)
+			for (auto chunk : chunks)
+			{
+				auto r = measure(opt, pc, clock_ns, sd.name, sd.run, c, chunk);
+				if (!opt.json)
+					print_csv(r);
+				else
+					std::fprintf(stderr, "%s %s %zu: p50 %.1f ns, p99 %.1f ns\n",
+						r.corpus.c_str(), r.decoder.c_str(), r.chunk, r.p50_ns, r.p99_ns);
+				results.push_back(std::move(r));
+			}
+	}
+
+	if (opt.json)
+		print_json(results);
+
+	return 0;
+}
@@ -1,204 +1,2367 @@
 #include "lz4_stream.h"
+#include "lz4_stream.hpp"
+#include "lz4_stream_index.h"
+#include "lz4_stream_mt.h"
+#ifndef _WIN32
+#include "lz4_stream_uring.h"
+#include <unistd.h>
+#endif
+#include "lz4_stream-generators.hpp"
 
 #include "lz4.h"
+#include "lz4frame.h"
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <cassert>
 #include <climits>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <vector>
 
+template <typename Generator>
+static void test_block_runners();
+template <typename Generator>
+static void test_seq_runners();
+template <typename Generator>
+static void test_frame_runners();
+template <typename Generator>
+static uint32_t content_checksum();
+
+//lz4_dec_stream_run, but built on lz4_dec_stream_peek/consume: copy out
+//whatever of the peeked spans fits, consume just that
+static int pull_run(lz4_dec_stream_state* s)
+{
+	lz4_dec_stream_span span[2];
+	if (lz4_dec_stream_peek(s, span) != 0)
+		return -1;
+
+	for (auto& sp : span)
+	{
+		std::size_t n = std::min(sp.len, s->avail_out);
+		std::memcpy(s->out, sp.data, n);
+		s->out += n;
+		s->avail_out -= n;
+		lz4_dec_stream_consume(s, n);
+	}
+
+	return 0;
+}
+
+//lz4_dec_stream_run, but built on lz4_dec_stream_runv with the buffers
+//chopped up into segments of uneven sizes
+static int runv_run(lz4_dec_stream_state* s)
+{
+	static const std::size_t seg_lens[] = {1, 7, 300, 4096, 2};
+
+	std::vector<lz4_dec_stream_span> in;
+	for (std::size_t at = 0, k = 0; at < s->avail_in; k++)
+	{
+		std::size_t n = std::min(seg_lens[k % std::size(seg_lens)], s->avail_in - at);
+		in.push_back({s->in + at, n});
+		at += n;
+	}
+
+	std::vector<lz4_dec_stream_iov> out;
+	for (std::size_t at = 0, k = 3; at < s->avail_out; k++)
+	{
+		std::size_t n = std::min(seg_lens[k % std::size(seg_lens)], s->avail_out - at);
+		out.push_back({s->out + at, n});
+		at += n;
+	}
+
+	auto in_start = s->in;
+	auto avail_in = s->avail_in;
+	auto out_start = s->out;
+	auto avail_out = s->avail_out;
+
+	std::size_t in_len, out_len;
+	if (lz4_dec_stream_runv(s, in.data(), in.size(), &in_len, out.data(), out.size(), &out_len) != 0)
+		return -1;
+
+	//the fields are left inside the last segments, which here are one contiguous buffer
+	REQUIRE((!in_len || s->in == in_start + in_len));
+	REQUIRE((!out_len || s->out == out_start + out_len));
+
+	s->in = in_start + in_len;
+	s->avail_in = avail_in - in_len;
+	s->out = out_start + out_len;
+	s->avail_out = avail_out - out_len;
+
+	return 0;
+}
+
+//lz4_dec_stream_run_auto, called on a few bytes of output at a time, with
+//the odd run of big calls in between, so it switches engines as it goes
+static int auto_switching_run(lz4_dec_stream_state* s)
+{
+	auto out_end = s->out + s->avail_out;
+
+	for (unsigned int k = 0;; k++)
+	{
+		auto prev_in = s->in;
+		auto prev_out = s->out;
+
+		s->avail_out = std::min<std::size_t>((std::size_t)(out_end - s->out), k % 48 < 40 ? 97 : 0x10000);
+		if (lz4_dec_stream_run_auto(s) != 0)
+			return -1;
+
+		if (s->out == out_end || (s->in == prev_in && s->out == prev_out))
+			break; //out of output, or of input
+	}
+
+	s->avail_out = (std::size_t)(out_end - s->out);
+	return 0;
+}
+
 template <typename Generator>
 struct test_data
 {
-	std::vector<uint8_t> input;
-	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> input;
+	std::vector<uint8_t> compressed;
+
+	test_data()
+	{
+		Generator{}(input);
+		assert(input.size() <= INT_MAX);
+
+		compressed.resize((std::size_t)LZ4_compressBound((int)input.size()));
+		auto compressed_len = LZ4_compress_default((const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size());
+		assert(compressed_len >= 0);
+		compressed.resize((std::size_t)compressed_len);
+	}
+
+	//move the test data out to globals to take setup out of the test execution timings
+	static const test_data instance;
+};
+
+template <typename Generator>
+/* static */ const test_data<Generator> test_data<Generator>::instance{};
+
+template <typename Generator>
+static void test_runners()
+{
+	auto& [input, compressed] = test_data<Generator>::instance;
+
+	std::vector<uint8_t> output;
+	auto test_runner = [&](auto stream_run, unsigned int flags = 0, std::size_t slack = 0)
+	{
+		const uint8_t canary = 0xA5;
+		const std::size_t canary_len = 64;
+
+		auto test_limited = [&](
+			std::size_t in_page_limit = SIZE_MAX,
+			std::size_t out_page_limit = SIZE_MAX)
+		{
+			output.clear();
+			output.resize(input.size()); //don't leak data through from prior test!
+			output.resize(input.size() + slack + canary_len, canary);
+
+			lz4_dec_stream_state dec;
+			lz4_dec_stream_init_ex(&dec, flags);
+
+			dec.in = compressed.data();
+			auto in_end = compressed.data() + compressed.size();
+			dec.out = output.data();
+			auto out_end = output.data() + input.size();
+
+			while (dec.out < out_end)
+			{
+				dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
+				dec.avail_out = std::min((std::size_t)(out_end - dec.out), out_page_limit);
+
+				auto stream_run_ret = stream_run(&dec);
+				REQUIRE(stream_run_ret == 0);
+			}
+
+			if (input.empty())
+			{
+				dec.avail_in = (std::size_t)(in_end - dec.in);
+				dec.avail_out = (std::size_t)(out_end - dec.out);
+
+				auto stream_run_ret = stream_run(&dec);
+				REQUIRE(stream_run_ret == 0);
+			}
+
+			REQUIRE(dec.avail_in == 0);
+			REQUIRE(dec.in == in_end);
+			REQUIRE(dec.avail_out == 0);
+			REQUIRE(dec.out == out_end);
+
+			if (!input.empty() && std::memcmp(input.data(), output.data(), input.size()) != 0)
+				for (std::size_t i = 0; i < input.size(); i++) //this loop ain't as fast as memcmp
+					if (input[i] != output[i]) //REQUIE is sloooooooooooow
+						REQUIRE(i != i);
+
+			if (flags & LZ4_DEC_STREAM_XXH32)
+				REQUIRE(lz4_dec_stream_xxh32(&dec) == content_checksum<Generator>());
+
+			//the slack may have been scribbled on, but nothing past it
+			for (std::size_t i = input.size() + slack; i < output.size(); i++)
+				REQUIRE(output[i] == canary);
+		};
+
+		SECTION("one shot")
+		{
+			test_limited();
+		}
+
+		if (input.size() > 1024)
+			SECTION("1K read")
+			{
+				test_limited(1024, SIZE_MAX);
+			}
+
+		if (input.size() > 1024)
+			SECTION("1K write")
+			{
+				test_limited(SIZE_MAX, 1024);
+			}
+
+		if (input.size() > 512)
+			SECTION("512B read")
+			{
+				test_limited(512, SIZE_MAX);
+			}
+
+		if (input.size() > 512)
+			SECTION("512B write")
+			{
+				test_limited(SIZE_MAX, 512);
+			}
+	};
+
+	SECTION("base")
+	{
+		test_runner(lz4_dec_stream_run);
+	}
+
+	SECTION("dst_uncached")
+	{
+		test_runner(lz4_dec_stream_run_dst_uncached);
+	}
+
+	SECTION("dst_nt")
+	{
+		test_runner(lz4_dec_stream_run_dst_nt);
+	}
+
+	SECTION("pull")
+	{
+		test_runner(pull_run);
+	}
+
+	SECTION("scatter/gather")
+	{
+		test_runner(runv_run);
+	}
+
+	SECTION("auto")
+	{
+		test_runner(lz4_dec_stream_run_auto);
+	}
+
+	SECTION("auto, switching")
+	{
+		test_runner(auto_switching_run);
+	}
+
+	SECTION("base, slack")
+	{
+		test_runner([](lz4_dec_stream_state* s) { return lz4_dec_stream_run_slack(s, 32); }, 0, 32);
+	}
+
+	SECTION("base, no SIMD")
+	{
+		test_runner(lz4_dec_stream_run, LZ4_DEC_STREAM_NO_SIMD);
+	}
+
+	SECTION("base, retained")
+	{
+		test_runner(lz4_dec_stream_run, LZ4_DEC_STREAM_RETAIN_OUTPUT);
+	}
+
+	SECTION("base, slack, retained")
+	{
+		test_runner([](lz4_dec_stream_state* s) { return lz4_dec_stream_run_slack(s, 32); }, LZ4_DEC_STREAM_RETAIN_OUTPUT, 32);
+	}
+
+	SECTION("auto, retained")
+	{
+		test_runner(auto_switching_run, LZ4_DEC_STREAM_RETAIN_OUTPUT);
+	}
+
+	SECTION("base, xxh32")
+	{
+		test_runner(lz4_dec_stream_run, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("dst_uncached, xxh32")
+	{
+		test_runner(lz4_dec_stream_run_dst_uncached, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("dst_nt, xxh32")
+	{
+		test_runner(lz4_dec_stream_run_dst_nt, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("pull, xxh32")
+	{
+		test_runner(pull_run, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("scatter/gather, xxh32")
+	{
+		test_runner(runv_run, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("base, retained, xxh32")
+	{
+		test_runner(lz4_dec_stream_run, LZ4_DEC_STREAM_RETAIN_OUTPUT | LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("auto, switching, xxh32")
+	{
+		test_runner(auto_switching_run, LZ4_DEC_STREAM_XXH32);
+	}
+
+	SECTION("dst_uncached, no SIMD")
+	{
+		test_runner(lz4_dec_stream_run_dst_uncached, LZ4_DEC_STREAM_NO_SIMD);
+	}
+
+	SECTION("sequences")
+	{
+		test_seq_runners<Generator>();
+	}
+
+	SECTION("blocks")
+	{
+		test_block_runners<Generator>();
+	}
+
+	SECTION("frame")
+	{
+		test_frame_runners<Generator>();
+	}
+}
+
+template <typename Generator>
+static void test_seq_runners()
+{
+	auto& [input, compressed] = test_data<Generator>::instance;
+
+	auto in_end = compressed.data() + compressed.size();
+
+	for (std::size_t in_page_limit : {(std::size_t)SIZE_MAX, (std::size_t)1024, (std::size_t)7})
+	{
+		//rebuild the output from nothing but the sequences
+		std::vector<uint8_t> output;
+		output.reserve(input.size());
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+		dec.in = compressed.data();
+
+		do
+		{
+			dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
+
+			lz4_dec_stream_seq seq;
+			int ret;
+			while ((ret = lz4_dec_stream_next_seq(&dec, &seq)) > 0)
+			{
+				REQUIRE((seq.lit_len || seq.mat_len));
+				output.insert(output.end(), seq.lit, seq.lit + seq.lit_len);
+
+				if (seq.mat_len)
+				{
+					REQUIRE(seq.mat_dst != 0);
+					REQUIRE(seq.mat_dst <= output.size());
+					for (std::size_t i = 0; i < seq.mat_len; i++)
+						output.push_back(output[output.size() - seq.mat_dst]);
+				}
+			}
+			REQUIRE(ret == 0);
+		} while (dec.in != in_end);
+
+		REQUIRE(output.size() == input.size());
+		if (output != input)
+			REQUIRE(output == input); //only compare them twice if they don't match, REQUIRE's slow
+
+		//and just the size
+		lz4_dec_stream_init(&dec);
+		dec.in = compressed.data();
+
+		std::size_t out_len = 0;
+		do
+		{
+			dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
+			REQUIRE(lz4_dec_stream_scan(&dec, &out_len) == 0);
+		} while (dec.in != in_end);
+
+		REQUIRE(out_len == input.size());
+	}
+}
+
+template <typename Generator>
+struct test_block_data
+{
+	static constexpr std::size_t block_len = 0x6000;
+
+	std::vector<uint8_t> input;
+
+	//input cut into block_len pieces and compressed
+	//as a series of independent or linked blocks
+	std::vector<uint8_t> independent, linked;
+	std::vector<std::size_t> independent_lens, linked_lens;
+
+	test_block_data()
+	{
+		Generator{}(input);
+
+		LZ4_stream_t stream;
+		LZ4_initStream(&stream, sizeof(stream));
+
+		for (std::size_t i = 0; i < input.size(); i += block_len)
+		{
+			auto src = (const char*)input.data() + i;
+			auto src_len = (int)std::min(block_len, input.size() - i);
+
+			auto compress = [&](std::vector<uint8_t>& dst, std::vector<std::size_t>& lens, auto&& compress_fn)
+			{
+				auto start = dst.size();
+				dst.resize(start + (std::size_t)LZ4_compressBound(src_len));
+				auto len = compress_fn((char*)dst.data() + start, (int)(dst.size() - start));
+				assert(len > 0);
+				dst.resize(start + (std::size_t)len);
+				lens.push_back((std::size_t)len);
+			};
+
+			compress(independent, independent_lens, [&](char* dst, int dst_len)
+			{
+				return LZ4_compress_default(src, dst, src_len, dst_len);
+			});
+			compress(linked, linked_lens, [&](char* dst, int dst_len)
+			{
+				return LZ4_compress_fast_continue(&stream, src, dst, src_len, dst_len, 1);
+			});
+		}
+	}
+
+	static const test_block_data instance;
+};
+
+template <typename Generator>
+/* static */ const test_block_data<Generator> test_block_data<Generator>::instance{};
+
+template <typename Generator>
+static void test_block_runners()
+{
+	auto& data = test_block_data<Generator>::instance;
+	auto& input = data.input;
+
+	std::vector<uint8_t> output;
+	auto test_runner = [&](int (*stream_run)(lz4_dec_stream_state*), bool sized = false)
+	{
+		auto test_limited = [&](
+			unsigned int flags,
+			const std::vector<uint8_t>& compressed,
+			const std::vector<std::size_t>& block_lens,
+			std::size_t in_page_limit = SIZE_MAX,
+			std::size_t out_page_limit = SIZE_MAX)
+		{
+			output.clear();
+			output.resize(input.size());
+
+			lz4_dec_stream_state dec;
+			lz4_dec_stream_init_ex(&dec, flags);
+
+			dec.in = compressed.data();
+			auto in_end = compressed.data() + compressed.size();
+			dec.out = output.data();
+			auto out_end = output.data() + output.size();
+
+			std::size_t decoded = 0; //nb: peek may decode ahead of dec.out
+			for (auto block_len : block_lens)
+			{
+				auto block_out_len = std::min(data.block_len, input.size() - decoded);
+				decoded += block_out_len;
+
+				if (sized)
+					lz4_dec_stream_begin_block_ex(&dec, block_len, block_out_len);
+				else
+					lz4_dec_stream_begin_block(&dec, block_len);
+
+				auto block_end = dec.in + block_len;
+				while (dec.in < block_end)
+				{
+					REQUIRE(!lz4_dec_stream_block_done(&dec));
+
+					//nb: deliberately offer input past the end of the block
+					dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
+					dec.avail_out = std::min((std::size_t)(out_end - dec.out), out_page_limit);
+
+					auto stream_run_ret = stream_run(&dec);
+					REQUIRE(stream_run_ret == 0);
+					REQUIRE(dec.in <= block_end);
+				}
+
+				REQUIRE(lz4_dec_stream_block_done(&dec));
+			}
+
+			//pull_run may still have output to hand over
+			while (dec.out < out_end)
+			{
+				auto prev_out = dec.out;
+				dec.avail_in = 0;
+				dec.avail_out = std::min((std::size_t)(out_end - dec.out), out_page_limit);
+				REQUIRE(stream_run(&dec) == 0);
+				REQUIRE(dec.out != prev_out);
+			}
+
+			REQUIRE(dec.in == in_end);
+			REQUIRE(dec.out == out_end);
+
+			if (!input.empty() && std::memcmp(input.data(), output.data(), input.size()) != 0)
+				for (std::size_t i = 0; i < input.size(); i++)
+					if (input[i] != output[i])
+						REQUIRE(i != i);
+		};
+
+		auto test_both = [&](std::size_t in_page_limit = SIZE_MAX, std::size_t out_page_limit = SIZE_MAX)
+		{
+			SECTION("independent")
+			{
+				test_limited(LZ4_DEC_STREAM_INDEPENDENT_BLOCKS, data.independent, data.independent_lens, in_page_limit, out_page_limit);
+			}
+
+			SECTION("linked")
+			{
+				test_limited(0, data.linked, data.linked_lens, in_page_limit, out_page_limit);
+			}
+		};
+
+		SECTION("one shot")
+		{
+			test_both();
+		}
+
+		if (input.size() > 1024)
+			SECTION("1K read")
+			{
+				test_both(1024, SIZE_MAX);
+			}
+
+		if (input.size() > 512)
+			SECTION("512B write")
+			{
+				test_both(SIZE_MAX, 512);
+			}
+	};
+
+	SECTION("base")
+	{
+		test_runner(lz4_dec_stream_run);
+	}
+
+	SECTION("dst_uncached")
+	{
+		test_runner(lz4_dec_stream_run_dst_uncached);
+	}
+
+	SECTION("base, sized")
+	{
+		test_runner(lz4_dec_stream_run, true);
+	}
+
+	SECTION("dst_uncached, sized")
+	{
+		test_runner(lz4_dec_stream_run_dst_uncached, true);
+	}
+
+	SECTION("dst_nt, sized")
+	{
+		test_runner(lz4_dec_stream_run_dst_nt, true);
+	}
+
+	SECTION("pull, sized")
+	{
+		test_runner(pull_run, true);
+	}
+}
+
+struct frame_config
+{
+	LZ4F_blockSizeID_t block_size;
+	LZ4F_blockMode_t block_mode;
+	bool checksums;
+};
+
+static const frame_config frame_configs[] =
+{
+	{LZ4F_max64KB, LZ4F_blockLinked, false},
+	{LZ4F_max256KB, LZ4F_blockIndependent, true},
+	{LZ4F_max4MB, LZ4F_blockLinked, true},
+};
+
+static void append_frame(std::vector<uint8_t>& stream, const std::vector<uint8_t>& input, const frame_config& cfg)
+{
+	LZ4F_preferences_t prefs{};
+	prefs.frameInfo.blockSizeID = cfg.block_size;
+	prefs.frameInfo.blockMode = cfg.block_mode;
+	if (cfg.checksums)
+	{
+		prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+		prefs.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+		prefs.frameInfo.contentSize = input.size();
+	}
+
+	auto start = stream.size();
+	stream.resize(start + LZ4F_compressFrameBound(input.size(), &prefs));
+	auto frame_len = LZ4F_compressFrame(stream.data() + start, stream.size() - start, input.data(), input.size(), &prefs);
+	assert(!LZ4F_isError(frame_len));
+	stream.resize(start + frame_len);
+}
+
+static void append_skippable_frame(std::vector<uint8_t>& stream, std::size_t len)
+{
+	const uint8_t header[] = {0x5A, 0x2A, 0x4D, 0x18, (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16), (uint8_t)(len >> 24)};
+	stream.insert(stream.end(), std::begin(header), std::end(header));
+	stream.resize(stream.size() + len, 0xCC);
+}
+
+template <typename Generator>
+struct test_frame_data
+{
+	std::vector<uint8_t> input;
+
+	//one stream per frame_configs entry, plus one holding
+	//two frames and a couple of skippable frames, which
+	//decodes to two copies of input
+	std::vector<uint8_t> streams[std::size(frame_configs) + 1];
+
+	test_frame_data()
+	{
+		Generator{}(input);
+
+		for (std::size_t i = 0; i < std::size(frame_configs); i++)
+			append_frame(streams[i], input, frame_configs[i]);
+
+		auto& multi = streams[std::size(frame_configs)];
+		append_skippable_frame(multi, 13);
+		append_frame(multi, input, frame_configs[0]);
+		append_skippable_frame(multi, 0);
+		append_frame(multi, input, frame_configs[1]);
+	}
+
+	static const test_frame_data instance;
+};
+
+template <typename Generator>
+/* static */ const test_frame_data<Generator> test_frame_data<Generator>::instance{};
+
+//the xxHash32 of the generator's output, as liblz4 put it in a frame's content checksum
+template <typename Generator>
+static uint32_t content_checksum()
+{
+	auto& stream = test_frame_data<Generator>::instance.streams[1];
+	assert(frame_configs[1].checksums);
+
+	const uint8_t* p = stream.data() + stream.size() - 4;
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+template <typename Generator>
+static void test_frame_runners()
+{
+	auto& [input, streams] = test_frame_data<Generator>::instance;
+
+	std::vector<uint8_t> expected, output;
+	auto test_runner = [&](int (*frame_run)(lz4_frame_dec_state*), unsigned int flags = 0)
+	{
+		auto test_limited = [&](
+			const std::vector<uint8_t>& stream,
+			std::size_t in_page_limit = SIZE_MAX,
+			std::size_t out_page_limit = SIZE_MAX)
+		{
+			output.clear();
+			output.resize(expected.size());
+
+			lz4_frame_dec_state dec;
+			lz4_frame_dec_init_ex(&dec, flags);
+
+			dec.in = stream.data();
+			auto in_end = stream.data() + stream.size();
+			dec.out = output.data();
+			auto out_end = output.data() + output.size();
+
+			while (dec.in < in_end)
+			{
+				dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
+				dec.avail_out = std::min((std::size_t)(out_end - dec.out), out_page_limit);
+
+				auto prev_in = dec.in;
+				auto prev_out = dec.out;
+
+				auto frame_run_ret = frame_run(&dec);
+				REQUIRE(frame_run_ret == 0);
+				REQUIRE((dec.in != prev_in || dec.out != prev_out));
+			}
+
+			REQUIRE(lz4_frame_dec_done(&dec));
+			REQUIRE(dec.out == out_end);
+
+			if (!expected.empty() && std::memcmp(expected.data(), output.data(), expected.size()) != 0)
+				for (std::size_t i = 0; i < expected.size(); i++)
+					if (expected[i] != output[i])
+						REQUIRE(i != i);
+		};
+
+		for (std::size_t i = 0; i < std::size(streams); i++)
+		{
+			expected = input;
+			if (i == std::size(frame_configs))
+				expected.insert(expected.end(), input.begin(), input.end());
+
+			SECTION("one shot")
+			{
+				test_limited(streams[i]);
+			}
+
+			if (input.size() > 1024)
+				SECTION("1K read")
+				{
+					test_limited(streams[i], 1024, SIZE_MAX);
+				}
+
+			if (input.size() > 512)
+				SECTION("512B write")
+				{
+					test_limited(streams[i], SIZE_MAX, 512);
+				}
+
+			SECTION("7B read, 5B write")
+			{
+				if (input.size() <= 0x10000)
+					test_limited(streams[i], 7, 5);
+			}
+		}
+	};
+
+	SECTION("base")
+	{
+		test_runner(lz4_frame_dec_run);
+	}
+
+	SECTION("dst_uncached")
+	{
+		test_runner(lz4_frame_dec_run_dst_uncached);
+	}
+
+	SECTION("base, verify checksums")
+	{
+		test_runner(lz4_frame_dec_run, LZ4_FRAME_DEC_VERIFY_CHECKSUMS);
+	}
+
+	SECTION("dst_uncached, verify checksums")
+	{
+		test_runner(lz4_frame_dec_run_dst_uncached, LZ4_FRAME_DEC_VERIFY_CHECKSUMS);
+	}
+
+	SECTION("parallel")
+	{
+		for (std::size_t i = 0; i < std::size(streams); i++)
+		{
+			expected = input;
+			if (i == std::size(frame_configs))
+				expected.insert(expected.end(), input.begin(), input.end());
+
+			for (unsigned int n_threads : {1u, 2u, 5u})
+			{
+				output.clear();
+				output.resize(expected.size() + 1);
+
+				auto out_len = output.size();
+				REQUIRE(lz4_frame_dec_parallel(streams[i].data(), streams[i].size(), output.data(), &out_len, n_threads) == 0);
+				REQUIRE(out_len == expected.size());
+				REQUIRE((expected.empty() || std::memcmp(expected.data(), output.data(), expected.size()) == 0));
+
+				if (!expected.empty())
+				{
+					out_len = expected.size() - 1;
+					REQUIRE(lz4_frame_dec_parallel(streams[i].data(), streams[i].size(), output.data(), &out_len, n_threads) != 0);
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("parallel frame with short blocks")
+{
+	//flushing after every update makes LZ4F emit blocks shorter than
+	//the frame's block size, which the parallel decoder can't place
+	//up front and has to hand off to the sequential decoder
+
+	std::vector<uint8_t> input;
+	repeated_generator<
+		chained_generators<
+			counting_span<0, 255>,
+			xorshift_uints<0x1000>
+		>, 16>{}(input);
+
+	LZ4F_preferences_t prefs{};
+	prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+	prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+	prefs.autoFlush = 1;
+
+	const std::size_t chunk_len = 10000;
+
+	LZ4F_cctx* cctx;
+	REQUIRE(!LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)));
+
+	std::vector<uint8_t> stream(LZ4F_compressBound(input.size(), &prefs) * 2 + LZ4F_HEADER_SIZE_MAX);
+	std::size_t stream_len = LZ4F_compressBegin(cctx, stream.data(), stream.size(), &prefs);
+	REQUIRE(!LZ4F_isError(stream_len));
+	for (std::size_t i = 0; i < input.size(); i += chunk_len)
+	{
+		auto n = LZ4F_compressUpdate(cctx, stream.data() + stream_len, stream.size() - stream_len,
+			input.data() + i, std::min(chunk_len, input.size() - i), nullptr);
+		REQUIRE(!LZ4F_isError(n));
+		stream_len += n;
+	}
+	auto n = LZ4F_compressEnd(cctx, stream.data() + stream_len, stream.size() - stream_len, nullptr);
+	REQUIRE(!LZ4F_isError(n));
+	stream_len += n;
+	LZ4F_freeCompressionContext(cctx);
+
+	std::vector<uint8_t> output(input.size());
+	auto out_len = output.size();
+	REQUIRE(lz4_frame_dec_parallel(stream.data(), stream_len, output.data(), &out_len, 4) == 0);
+	REQUIRE(out_len == input.size());
+	REQUIRE(output == input);
+}
+
+TEST_CASE("parallel frame header checks")
+{
+	//independent blocks, several of them, so the frame would be split up
+	std::vector<uint8_t> input;
+	xorshift_uints<0x10000>{}(input);
+
+	std::vector<uint8_t> stream;
+	append_frame(stream, input, {LZ4F_max64KB, LZ4F_blockIndependent, false});
+
+	//returns what each decoder made of the stream, sequential first
+	auto run_both = [&](const std::vector<uint8_t>& stream)
+	{
+		std::vector<uint8_t> output(input.size() + 0x100);
+
+		lz4_frame_dec_state dec;
+		lz4_frame_dec_init(&dec);
+		dec.in = stream.data();
+		dec.avail_in = stream.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		int seq_ret = lz4_frame_dec_run(&dec);
+
+		auto out_len = output.size();
+		int par_ret = lz4_frame_dec_parallel(stream.data(), stream.size(), output.data(), &out_len, 4);
+
+		return std::make_pair(seq_ret, par_ret);
+	};
+
+	REQUIRE(run_both(stream) == std::make_pair(0, 0));
+
+	//nb: no content size, so FLG and BD are followed by the header checksum
+	SECTION("reserved FLG bit")
+	{
+		auto bad = stream;
+		bad[4] |= 0x02;
+		auto [seq_ret, par_ret] = run_both(bad);
+		REQUIRE(seq_ret != 0);
+		REQUIRE(par_ret != 0);
+	}
+
+	SECTION("reserved BD bit")
+	{
+		auto bad = stream;
+		bad[5] |= 0x01;
+		auto [seq_ret, par_ret] = run_both(bad);
+		REQUIRE(seq_ret != 0);
+		REQUIRE(par_ret != 0);
+	}
+
+	SECTION("undefined block size")
+	{
+		auto bad = stream;
+		bad[5] = 0x00;
+		auto [seq_ret, par_ret] = run_both(bad);
+		REQUIRE(seq_ret != 0);
+		REQUIRE(par_ret != 0);
+	}
+
+	SECTION("dictionary ID")
+	{
+		//a well-formed one: the flag, and the ID itself ahead of the header checksum
+		auto bad = stream;
+		bad[4] |= 0x01;
+		bad.insert(bad.begin() + 6, {0x78, 0x56, 0x34, 0x12});
+		auto [seq_ret, par_ret] = run_both(bad);
+		REQUIRE(seq_ret != 0);
+		REQUIRE(par_ret != 0);
+	}
+}
+
+template <typename Generator>
+static void test_encoder()
+{
+	auto& [input, compressed] = test_data<Generator>::instance;
+
+	auto enc = std::make_unique<lz4_enc_stream_state>();
+
+	std::vector<uint8_t> encoded, output;
+	auto test_limited = [&](
+		std::size_t in_page_limit = SIZE_MAX,
+		std::size_t out_page_limit = SIZE_MAX)
+	{
+		encoded.clear();
+		encoded.resize((std::size_t)LZ4_compressBound((int)input.size()) + 16);
+
+		lz4_enc_stream_init(enc.get());
+
+		enc->in = input.data();
+		auto in_end = input.data() + input.size();
+		enc->out = encoded.data();
+		auto out_end = encoded.data() + encoded.size();
+
+		while (enc->in < in_end)
+		{
+			enc->avail_in = std::min((std::size_t)(in_end - enc->in), in_page_limit);
+			enc->avail_out = std::min((std::size_t)(out_end - enc->out), out_page_limit);
+
+			auto prev_in = enc->in;
+			auto prev_out = enc->out;
+
+			REQUIRE(lz4_enc_stream_run(enc.get()) == 0);
+			REQUIRE((enc->in != prev_in || enc->out != prev_out));
+		}
+
+		for (;;)
+		{
+			enc->avail_in = 0;
+			enc->avail_out = std::min((std::size_t)(out_end - enc->out), out_page_limit);
+
+			auto prev_out = enc->out;
+
+			auto finish_ret = lz4_enc_stream_finish(enc.get());
+			REQUIRE(finish_ret >= 0);
+			if (finish_ret)
+				break;
+
+			REQUIRE(enc->out != prev_out);
+		}
+
+		encoded.resize((std::size_t)(enc->out - encoded.data()));
+
+		//it should hold its own against LZ4_compress_default
+		REQUIRE(encoded.size() <= compressed.size() + compressed.size() / 8 + 16);
+
+		output.clear();
+		output.resize(input.size() + 1);
+
+		auto output_len = LZ4_decompress_safe((const char*)encoded.data(), (char*)output.data(), (int)encoded.size(), (int)output.size());
+		REQUIRE(output_len == (int)input.size());
+		REQUIRE((input.empty() || std::memcmp(input.data(), output.data(), input.size()) == 0));
+
+		std::fill(output.begin(), output.end(), 0);
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+		dec.in = encoded.data();
+		dec.avail_in = encoded.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		REQUIRE(lz4_dec_stream_run(&dec) == 0);
+		REQUIRE(dec.avail_in == 0);
+		REQUIRE(dec.avail_out == 1);
+		REQUIRE((input.empty() || std::memcmp(input.data(), output.data(), input.size()) == 0));
+	};
+
+	SECTION("one shot")
+	{
+		test_limited();
+	}
+
+	if (input.size() > 1024)
+		SECTION("1K read")
+		{
+			test_limited(1024, SIZE_MAX);
+		}
+
+	if (input.size() > 512)
+		SECTION("512B write")
+		{
+			test_limited(SIZE_MAX, 512);
+		}
+
+	SECTION("7B read, 5B write")
+	{
+		if (input.size() <= 0x40000)
+			test_limited(7, 5);
+	}
+}
+
+TEST_CASE("truncated block")
+{
+	auto input = std::vector<uint8_t>(0x1000, 0x55);
+	std::vector<uint8_t> compressed((std::size_t)LZ4_compressBound((int)input.size()));
+	compressed.resize((std::size_t)LZ4_compress_default((const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size()));
+
+	std::vector<uint8_t> output(input.size());
+
+	lz4_dec_stream_state dec;
+	lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_INDEPENDENT_BLOCKS);
+	lz4_dec_stream_begin_block(&dec, compressed.size() - 1);
+
+	dec.in = compressed.data();
+	dec.avail_in = compressed.size();
+	dec.out = output.data();
+	dec.avail_out = output.size();
+
+	REQUIRE(lz4_dec_stream_run(&dec) != 0);
+}
+
+TEST_CASE("unbounded block end")
+{
+	auto input = std::vector<uint8_t>(0x1000, 0x55);
+	std::vector<uint8_t> compressed((std::size_t)LZ4_compressBound((int)input.size()));
+	compressed.resize((std::size_t)LZ4_compress_default((const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size()));
+
+	//cut off in the last literal, and then not at all
+	for (std::size_t cut : {(std::size_t)1, (std::size_t)0})
+	{
+		std::vector<uint8_t> output(input.size());
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+
+		dec.in = compressed.data();
+		dec.avail_in = compressed.size() - cut;
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		REQUIRE(lz4_dec_stream_run(&dec) == 0);
+		REQUIRE(dec.avail_in == 0);
+		REQUIRE(!lz4_dec_stream_may_end(&dec) == (cut != 0));
+	}
+}
+
+TEST_CASE("declared block sizes")
+{
+	//a little container: two blocks back to back, then some junk
+	std::vector<uint8_t> input;
+	xorshift_uints<0x100>{}(input);
+	input.resize(input.size() + 0x700, 0x55);
+
+	std::vector<uint8_t> container;
+	std::vector<std::size_t> block_lens;
+	for (int i = 0; i < 2; i++)
+	{
+		auto start = container.size();
+		container.resize(start + (std::size_t)LZ4_compressBound((int)input.size()));
+		container.resize(start + (std::size_t)LZ4_compress_default((const char*)input.data(),
+			(char*)container.data() + start, (int)input.size(), (int)(container.size() - start)));
+		block_lens.push_back(container.size() - start);
+	}
+	container.resize(container.size() + 100, 0xFF);
+
+	//nb: not pull_run, whose output lags behind the block being done
+	int (*const runs[])(lz4_dec_stream_state*) = {lz4_dec_stream_run, lz4_dec_stream_run_dst_uncached, lz4_dec_stream_run_dst_nt};
+
+	//decodes both blocks, saying each holds out_len bytes, returns the first error
+	auto decode = [&](int (*stream_run)(lz4_dec_stream_state*), std::size_t out_len, std::size_t out_page_limit)
+	{
+		std::vector<uint8_t> output(input.size() * 2 + 0x100);
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_INDEPENDENT_BLOCKS);
+		dec.in = container.data();
+		dec.out = output.data();
+
+		for (auto block_len : block_lens)
+		{
+			lz4_dec_stream_begin_block_ex(&dec, block_len, out_len);
+			auto out_start = dec.out;
+
+			while (!lz4_dec_stream_block_done(&dec))
+			{
+				//the whole rest of the container, every time
+				dec.avail_in = (std::size_t)(container.data() + container.size() - dec.in);
+				dec.avail_out = std::min((std::size_t)(output.data() + output.size() - dec.out), out_page_limit);
+
+				auto prev_in = dec.in;
+				auto prev_out = dec.out;
+				if (stream_run(&dec) != 0)
+					return -1;
+				REQUIRE((dec.in != prev_in || dec.out != prev_out));
+			}
+
+			REQUIRE((std::size_t)(dec.out - out_start) == input.size());
+			REQUIRE(std::equal(input.begin(), input.end(), out_start));
+		}
+
+		REQUIRE(dec.in == container.data() + container.size() - 100);
+		return 0;
+	};
+
+	for (auto stream_run : runs)
+		for (std::size_t out_page_limit : {(std::size_t)SIZE_MAX, (std::size_t)7})
+		{
+			REQUIRE(decode(stream_run, input.size(), out_page_limit) == 0);
+			REQUIRE(decode(stream_run, SIZE_MAX, out_page_limit) == 0);
+
+			REQUIRE(decode(stream_run, input.size() - 1, out_page_limit) != 0);
+			REQUIRE(decode(stream_run, input.size() + 1, out_page_limit) != 0);
+			REQUIRE(decode(stream_run, 0, out_page_limit) != 0);
+		}
+
+	//scanning stops at the same block ends, and checks the same sizes
+	auto scan = [&](std::size_t out_len, std::size_t in_page_limit)
+	{
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_INDEPENDENT_BLOCKS);
+		dec.in = container.data();
+
+		for (auto block_len : block_lens)
+		{
+			lz4_dec_stream_begin_block_ex(&dec, block_len, out_len);
+
+			std::size_t scanned_len = 0;
+			while (!lz4_dec_stream_block_done(&dec))
+			{
+				dec.avail_in = std::min((std::size_t)(container.data() + container.size() - dec.in), in_page_limit);
+				if (lz4_dec_stream_scan(&dec, &scanned_len) != 0)
+					return -1;
+			}
+
+			REQUIRE(scanned_len == input.size());
+		}
+
+		REQUIRE(dec.in == container.data() + container.size() - 100);
+		return 0;
+	};
+
+	for (std::size_t in_page_limit : {(std::size_t)SIZE_MAX, (std::size_t)7})
+	{
+		REQUIRE(scan(input.size(), in_page_limit) == 0);
+		REQUIRE(scan(SIZE_MAX, in_page_limit) == 0);
+
+		REQUIRE(scan(input.size() - 1, in_page_limit) != 0);
+		REQUIRE(scan(input.size() + 1, in_page_limit) != 0);
+	}
+}
+
+TEST_CASE("match offsets at the window edge")
+{
+	//one long literal run, one match reaching back ofs bytes, and the trailing literals
+	auto make_block = [](std::size_t ofs, std::vector<uint8_t>& expected)
+	{
+		std::size_t lit_len = LZ4_STREAM_WINDOW_LEN + 16;
+
+		expected.resize(lit_len);
+		for (std::size_t i = 0; i < lit_len; i++)
+			expected[i] = (uint8_t)(i * 7 + (i >> 8));
+
+		std::vector<uint8_t> block;
+		block.push_back(0xF0);
+		for (std::size_t n = lit_len - 15; ; n -= 255)
+		{
+			block.push_back((uint8_t)(n < 255 ? n : 255));
+			if (n < 255)
+				break;
+		}
+		block.insert(block.end(), expected.begin(), expected.end());
+		block.push_back((uint8_t)ofs);
+		block.push_back((uint8_t)(ofs >> 8));
+
+		for (std::size_t i = 0; i < 4; i++)
+			expected.push_back(expected[expected.size() - ofs]);
+
+		block.push_back(0x50);
+		for (uint8_t i = 0; i < 5; i++)
+		{
+			block.push_back(i);
+			expected.push_back(i);
+		}
+
+		return block;
+	};
+
+	auto run_all = [](const std::vector<uint8_t>& block, std::size_t out_len, std::size_t chunk_len)
+	{
+		std::vector<std::vector<uint8_t>> results;
+
+		static const std::pair<int (*)(lz4_dec_stream_state*), unsigned int> stream_runs[] =
+		{
+			{lz4_dec_stream_run, 0},
+			{lz4_dec_stream_run_dst_uncached, 0},
+			{lz4_dec_stream_run_dst_nt, 0},
+			{lz4_dec_stream_run, LZ4_DEC_STREAM_RETAIN_OUTPUT},
+		};
+
+		for (auto [stream_run, flags] : stream_runs)
+		{
+			std::vector<uint8_t> output(out_len);
+
+			lz4_dec_stream_state dec;
+			lz4_dec_stream_init_ex(&dec, flags);
+			lz4_dec_stream_begin_block(&dec, block.size());
+
+			dec.in = block.data();
+			dec.avail_in = block.size();
+			dec.out = output.data();
+
+			int err = 0;
+			while (!err && dec.avail_in)
+			{
+				std::size_t n = std::min(chunk_len, (std::size_t)(output.data() + output.size() - dec.out));
+				dec.avail_out = n;
+				err = stream_run(&dec);
+				if (n && dec.avail_out == n && dec.avail_in)
+					break;
+			}
+
+			if (err)
+				output.clear();
+			else
+				output.resize((std::size_t)(dec.out - output.data()));
+			results.push_back(std::move(output));
+		}
+
+		return results;
+	};
+
+	std::size_t max_ofs = std::min<std::size_t>(LZ4_STREAM_WINDOW_LEN, 0xFFFF);
+
+	for (std::size_t chunk_len : {(std::size_t)SIZE_MAX, (std::size_t)7})
+	{
+		std::vector<uint8_t> expected;
+		auto block = make_block(max_ofs, expected);
+		for (auto& output : run_all(block, expected.size(), chunk_len))
+			REQUIRE(output == expected);
+
+		if (max_ofs < 0xFFFF)
+		{
+			block = make_block(max_ofs + 1, expected);
+			for (auto& output : run_all(block, expected.size(), chunk_len))
+				REQUIRE(output.empty());
+		}
+	}
+}
+
+TEST_CASE("short repeats")
+{
+	//a pat_len-byte literal, then a long match repeating it (mat_dst == pat_len), then
+	//the trailing literals; without SIMD, dst_uncached copies those matches a word at a
+	//time, and patterns that divide the word (1, 2, 4) need no realigning between words
+	//(this is mostly one for -DLZ4STREAM_SANITIZE=undefined)
+	for (std::size_t pat_len = 1; pat_len < sizeof(uintptr_t); pat_len++)
+	{
+		const std::size_t mat_len = 300;
+
+		std::vector<uint8_t> block, expected;
+		block.push_back((uint8_t)(pat_len << 4 | 0xF));
+		for (std::size_t i = 0; i < pat_len; i++)
+		{
+			block.push_back((uint8_t)(0xA0 + i));
+			expected.push_back((uint8_t)(0xA0 + i));
+		}
+		block.push_back((uint8_t)pat_len);
+		block.push_back(0);
+		for (std::size_t n = mat_len - 4 - 15; ; n -= 255)
+		{
+			block.push_back((uint8_t)(n < 255 ? n : 255));
+			if (n < 255)
+				break;
+		}
+		for (std::size_t i = 0; i < mat_len; i++)
+			expected.push_back(expected[i]);
+
+		block.push_back(0x50);
+		for (uint8_t i = 0; i < 5; i++)
+		{
+			block.push_back(i);
+			expected.push_back(i);
+		}
+
+		for (std::size_t chunk_len : {(std::size_t)SIZE_MAX, (std::size_t)13})
+		{
+			std::vector<uint8_t> output(expected.size());
+
+			auto dec = std::make_unique<lz4_dec_stream_state>();
+			lz4_dec_stream_init_ex(dec.get(), LZ4_DEC_STREAM_NO_SIMD);
+			dec->in = block.data();
+			dec->avail_in = block.size();
+			dec->out = output.data();
+
+			while (dec->avail_in)
+			{
+				std::size_t n = std::min(chunk_len, (std::size_t)(output.data() + output.size() - dec->out));
+				REQUIRE(n > 0);
+				dec->avail_out = n;
+				REQUIRE(lz4_dec_stream_run_dst_uncached(dec.get()) == 0);
+			}
+
+			REQUIRE(output == expected);
+#if LZ4_STREAM_STATS
+			REQUIRE(lz4_dec_stream_get_stats(dec.get())->cpy_mat_rle_short_dst > 0);
+#endif
+		}
+	}
+}
+
+TEST_CASE("slack, match from history")
+{
+	//a 16-byte literal, then a 20-byte match reaching all the way back to
+	//its start, then the trailing literals; the first call stops 8 bytes
+	//into the match, so the second finds the rest of it entirely in o_buf
+	//and nothing to copy out of its own output, even with slack to spare
+	//(this is mostly one for -DLZ4STREAM_SANITIZE=address)
+	std::vector<uint8_t> block, expected;
+	block.push_back(0xFF);
+	block.push_back(1);
+	for (uint8_t i = 0; i < 16; i++)
+	{
+		block.push_back((uint8_t)(0x30 + i));
+		expected.push_back((uint8_t)(0x30 + i));
+	}
+	block.push_back(16);
+	block.push_back(0);
+	block.push_back(1);
+	for (std::size_t i = 0; i < 20; i++)
+		expected.push_back(expected[expected.size() - 16]);
+
+	block.push_back(0x50);
+	for (uint8_t i = 0; i < 5; i++)
+	{
+		block.push_back(i);
+		expected.push_back(i);
+	}
+
+	lz4_dec_stream_state dec;
+	lz4_dec_stream_init(&dec);
+	dec.in = block.data();
+	dec.avail_in = block.size();
+
+	//separate allocations, so reading before the second is caught
+	const std::size_t slack = 32;
+	auto first = std::make_unique<uint8_t[]>(24);
+	dec.out = first.get();
+	dec.avail_out = 24;
+	REQUIRE(lz4_dec_stream_run_slack(&dec, 0) == 0);
+	REQUIRE(dec.avail_out == 0);
+
+	auto second = std::make_unique<uint8_t[]>(expected.size() - 24 + slack);
+	dec.out = second.get();
+	dec.avail_out = expected.size() - 24;
+	REQUIRE(lz4_dec_stream_run_slack(&dec, slack) == 0);
+	REQUIRE(dec.avail_out == 0);
+	REQUIRE(dec.avail_in == 0);
+
+	REQUIRE(std::equal(first.get(), first.get() + 24, expected.begin()));
+	REQUIRE(std::equal(second.get(), second.get() + (expected.size() - 24), expected.begin() + 24));
+}
+
+TEST_CASE("scatter/gather with empty segments")
+{
+	//empty segments may come with null data (this is mostly one for
+	//-DLZ4STREAM_SANITIZE=undefined)
+	std::vector<uint8_t> input;
+	xorshift_uints<0x100>{}(input);
+	repeated_generator<counting_span<0, 99>, 20>{}(input);
+
+	std::vector<uint8_t> compressed((std::size_t)LZ4_compressBound((int)input.size()));
+	compressed.resize((std::size_t)LZ4_compress_default((const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size()));
+
+	lz4_dec_stream_span in = {compressed.data(), compressed.size()};
+	std::size_t in_len, out_len;
+
+	//no output at all
+	lz4_dec_stream_state dec;
+	lz4_dec_stream_init(&dec);
+	REQUIRE(lz4_dec_stream_runv(&dec, &in, 1, &in_len, nullptr, 0, &out_len) == 0);
+	REQUIRE(out_len == 0);
+	REQUIRE(in_len < compressed.size());
+
+	//and 7-byte segments with empty ones in between, which matches reach back across
+	std::vector<uint8_t> output(input.size());
+	std::vector<lz4_dec_stream_iov> out;
+	for (std::size_t at = 0; at < output.size(); at += 7)
+	{
+		out.push_back({nullptr, 0});
+		out.push_back({output.data() + at, std::min<std::size_t>(7, output.size() - at)});
+	}
+	out.push_back({nullptr, 0});
+
+	lz4_dec_stream_init(&dec);
+	REQUIRE(lz4_dec_stream_runv(&dec, &in, 1, &in_len, out.data(), out.size(), &out_len) == 0);
+	REQUIRE(in_len == compressed.size());
+	REQUIRE(out_len == input.size());
+	REQUIRE(output == input);
+}
+
+TEST_CASE("dictionary")
+{
+	std::vector<uint8_t> dict;
+	xorshift_uints<0x2000>{}(dict);
+
+	//pieces from all over the dictionary mixed with fresh noise
+	std::vector<uint8_t> input;
+	std::vector<uint8_t> noise;
+	xorshift_uints<0x400, 0xBAADCAFE>{}(noise);
+	for (std::size_t i = 0; i < 8; i++)
+	{
+		std::size_t at = i * 0x3F1 % (dict.size() - 0x200);
+		input.insert(input.end(), dict.begin() + (std::ptrdiff_t)at, dict.begin() + (std::ptrdiff_t)at + 0x200);
+		input.insert(input.end(), noise.begin() + (std::ptrdiff_t)(i * 0x80), noise.begin() + (std::ptrdiff_t)(i * 0x80 + 0x80));
+	}
+	input.insert(input.end(), dict.begin(), dict.begin() + 0x100);
+
+	std::vector<uint8_t> compressed((std::size_t)LZ4_compressBound((int)input.size()));
+	{
+		LZ4_stream_t lz4;
+		LZ4_initStream(&lz4, sizeof(lz4));
+		LZ4_loadDict(&lz4, (const char*)dict.data(), (int)dict.size());
+		compressed.resize((std::size_t)LZ4_compress_fast_continue(&lz4,
+			(const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size(), 1));
+	}
+
+	auto decode = [&](int (*stream_run)(lz4_dec_stream_state*), std::size_t dict_skip, std::size_t out_page_limit, std::vector<uint8_t>& output,
+		unsigned int flags = 0)
+	{
+		output.assign(input.size(), 0);
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init_ex(&dec, flags);
+		lz4_dec_stream_set_dict(&dec, dict.data() + dict_skip, dict.size() - dict_skip);
+
+		dec.in = compressed.data();
+		dec.avail_in = compressed.size();
+		dec.out = output.data();
+
+		while (dec.out < output.data() + output.size())
+		{
+			dec.avail_out = std::min((std::size_t)(output.data() + output.size() - dec.out), out_page_limit);
+
+			auto prev_out = dec.out;
+			if (stream_run(&dec) != 0)
+				return -1;
+			if (dec.out == prev_out)
+				break;
+		}
+
+		return 0;
+	};
+
+	int (*const runs[])(lz4_dec_stream_state*) = {lz4_dec_stream_run, lz4_dec_stream_run_dst_uncached, lz4_dec_stream_run_dst_nt, pull_run};
+
+	std::vector<uint8_t> output;
+	for (auto stream_run : runs)
+		for (std::size_t out_page_limit : {(std::size_t)SIZE_MAX, (std::size_t)5})
+		{
+			REQUIRE(decode(stream_run, 0, out_page_limit, output) == 0);
+			REQUIRE(output == input);
+
+			//the data refers back into all of the dictionary, so half of it won't do
+			REQUIRE(decode(stream_run, dict.size() / 2, out_page_limit, output) != 0);
+		}
+
+	for (std::size_t out_page_limit : {(std::size_t)SIZE_MAX, (std::size_t)5})
+	{
+		REQUIRE(decode(lz4_dec_stream_run, 0, out_page_limit, output, LZ4_DEC_STREAM_RETAIN_OUTPUT) == 0);
+		REQUIRE(output == input);
+		REQUIRE(decode(lz4_dec_stream_run, dict.size() / 2, out_page_limit, output, LZ4_DEC_STREAM_RETAIN_OUTPUT) != 0);
+	}
+
+	SECTION("a match longer than the decoders' copy steps, all from the dictionary")
+	{
+		std::vector<uint8_t> big_dict;
+		xorshift_uints<0x8000 / 4, 0xF00DF00D>{}(big_dict);
+
+		std::vector<uint8_t> copied(big_dict.begin(), big_dict.begin() + 0x6000);
+		std::vector<uint8_t> packed((std::size_t)LZ4_compressBound((int)copied.size()));
+		LZ4_stream_t lz4;
+		LZ4_initStream(&lz4, sizeof(lz4));
+		LZ4_loadDict(&lz4, (const char*)big_dict.data(), (int)big_dict.size());
+		packed.resize((std::size_t)LZ4_compress_fast_continue(&lz4,
+			(const char*)copied.data(), (char*)packed.data(), (int)copied.size(), (int)packed.size(), 1));
+		REQUIRE(packed.size() < 0x100);
+
+		for (auto stream_run : runs)
+			for (unsigned int flags : {0u, (unsigned int)LZ4_DEC_STREAM_XXH32})
+			{
+				std::vector<uint8_t> out(copied.size());
+
+				lz4_dec_stream_state dec;
+				lz4_dec_stream_init_ex(&dec, flags);
+				lz4_dec_stream_set_dict(&dec, big_dict.data(), big_dict.size());
+				dec.in = packed.data();
+				dec.avail_in = packed.size();
+				dec.out = out.data();
+				dec.avail_out = out.size();
+
+				REQUIRE(stream_run(&dec) == 0);
+				REQUIRE(dec.avail_out == 0);
+				REQUIRE(out == copied);
+			}
+	}
+}
+
+TEST_CASE("retained output")
+{
+	//a literal, then a match reaching back two bytes, which is before the start
+	const std::vector<uint8_t> block = {0x10, 'a', 0x02, 0x00, 0x50, 1, 2, 3, 4, 5};
+
+	for (std::size_t chunk_len : {(std::size_t)SIZE_MAX, (std::size_t)1})
+	{
+		std::vector<uint8_t> output(10);
+
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_RETAIN_OUTPUT);
+		dec.in = block.data();
+		dec.avail_in = block.size();
+		dec.out = output.data();
+
+		int err = 0;
+		while (!err && dec.avail_in)
+		{
+			dec.avail_out = std::min(chunk_len, (std::size_t)(output.data() + output.size() - dec.out));
+			err = lz4_dec_stream_run(&dec);
+		}
+
+		//without any history window to fall back on, that's an error
+		REQUIRE(err != 0);
+	}
+}
+
+TEST_CASE("batch")
+{
+	std::vector<uint8_t> noise;
+	xorshift_uints<0x400>{}(noise);
+
+	const std::size_t n = 19;
+	std::vector<std::vector<uint8_t>> inputs(n), blocks(n), outputs(n);
+	auto states = std::make_unique<lz4_dec_stream_state[]>(n);
+	std::vector<lz4_dec_stream_state*> batch(n);
+
+	for (std::size_t i = 0; i < n; i++)
+	{
+		//a bit of noise, then a run of its own byte
+		inputs[i].assign(noise.begin(), noise.begin() + (std::ptrdiff_t)(i * 37 % noise.size()));
+		inputs[i].resize(inputs[i].size() + 100 + i, (uint8_t)i);
+
+		blocks[i].resize((std::size_t)LZ4_compressBound((int)inputs[i].size()));
+		blocks[i].resize((std::size_t)LZ4_compress_default((const char*)inputs[i].data(), (char*)blocks[i].data(), (int)inputs[i].size(), (int)blocks[i].size()));
+	}
+
+	//a zero offset
+	blocks[7] = {0x10, 0xAA, 0x00, 0x00};
+
+	for (std::size_t i = 0; i < n; i++)
+	{
+		outputs[i].resize(inputs[i].size());
+
+		lz4_dec_stream_init(&states[i]);
+		states[i].in = blocks[i].data();
+		states[i].avail_in = blocks[i].size();
+		states[i].out = outputs[i].data();
+		states[i].avail_out = outputs[i].size();
+		batch[i] = &states[i];
+	}
+
+	int results[n];
+	REQUIRE(lz4_dec_stream_run_prefetched(batch.data(), n, results) != 0);
+
+	for (std::size_t i = 0; i < n; i++)
+		if (i == 7)
+			REQUIRE(results[i] != 0);
+		else
+		{
+			REQUIRE(results[i] == 0);
+			REQUIRE(states[i].avail_in == 0);
+			REQUIRE(outputs[i] == inputs[i]);
+		}
+}
+
+template <typename State>
+struct index_ops;
+
+template <>
+struct index_ops<lz4_dec_stream_state>
+{
+	static void init(lz4_dec_stream_state* s) { lz4_dec_stream_init(s); }
+	static int run(lz4_dec_index* idx, lz4_dec_stream_state* s) { return lz4_dec_index_run(idx, s); }
+	static int plain_run(lz4_dec_stream_state* s) { return lz4_dec_stream_run(s); }
+	static int seek(const lz4_dec_index* idx, uint64_t pos, lz4_dec_stream_state* s, uint64_t* in_pos, uint64_t* at)
+		{ return lz4_dec_index_seek(idx, pos, s, in_pos, at); }
+};
+
+template <>
+struct index_ops<lz4_frame_dec_state>
+{
+	static void init(lz4_frame_dec_state* s) { lz4_frame_dec_init_ex(s, LZ4_FRAME_DEC_VERIFY_CHECKSUMS); }
+	static int run(lz4_dec_index* idx, lz4_frame_dec_state* s) { return lz4_frame_dec_index_run(idx, s); }
+	static int plain_run(lz4_frame_dec_state* s) { return lz4_frame_dec_run(s); }
+	static int seek(const lz4_dec_index* idx, uint64_t pos, lz4_frame_dec_state* s, uint64_t* in_pos, uint64_t* at)
+		{ return lz4_frame_dec_index_seek(idx, pos, s, in_pos, at); }
+};
+
+//indexes compressed in uneven chunks, then reads ranges back through a save/load round trip
+template <typename State>
+static void test_index(const std::vector<uint8_t>& compressed, const std::vector<uint8_t>& expected, uint64_t spacing)
+{
+	using ops = index_ops<State>;
+
+	std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> built(lz4_dec_index_create(spacing), lz4_dec_index_free);
+	REQUIRE(built);
+
+	auto dec = std::make_unique<State>();
+	ops::init(dec.get());
+
+	std::vector<uint8_t> output(expected.size());
+	dec->in = compressed.data();
+	auto in_end = compressed.data() + compressed.size();
+	dec->out = output.data();
+	auto out_end = output.data() + output.size();
+
+	for (std::size_t k = 1; dec->in < in_end || dec->out < out_end; k = k * 5 % 9001)
+	{
+		dec->avail_in = std::min((std::size_t)(in_end - dec->in), k);
+		dec->avail_out = std::min((std::size_t)(out_end - dec->out), k * 3 + 1);
+		REQUIRE(ops::run(built.get(), dec.get()) == 0);
+	}
+	REQUIRE(output == expected);
+	REQUIRE(lz4_dec_index_count(built.get()) == (expected.size() - 1) / spacing);
+
+	std::vector<uint8_t> saved(lz4_dec_index_save(built.get(), nullptr, 0));
+	REQUIRE(lz4_dec_index_save(built.get(), saved.data(), saved.size()) == saved.size());
+
+	std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_load(saved.data(), saved.size()), lz4_dec_index_free);
+	REQUIRE(idx);
+	REQUIRE(lz4_dec_index_count(idx.get()) == lz4_dec_index_count(built.get()));
+
+	for (uint64_t pos : {(uint64_t)0, spacing - 1, spacing, spacing + 1, expected.size() / 3, expected.size() / 2 + 7, expected.size() - 100})
+	{
+		const std::size_t len = 100;
+
+		ops::init(dec.get());
+		uint64_t in_pos, at;
+		REQUIRE(ops::seek(idx.get(), pos, dec.get(), &in_pos, &at) == 0);
+		REQUIRE(at <= pos);
+		REQUIRE(pos - at < spacing);
+
+		std::vector<uint8_t> range((std::size_t)(pos - at) + len);
+		dec->in = compressed.data() + in_pos;
+		dec->avail_in = compressed.size() - (std::size_t)in_pos;
+		dec->out = range.data();
+		dec->avail_out = range.size();
+		REQUIRE(ops::plain_run(dec.get()) == 0);
+		REQUIRE(dec->avail_out == 0);
+
+		REQUIRE(std::equal(range.begin() + (std::ptrdiff_t)(pos - at), range.end(), expected.begin() + (std::ptrdiff_t)pos));
+	}
+
+	//a truncated index doesn't load
+	REQUIRE(!lz4_dec_index_load(saved.data(), saved.size() - 1));
+}
+
+TEST_CASE("checkpoint index")
+{
+	using gen = chained_generators<
+		xorshift_uints<0x10000>,
+		repeated_generator<counting_span<0, 255>, 512>,
+		constant_span<0x20000, 0x5A>,
+		repeated_generator<
+			chained_generators<
+				counting_span<0, 255>,
+				xorshift_uints<0x1000>,
+				counting_span<255, 0>
+			>, 16>
+	>;
+
+	SECTION("raw block")
+	{
+		auto& [input, block] = test_data<gen>::instance;
+		test_index<lz4_dec_stream_state>(block, input, 0x7000);
+	}
+
+	SECTION("frames")
+	{
+		auto& data = test_frame_data<gen>::instance;
+		for (std::size_t i = 0; i < std::size(frame_configs); i++)
+			test_index<lz4_frame_dec_state>(data.streams[i], data.input, 0x9000);
+
+		auto twice = data.input;
+		twice.insert(twice.end(), data.input.begin(), data.input.end());
+		test_index<lz4_frame_dec_state>(data.streams[std::size(frame_configs)], twice, 0x11000);
+	}
+
+	SECTION("checksums carry on after a seek")
+	{
+		auto& [input, block] = test_data<gen>::instance;
+		auto& frame = test_frame_data<gen>::instance.streams[1];
+		assert(frame_configs[1].checksums);
+
+		auto seek_and_finish = [&](auto& dec, auto seek, auto run, const std::vector<uint8_t>& compressed)
+		{
+			std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_create(0x8000), lz4_dec_index_free);
+
+			std::vector<uint8_t> output(input.size());
+			dec.in = compressed.data();
+			dec.avail_in = compressed.size();
+			dec.out = output.data();
+			dec.avail_out = output.size();
+			REQUIRE(seek.first(idx.get(), &dec) == 0);
+
+			//start over from a checkpoint, decode the rest
+			uint64_t in_pos, at;
+			REQUIRE(seek.second(idx.get(), input.size() / 2, &dec, &in_pos, &at) == 0);
+			REQUIRE(at > 0);
+
+			dec.in = compressed.data() + in_pos;
+			dec.avail_in = compressed.size() - (std::size_t)in_pos;
+			dec.out = output.data() + at;
+			dec.avail_out = output.size() - (std::size_t)at;
+			REQUIRE(run(&dec) == 0);
+			REQUIRE(dec.avail_out == 0);
+		};
+
+		lz4_dec_stream_state raw;
+		lz4_dec_stream_init_ex(&raw, LZ4_DEC_STREAM_XXH32);
+		seek_and_finish(raw, std::make_pair(lz4_dec_index_run, lz4_dec_index_seek), lz4_dec_stream_run, block);
+		REQUIRE(lz4_dec_stream_xxh32(&raw) == content_checksum<gen>());
+
+		//the content checksum's at the very end
+		lz4_frame_dec_state framed;
+		lz4_frame_dec_init_ex(&framed, LZ4_FRAME_DEC_VERIFY_CHECKSUMS);
+		seek_and_finish(framed, std::make_pair(lz4_frame_dec_index_run, lz4_frame_dec_index_seek), lz4_frame_dec_run, frame);
+		REQUIRE(framed.avail_in == 0);
+		REQUIRE(lz4_frame_dec_done(&framed));
+
+		//and indexing checks them too
+		auto bad = frame;
+		bad.back() ^= 1;
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_create(0x8000), lz4_dec_index_free);
+		std::vector<uint8_t> output(input.size());
+		lz4_frame_dec_init_ex(&framed, LZ4_FRAME_DEC_VERIFY_CHECKSUMS);
+		framed.in = bad.data();
+		framed.avail_in = bad.size();
+		framed.out = output.data();
+		framed.avail_out = output.size();
+		REQUIRE(lz4_frame_dec_index_run(idx.get(), &framed) != 0);
+	}
+
+	SECTION("seeking keeps the decoder's own flags")
+	{
+		auto& [input, block] = test_data<gen>::instance;
+
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_create(0x10000), lz4_dec_index_free);
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+
+		std::vector<uint8_t> output(input.size());
+		dec.in = block.data();
+		dec.avail_in = block.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+		REQUIRE(lz4_dec_index_run(idx.get(), &dec) == 0);
+
+		//the same index, saved and loaded, restores the same state
+		std::vector<uint8_t> saved(lz4_dec_index_save(idx.get(), nullptr, 0));
+		REQUIRE(lz4_dec_index_save(idx.get(), saved.data(), saved.size()) == saved.size());
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> loaded(lz4_dec_index_load(saved.data(), saved.size()), lz4_dec_index_free);
+		REQUIRE(loaded);
+
+		for (auto* from : {idx.get(), loaded.get()})
+		{
+			lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_NO_SIMD);
+			uint64_t in_pos, at;
+			REQUIRE(lz4_dec_index_seek(from, 0x28000, &dec, &in_pos, &at) == 0);
+			REQUIRE(at == 0x20000);
+			REQUIRE((dec.p_.flags & LZ4_DEC_STREAM_NO_SIMD));
+
+			std::vector<uint8_t> range(0x10000);
+			dec.in = block.data() + in_pos;
+			dec.avail_in = block.size() - (std::size_t)in_pos;
+			dec.out = range.data();
+			dec.avail_out = range.size();
+			REQUIRE(lz4_dec_stream_run_dst_uncached(&dec) == 0);
+			REQUIRE(std::equal(range.begin(), range.end(), input.begin() + 0x20000));
+		}
+
+		//a decoder retaining its output has no window to checkpoint, or restore
+		lz4_dec_stream_init_ex(&dec, LZ4_DEC_STREAM_RETAIN_OUTPUT);
+		uint64_t in_pos, at;
+		REQUIRE(lz4_dec_index_seek(idx.get(), 0x28000, &dec, &in_pos, &at) != 0);
+
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> retained(lz4_dec_index_create(0x10000), lz4_dec_index_free);
+		dec.in = block.data();
+		dec.avail_in = block.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+		REQUIRE(lz4_dec_index_run(retained.get(), &dec) != 0);
+	}
+
+	SECTION("the index is smaller than the output")
+	{
+		auto& [input, block] = test_data<gen>::instance;
+
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_create(0x10000), lz4_dec_index_free);
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+
+		std::vector<uint8_t> output(input.size());
+		dec.in = block.data();
+		dec.avail_in = block.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+		REQUIRE(lz4_dec_index_run(idx.get(), &dec) == 0);
+
+		//every window's 64 KiB, but they compress as well as the data does
+		auto n = lz4_dec_index_count(idx.get());
+		REQUIRE(n > 4);
+		REQUIRE(lz4_dec_index_save(idx.get(), nullptr, 0) < n * 0x10000 / 2);
+	}
+
+	SECTION("a corrupted index doesn't load")
+	{
+		auto& [input, block] = test_data<gen>::instance;
+
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> built(lz4_dec_index_create(0x10000), lz4_dec_index_free);
+		lz4_dec_stream_state dec;
+		lz4_dec_stream_init(&dec);
+
+		std::vector<uint8_t> output(input.size());
+		dec.in = block.data();
+		dec.avail_in = block.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+		REQUIRE(lz4_dec_index_run(built.get(), &dec) == 0);
+
+		std::vector<uint8_t> saved(lz4_dec_index_save(built.get(), nullptr, 0));
+		REQUIRE(lz4_dec_index_save(built.get(), saved.data(), saved.size()) == saved.size());
+
+		//the first checkpoint's block decoder fields follow the 32-byte
+		//header and its in and out positions, each a little-endian u32
+		const std::size_t lit_len = 48, mat_len = 52, mat_dst = 56, phase = 60, flags = 64, blk_left = 68;
+		auto patch = [&](std::vector<uint8_t>& buf, std::size_t at, uint32_t v)
+		{
+			for (int i = 0; i < 4; i++)
+				buf[at + (std::size_t)i] = (uint8_t)(v >> (i * 8));
+		};
+		auto loads = [](const std::vector<uint8_t>& buf)
+		{
+			std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_load(buf.data(), buf.size()), lz4_dec_index_free);
+			return idx != nullptr;
+		};
+
+		REQUIRE(loads(saved));
+
+		//mid-match, with no match offset (the decoder would divide by it)
+		auto bad = saved;
+		patch(bad, phase, 6);
+		patch(bad, mat_len, 5);
+		patch(bad, mat_dst, 0);
+		REQUIRE(!loads(bad));
+
+		//or one reaching past the window
+		patch(bad, mat_dst, LZ4_STREAM_WINDOW_LEN + 1);
+		REQUIRE(!loads(bad));
+
+		//mid-literal, with more of it to come than the block holds
+		bad = saved;
+		patch(bad, phase, 2);
+		patch(bad, lit_len, 100);
+		patch(bad, flags, 0x80000000u); //in a block...
+		patch(bad, blk_left, 10);
+		patch(bad, blk_left + 4, 0);
+		REQUIRE(!loads(bad));
+
+		//a window stored uncompressed that's shorter than it claims to be: find
+		//one (the noise at the start won't compress), and cut the index off after it
+		const std::size_t cp_len = 188, win_len = 180, win_packed = 184, count = 24;
+		auto get = [&](std::size_t at)
+		{
+			uint32_t v = 0;
+			for (int i = 0; i < 4; i++)
+				v |= (uint32_t)saved[at + (std::size_t)i] << (i * 8);
+			return v;
+		};
+
+		std::size_t cp = 32, n = 1;
+		while (!(get(cp + win_packed) & 0x80000000u) || get(cp + win_len) < 2)
+		{
+			cp += cp_len + (get(cp + win_packed) & 0x7FFFFFFFu);
+			n++;
+			REQUIRE(cp < saved.size());
+		}
+
+		bad = saved;
+		bad.resize(cp + cp_len + get(cp + win_len));
+		patch(bad, count, (uint32_t)n);
+		REQUIRE(loads(bad));
+
+		bad.resize(cp + cp_len + 1);
+		patch(bad, cp + win_packed, 0x80000000u | 1);
+		REQUIRE(!loads(bad));
+
+		//flags no checkpoint could have saved are dropped, so it still decodes right
+		bad = saved;
+		patch(bad, flags, LZ4_DEC_STREAM_RETAIN_OUTPUT | 0x20000000u);
+		std::unique_ptr<lz4_dec_index, void (*)(lz4_dec_index*)> idx(lz4_dec_index_load(bad.data(), bad.size()), lz4_dec_index_free);
+		REQUIRE(idx);
+
+		lz4_dec_stream_init(&dec);
+		uint64_t in_pos, at;
+		REQUIRE(lz4_dec_index_seek(idx.get(), 0x18000, &dec, &in_pos, &at) == 0);
+		REQUIRE(at == 0x10000);
+		REQUIRE(!(dec.p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT));
+
+		std::vector<uint8_t> range(0x10000);
+		dec.in = block.data() + in_pos;
+		dec.avail_in = block.size() - (std::size_t)in_pos;
+		dec.out = range.data();
+		dec.avail_out = range.size();
+		REQUIRE(lz4_dec_stream_run(&dec) == 0);
+		REQUIRE(std::equal(range.begin(), range.end(), input.begin() + 0x10000));
+	}
+}
+
+TEST_CASE("streambuf")
+{
+	auto& [input, block] = test_data<chained_generators<
+		xorshift_uints<0x8000>,
+		repeated_generator<counting_span<0, 255>, 512>,
+		constant_span<0x20000, 0x5A>
+	>>::instance;
 
-	test_data()
+	std::string compressed(block.begin(), block.end());
+
+	SECTION("read in odd pieces")
 	{
-		Generator{}(input);
-		assert(input.size() <= INT_MAX);
+		//a tiny input buffer, so the source gets read lots of times
+		std::istringstream source(compressed);
+		lz4_stream::istream in(source, 100);
 
-		compressed.resize((std::size_t)LZ4_compressBound((int)input.size()));
-		auto compressed_len = LZ4_compress_default((const char*)input.data(), (char*)compressed.data(), (int)input.size(), (int)compressed.size());
-		assert(compressed_len >= 0);
-		compressed.resize((std::size_t)compressed_len);
+		std::vector<uint8_t> output(input.size() + 1);
+		std::size_t at = 0;
+		for (std::size_t k = 1; in; k = k * 7 % 5003)
+		{
+			in.read((char*)output.data() + at, (std::streamsize)std::min(k, output.size() - at));
+			at += (std::size_t)in.gcount();
+		}
+
+		REQUIRE(in.eof());
+		REQUIRE(!in.bad());
+		REQUIRE(at == input.size());
+		output.resize(at);
+		REQUIRE(output == input);
 	}
 
-	//move the test data out to globals to take setup out of the test execution timings
-	static const test_data instance;
-};
+	SECTION("iterators")
+	{
+		std::istringstream source(compressed);
+		lz4_stream::istream in(source);
 
-template <typename Generator>
-/* static */ const test_data<Generator> test_data<Generator>::instance{};
+		std::vector<uint8_t> output(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>{});
+		REQUIRE(output == input);
+	}
 
-template <typename Generator>
-static void test_runners()
-{
-	auto& [input, compressed] = test_data<Generator>::instance;
+	SECTION("bad input")
+	{
+		std::istringstream source(std::string("\x10\xAA\x00\x00", 4));
+		lz4_stream::istream in(source);
 
-	std::vector<uint8_t> output;
-	auto test_runner = [&](int (*stream_run)(lz4_dec_stream_state*))
+		char ch;
+		REQUIRE(in.get(ch).bad());
+
+		std::istringstream source2(std::string("\x10\xAA\x00\x00", 4));
+		lz4_stream::istream in2(source2);
+		in2.exceptions(std::ios::badbit);
+		REQUIRE_THROWS_AS(in2.get(ch), lz4_stream::decode_error);
+	}
+
+	SECTION("truncated input")
 	{
-		auto test_limited = [&](
-			std::size_t in_page_limit = SIZE_MAX,
-			std::size_t out_page_limit = SIZE_MAX)
-		{
-			output.clear();
-			output.resize(input.size()); //don't leak data through from prior test!
+		//rather than ending early, as though that was all there was
+		std::istringstream source(compressed.substr(0, compressed.size() - 3000));
+		lz4_stream::istream in(source);
 
-			lz4_dec_stream_state dec;
-			lz4_dec_stream_init(&dec);
+		std::vector<char> output(input.size());
+		in.read(output.data(), (std::streamsize)output.size());
+		REQUIRE((std::size_t)in.gcount() < input.size());
+		REQUIRE(in.bad());
 
-			dec.in = compressed.data();
-			auto in_end = compressed.data() + compressed.size();
-			dec.out = output.data();
-			auto out_end = output.data() + output.size();
+		std::istringstream source2(compressed.substr(0, compressed.size() - 3000));
+		lz4_stream::istream in2(source2);
+		in2.exceptions(std::ios::badbit);
+		REQUIRE_THROWS_AS(in2.read(output.data(), (std::streamsize)output.size()), lz4_stream::decode_error);
 
-			while (dec.out < out_end)
-			{
-				dec.avail_in = std::min((std::size_t)(in_end - dec.in), in_page_limit);
-				dec.avail_out = std::min((std::size_t)(out_end - dec.out), out_page_limit);
+		//an empty source is just an empty stream
+		std::istringstream source3;
+		lz4_stream::istream in3(source3);
+		char ch;
+		REQUIRE(!in3.get(ch));
+		REQUIRE(in3.eof());
+		REQUIRE(!in3.bad());
+	}
 
-				auto stream_run_ret = stream_run(&dec);
-				REQUIRE(stream_run_ret == 0);
-			}
+	SECTION("spans")
+	{
+		lz4_stream::decoder dec;
+		std::vector<uint8_t> output(input.size());
 
-			if (output.empty())
-			{
-				dec.avail_in = (std::size_t)(in_end - dec.in);
-				dec.avail_out = (std::size_t)(out_end - dec.out);
+		std::span<const uint8_t> in(block);
+		std::span<uint8_t> out(output);
+		while (!out.empty())
+		{
+			auto r = dec.decode(in.first(std::min<std::size_t>(in.size(), 999)), out.first(std::min<std::size_t>(out.size(), 777)));
+			in = in.subspan(r.in_used);
+			out = out.subspan(r.out_used);
+		}
 
-				auto stream_run_ret = stream_run(&dec);
-				REQUIRE(stream_run_ret == 0);
-			}
+		REQUIRE(in.empty());
+		REQUIRE(output == input);
+	}
+}
 
-			REQUIRE(dec.avail_in == 0);
-			REQUIRE(dec.in == in_end);
-			REQUIRE(dec.avail_out == 0);
-			REQUIRE(dec.out == out_end);
+#ifndef _WIN32
+TEST_CASE("uring pipeline")
+{
+	auto& [input, block] = test_data<chained_generators<
+		xorshift_uints<0x10000>,
+		repeated_generator<counting_span<0, 255>, 64>,
+		constant_span<0x10000, 0x3C>
+	>>::instance;
 
-			if (std::memcmp(input.data(), output.data(), input.size()) != 0)
-				for (std::size_t i = 0; i < input.size(); i++) //this loop ain't as fast as memcmp
-					if (input[i] != output[i]) //REQUIE is sloooooooooooow
-						REQUIRE(i != i);
-		};
+	std::vector<uint8_t> frame;
+	append_frame(frame, input, frame_configs[0]);
 
-		SECTION("one shot")
+	auto run = [&](const std::vector<uint8_t>& compressed, unsigned int flags, std::size_t lead,
+		std::vector<uint8_t>& output, lz4_uring_stats& stats)
+	{
+		std::unique_ptr<std::FILE, int (*)(std::FILE*)> in(std::tmpfile(), std::fclose), out(std::tmpfile(), std::fclose);
+		REQUIRE((in && out));
+
+		//start somewhere other than the beginning of both files
+		std::vector<uint8_t> junk(lead, 0xEE);
+		if (lead)
 		{
-			test_limited();
+			std::fwrite(junk.data(), 1, junk.size(), in.get());
+			std::fwrite(junk.data(), 1, junk.size(), out.get());
 		}
+		std::fwrite(compressed.data(), 1, compressed.size(), in.get());
+		std::fflush(in.get());
+		std::fflush(out.get());
+		std::fseek(in.get(), (long)lead, SEEK_SET);
 
-		if (input.size() > 1024)
-			SECTION("1K read")
-			{
-				test_limited(1024, SIZE_MAX);
-			}
+		int ret = lz4_uring_dec_fd(fileno(in.get()), fileno(out.get()), flags, 4, 0x1000, &stats);
 
-		if (input.size() > 1024)
-			SECTION("1K write")
-			{
-				test_limited(SIZE_MAX, 1024);
-			}
+		std::fseek(out.get(), 0, SEEK_END);
+		output.resize((std::size_t)std::ftell(out.get()));
+		std::fseek(out.get(), 0, SEEK_SET);
+		REQUIRE((output.empty() || std::fread(output.data(), 1, output.size(), out.get()) == output.size()));
+		output.erase(output.begin(), output.begin() + (std::ptrdiff_t)lead);
 
-		if (input.size() > 512)
-			SECTION("512B read")
-			{
-				test_limited(512, SIZE_MAX);
-			}
+		return ret;
+	};
 
-		if (input.size() > 512)
-			SECTION("512B write")
-			{
-				test_limited(SIZE_MAX, 512);
-			}
+	std::vector<uint8_t> output;
+	lz4_uring_stats stats;
+
+	REQUIRE(run(frame, 0, 100, output, stats) == 0);
+	REQUIRE(output == input);
+	REQUIRE(stats.in_bytes == frame.size());
+	REQUIRE(stats.out_bytes == input.size());
+	REQUIRE(stats.queue_depth == 4);
+
+	REQUIRE(run(block, LZ4_URING_RAW_BLOCK, 0, output, stats) == 0);
+	REQUIRE(output == input);
+
+	auto truncated = frame;
+	truncated.resize(truncated.size() / 2);
+	REQUIRE(run(truncated, 0, 0, output, stats) != 0);
+
+	//a raw block runs to the end of the file, so one cut short in its last literal is caught
+	auto truncated_block = block;
+	truncated_block.pop_back();
+	REQUIRE(run(truncated_block, LZ4_URING_RAW_BLOCK, 100, output, stats) != 0);
+
+	//and a pipe has no end to go by, but that cut is still one a whole block can't end at
+	auto small = std::vector<uint8_t>(0x1000, 0x55);
+	std::vector<uint8_t> small_block((std::size_t)LZ4_compressBound((int)small.size()));
+	small_block.resize((std::size_t)LZ4_compress_default((const char*)small.data(), (char*)small_block.data(), (int)small.size(), (int)small_block.size()));
+
+	auto run_pipe = [&](const std::vector<uint8_t>& compressed)
+	{
+		std::unique_ptr<std::FILE, int (*)(std::FILE*)> out(std::tmpfile(), std::fclose);
+		REQUIRE(out);
+
+		int fds[2];
+		REQUIRE(pipe(fds) == 0);
+		REQUIRE(write(fds[1], compressed.data(), compressed.size()) == (ssize_t)compressed.size());
+		close(fds[1]);
+
+		int ret = lz4_uring_dec_fd(fds[0], fileno(out.get()), LZ4_URING_RAW_BLOCK, 4, 0x1000, &stats);
+		close(fds[0]);
+		return ret;
 	};
 
-	SECTION("base")
+	REQUIRE(run_pipe(small_block) == 0);
+	REQUIRE(stats.out_bytes == small.size());
+
+	small_block.pop_back();
+	REQUIRE(run_pipe(small_block) != 0);
+}
+#endif
+
+TEST_CASE("frame errors")
+{
+	auto input = std::vector<uint8_t>(0x1000, 0x55);
+	std::vector<uint8_t> stream;
+	append_frame(stream, input, frame_configs[0]);
+
+	auto run_all = [](std::vector<uint8_t> stream)
 	{
-		test_runner(lz4_dec_stream_run);
+		std::vector<uint8_t> output(0x2000);
+
+		lz4_frame_dec_state dec;
+		lz4_frame_dec_init(&dec);
+		dec.in = stream.data();
+		dec.avail_in = stream.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		return lz4_frame_dec_run(&dec);
+	};
+
+	REQUIRE(run_all(stream) == 0);
+
+	SECTION("bad magic")
+	{
+		auto bad = stream;
+		bad[0] ^= 1;
+		REQUIRE(run_all(bad) != 0);
 	}
 
-	SECTION("dst_uncached")
+	SECTION("bad version")
 	{
-		test_runner(lz4_dec_stream_run_dst_uncached);
+		auto bad = stream;
+		bad[4] ^= 0x80;
+		REQUIRE(run_all(bad) != 0);
+	}
+
+	SECTION("oversized block")
+	{
+		auto bad = stream;
+		bad[7] = 0xFF; //block size field starts after the 3 byte descriptor
+		bad[8] = 0xFF;
+		bad[9] = 0x01;
+		REQUIRE(run_all(bad) != 0);
 	}
 }
 
-template <std::size_t N, uint8_t Val = 0>
-struct constant_span
+TEST_CASE("frame checksums")
 {
-	void operator()(std::vector<uint8_t>& input) const
+	auto input = std::vector<uint8_t>(0x1000, 0x55);
+	std::vector<uint8_t> stream;
+	append_frame(stream, input, frame_configs[1]);
+
+	auto run_all = [](std::vector<uint8_t> stream, unsigned int flags)
 	{
-		input.resize(input.size() + N, Val);
+		std::vector<uint8_t> output(0x2000);
+
+		lz4_frame_dec_state dec;
+		lz4_frame_dec_init_ex(&dec, flags);
+		dec.in = stream.data();
+		dec.avail_in = stream.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		return lz4_frame_dec_run(&dec);
+	};
+
+	REQUIRE(run_all(stream, LZ4_FRAME_DEC_VERIFY_CHECKSUMS) == 0);
+
+	//the descriptor is FLG, BD, an 8 byte content size, and the header checksum,
+	//then the one block's length, its data, and its checksum
+	std::size_t hdr_checksum_at = 4 + 2 + 8;
+	std::size_t blk_at = hdr_checksum_at + 1;
+	std::size_t blk_len = (std::size_t)stream[blk_at] | (std::size_t)stream[blk_at + 1] << 8;
+	std::size_t blk_checksum_at = blk_at + 4 + blk_len;
+	REQUIRE(stream.size() == blk_checksum_at + 4 + 4 + 4);
+
+	for (std::size_t at : {hdr_checksum_at, blk_checksum_at, stream.size() - 1})
+	{
+		auto bad = stream;
+		bad[at] ^= 0x10;
+
+		//only noticed when asked to
+		REQUIRE(run_all(bad, 0) == 0);
+		REQUIRE(run_all(bad, LZ4_FRAME_DEC_VERIFY_CHECKSUMS) != 0);
 	}
-};
 
-template <uint8_t Start, uint8_t End>
-struct counting_span
-{
-	void operator()(std::vector<uint8_t>& input) const
+	SECTION("uncompressed block")
 	{
-		if constexpr (Start < End)
-		{
-			input.reserve(input.size() + (End - Start) + 1);
-			for (uint8_t i = Start; i != End; i++)
-				input.push_back(i);
-		}
-		else if constexpr (End < Start)
-		{
-			input.reserve(input.size() + (Start - End) + 1);
-			for (uint8_t i = Start; i != End; i--)
-				input.push_back(i);
+		auto noise = std::vector<uint8_t>();
+		xorshift_uints<0x400>{}(noise);
 
-		}
+		std::vector<uint8_t> raw;
+		append_frame(raw, noise, frame_configs[1]);
+		REQUIRE((raw[blk_at + 3] & 0x80)); //stored uncompressed
+		REQUIRE(run_all(raw, LZ4_FRAME_DEC_VERIFY_CHECKSUMS) == 0);
 
-		input.push_back(End);
+		//flip a bit of the data, which the checksums catch but the decoder can't
+		raw[blk_at + 4 + 100] ^= 1;
+		REQUIRE(run_all(raw, 0) == 0);
+		REQUIRE(run_all(raw, LZ4_FRAME_DEC_VERIFY_CHECKSUMS) != 0);
 	}
-};
+}
 
-template <std::size_t N, std::uint32_t Seed = 0xDEADBEEF>
-struct xorshift_uints
+TEST_CASE("statistics")
 {
-	void operator()(std::vector<uint8_t>& input) const
+	using gen = chained_generators<
+		xorshift_uints<0x4000>,
+		repeated_generator<counting_span<0, 255>, 64>,
+		constant_span<0x8000, 0x5A>,
+		repeated_generator<
+			chained_generators<
+				counting_span<0, 3>,
+				xorshift_uints<0x100>
+			>, 32>
+	>;
+	auto& [input, compressed] = test_data<gen>::instance;
+
+	auto run_all = [&](int (*run)(lz4_dec_stream_state*), lz4_dec_stream_state& dec)
 	{
-		input.reserve(input.size() + N * 4);
+		std::vector<uint8_t> output(input.size());
 
-		//https://en.wikipedia.org/wiki/Xorshift
+		lz4_dec_stream_init(&dec);
+		dec.in = compressed.data();
+		dec.out = output.data();
 
-		std::uint32_t n = Seed;
-		for (std::size_t i = 0; i < N; i++)
+		//dribble it in, so it suspends all over the place
+		std::size_t in_pos = 0;
+		while (in_pos < compressed.size())
 		{
-			n ^= n << 13;
-			n ^= n >> 17;
-			n ^= n << 5;
+			dec.avail_in = std::min<std::size_t>(compressed.size() - in_pos, 1000);
+			dec.avail_out = output.size() - (std::size_t)(dec.out - output.data());
+			REQUIRE(run(&dec) == 0);
+			in_pos = (std::size_t)(dec.in - compressed.data());
+		}
+
+		REQUIRE(dec.avail_out == 0);
+		REQUIRE(output == input);
+	};
+
+	auto dec = std::make_unique<lz4_dec_stream_state>();
+
+#if LZ4_STREAM_STATS
+	for (auto run : {lz4_dec_stream_run, lz4_dec_stream_run_dst_uncached, lz4_dec_stream_run_dst_nt})
+	{
+		run_all(run, *dec);
+
+		auto st = lz4_dec_stream_get_stats(dec.get());
+		REQUIRE(st != nullptr);
+
+		REQUIRE(st->lit_bytes + st->mat_bytes == input.size());
+		REQUIRE(st->hist_bytes > 0);
+
+		uint64_t suspends = 0;
+		for (auto n : st->suspends)
+			suspends += n;
+		REQUIRE(suspends == st->runs);
+		REQUIRE(st->runs > 1);
 
-			input.push_back((uint8_t)(n >> 0));
-			input.push_back((uint8_t)(n >> 8));
-			input.push_back((uint8_t)(n >> 16));
-			input.push_back((uint8_t)(n >> 24));
+		uint64_t lits = 0, mats = 0, dsts = 0;
+		for (unsigned int i = 0; i < LZ4_DEC_STREAM_STATS_BUCKETS; i++)
+		{
+			lits += st->lit_lens[i];
+			mats += st->mat_lens[i];
+			dsts += st->mat_dsts[i];
 		}
+		REQUIRE(lits == st->tokens);
+		REQUIRE(mats == st->tokens - 1); //the last sequence has no match
+		REQUIRE(dsts == mats);
+		REQUIRE(st->mat_dsts[1] > 0); //the 0x5A run
+
+		uint64_t kernels = st->cpy_mat_wild + st->cpy_mat_history + st->cpy_mat_dict +
+			st->cpy_mat_no_overlap + st->cpy_mat_rle_simd + st->cpy_mat_rle_long_dst +
+			st->cpy_mat_rle_short_dst + st->cpy_mat_obuf;
+		REQUIRE(kernels >= mats);
+
+		std::vector<char> text(lz4_dec_stream_stats_format(st, nullptr, 0) + 1);
+		REQUIRE(lz4_dec_stream_stats_format(st, text.data(), text.size()) == text.size() - 1);
+		REQUIRE(std::string(text.data()).find("\ntokens " + std::to_string(st->tokens) + "\n") != std::string::npos);
 	}
-};
 
-template <typename... Ts>
-struct chained_generators
-{
-	void operator()(std::vector<uint8_t>& input) const
+	SECTION("frames add up")
 	{
-		(Ts{}(input),...);
+		std::vector<uint8_t> stream;
+		append_frame(stream, input, frame_configs[0]);
+		append_frame(stream, input, frame_configs[0]);
+
+		std::vector<uint8_t> output(2 * input.size());
+		auto framed = std::make_unique<lz4_frame_dec_state>();
+		lz4_frame_dec_init(framed.get());
+		framed->in = stream.data();
+		framed->avail_in = stream.size();
+		framed->out = output.data();
+		framed->avail_out = output.size();
+		REQUIRE(lz4_frame_dec_run(framed.get()) == 0);
+		REQUIRE(lz4_frame_dec_done(framed.get()));
+
+		//counted across both frames (less any blocks stored uncompressed)
+		auto st = lz4_frame_dec_get_stats(framed.get());
+		REQUIRE(st->lit_bytes + st->mat_bytes > input.size());
+		REQUIRE(st->lit_bytes + st->mat_bytes <= output.size());
 	}
-};
 
-template <typename Gen, std::size_t Reps>
-struct repeated_generator
-{
-	void operator()(std::vector<uint8_t>& input) const
+	SECTION("scatter/gather saves history once per call")
 	{
-		for (std::size_t i = 0; i < Reps; i++)
-			Gen{}(input);
+		//all of it in one call, into 4 KiB pages
+		std::vector<uint8_t> output(input.size());
+		std::vector<lz4_dec_stream_iov> pages;
+		for (std::size_t at = 0; at < output.size(); at += 0x1000)
+			pages.push_back({output.data() + at, std::min<std::size_t>(0x1000, output.size() - at)});
+
+		lz4_dec_stream_span span = {compressed.data(), compressed.size()};
+		lz4_dec_stream_init(dec.get());
+
+		std::size_t in_len, out_len;
+		REQUIRE(lz4_dec_stream_runv(dec.get(), &span, 1, &in_len, pages.data(), pages.size(), &out_len) == 0);
+		REQUIRE(out_len == input.size());
+		REQUIRE(output == input);
+
+		auto st = lz4_dec_stream_get_stats(dec.get());
+		REQUIRE(input.size() > 2 * LZ4_STREAM_WINDOW_LEN);
+		REQUIRE(st->hist_bytes <= LZ4_STREAM_WINDOW_LEN);
+		REQUIRE(st->cpy_mat_history > 0); //matches did reach back into earlier pages
 	}
-};
+#else
+	run_all(lz4_dec_stream_run, *dec);
+	REQUIRE(lz4_dec_stream_get_stats(dec.get()) == nullptr);
+#endif
+}
 
 TEST_CASE("empty buffer")
 {
@@ -373,4 +2536,185 @@ TEST_CASE("many distant matches")
 				constant_span<0x10000, 0xFF>
 			>, 1024>
 	>();
-}
\ No newline at end of file
+}
+
+TEST_CASE("encoder")
+{
+	SECTION("empty buffer")
+	{
+		test_encoder<constant_span<0>>();
+	}
+
+	SECTION("14 zeroes")
+	{
+		test_encoder<constant_span<14>>();
+	}
+
+	SECTION("0x400000 zeroes")
+	{
+		test_encoder<constant_span<0x400000>>();
+	}
+
+	SECTION("short noise")
+	{
+		test_encoder<xorshift_uints<0x4000>>();
+	}
+
+	SECTION("many matches")
+	{
+		test_encoder<
+			repeated_generator<
+				chained_generators<
+					counting_span<0, 255>,
+					counting_span<255, 0>
+				>, 8 * 1024>
+		>();
+	}
+
+	SECTION("mixed")
+	{
+		test_encoder<
+			repeated_generator<
+				chained_generators<
+					xorshift_uints<0x2000>,
+					constant_span<0x1000, 0xF0>,
+					repeated_generator<
+						chained_generators<
+							counting_span<40, 255>,
+							counting_span<132, 0>,
+							counting_span<60, 140>
+						>, 64>,
+					xorshift_uints<0x3000, 0xBAADCAFE>,
+					counting_span<0, 255>
+				>, 16>
+		>();
+	}
+}
+
+template <typename Generator>
+static void test_frame_encoder()
+{
+	auto& [input, compressed] = test_data<Generator>::instance;
+
+	auto enc = std::make_unique<lz4_frame_enc_state>();
+
+	std::vector<uint8_t> encoded, output;
+	auto test_limited = [&](
+		std::size_t in_page_limit = SIZE_MAX,
+		std::size_t out_page_limit = SIZE_MAX)
+	{
+		encoded.clear();
+		encoded.resize(LZ4F_compressFrameBound(input.size(), nullptr) + 16);
+
+		lz4_frame_enc_init(enc.get());
+
+		enc->in = input.data();
+		auto in_end = input.data() + input.size();
+		enc->out = encoded.data();
+		auto out_end = encoded.data() + encoded.size();
+
+		while (enc->in < in_end)
+		{
+			enc->avail_in = std::min((std::size_t)(in_end - enc->in), in_page_limit);
+			enc->avail_out = std::min((std::size_t)(out_end - enc->out), out_page_limit);
+
+			auto prev_in = enc->in;
+			auto prev_out = enc->out;
+
+			REQUIRE(lz4_frame_enc_run(enc.get()) == 0);
+			REQUIRE((enc->in != prev_in || enc->out != prev_out));
+		}
+
+		for (;;)
+		{
+			enc->avail_in = 0;
+			enc->avail_out = std::min((std::size_t)(out_end - enc->out), out_page_limit);
+
+			auto prev_out = enc->out;
+
+			auto finish_ret = lz4_frame_enc_finish(enc.get());
+			REQUIRE(finish_ret >= 0);
+			if (finish_ret)
+				break;
+
+			REQUIRE(enc->out != prev_out);
+		}
+
+		encoded.resize((std::size_t)(enc->out - encoded.data()));
+
+		output.clear();
+		output.resize(input.size() + 1);
+
+		LZ4F_dctx* dctx;
+		REQUIRE(!LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)));
+		std::unique_ptr<LZ4F_dctx, LZ4F_errorCode_t (*)(LZ4F_dctx*)> dctx_owner(dctx, LZ4F_freeDecompressionContext);
+
+		std::size_t dst_len = output.size(), src_len = encoded.size();
+		REQUIRE(LZ4F_decompress(dctx, output.data(), &dst_len, encoded.data(), &src_len, nullptr) == 0);
+		REQUIRE(src_len == encoded.size());
+		REQUIRE(dst_len == input.size());
+		REQUIRE((input.empty() || std::memcmp(input.data(), output.data(), input.size()) == 0));
+
+		std::fill(output.begin(), output.end(), 0);
+
+		lz4_frame_dec_state dec;
+		lz4_frame_dec_init(&dec);
+		dec.in = encoded.data();
+		dec.avail_in = encoded.size();
+		dec.out = output.data();
+		dec.avail_out = output.size();
+
+		REQUIRE(lz4_frame_dec_run(&dec) == 0);
+		REQUIRE(lz4_frame_dec_done(&dec));
+		REQUIRE(dec.avail_in == 0);
+		REQUIRE(dec.avail_out == 1);
+		REQUIRE((input.empty() || std::memcmp(input.data(), output.data(), input.size()) == 0));
+	};
+
+	SECTION("one shot")
+	{
+		test_limited();
+	}
+
+	SECTION("7B read, 5B write")
+	{
+		test_limited(7, 5);
+	}
+}
+
+TEST_CASE("frame encoder")
+{
+	SECTION("empty buffer")
+	{
+		test_frame_encoder<constant_span<0>>();
+	}
+
+	//far more unmatchable input than lz4_enc_stream_state can hold on to
+	SECTION("incompressible input")
+	{
+		test_frame_encoder<xorshift_uints<0x40000>>();
+	}
+
+	//96 KiB of noise, then its last 48 KiB again: the second block's
+	//matches reach back into the first, which had to be stored
+	SECTION("matching a stored block")
+	{
+		test_frame_encoder<chained_generators<xorshift_uints<0x6000>, echo_tail<0xC000>>>();
+	}
+
+	SECTION("mixed")
+	{
+		test_frame_encoder<
+			repeated_generator<
+				chained_generators<
+					xorshift_uints<0x2000>,
+					constant_span<0x1000, 0xF0>,
+					repeated_generator<
+						chained_generators<
+							counting_span<40, 255>,
+							counting_span<132, 0>
+						>, 64>
+				>, 16>
+		>();
+	}
+}
@@ -1,32 +1,94 @@
 #include "lz4_stream.h"
+#include "lz4_stream_private.h"
 
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
-
-#define PHASE_READ_TOK			0
-#define PHASE_READ_EX_LIT_LEN	1
-#define PHASE_COPY_LIT			2
-#define PHASE_READ_OFS			3
-#define PHASE_READ_OFS2			4
-#define PHASE_READ_EX_MAT_LEN	5
-#define PHASE_COPY_MAT			6
-
-#define PHASE_REPORT_ERROR		7
+#include <stdio.h>
 
 #define MAX_BLOCK_LEN			UINT_MAX
 
-#define O_BUF_LEN 				0x10000
-#define O_BUF_PAD				32 //allows sloppy reads/writes at start+end
-
 _Static_assert(sizeof(((lz4_dec_stream_state *)0)->p_.o_buf) == O_BUF_PAD + O_BUF_LEN + O_BUF_PAD, "fix O_BUF_LEN + O_BUF_PAD");
 _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix below");
 #define WRAP_OBUF_IDX(idx) 		((idx) & (O_BUF_LEN - 1))
 
+//a zero offset is always bad, and with a window smaller than 64K so is any
+//offset reaching past it (mat_dst must never reach beyond o_buf)
+#if O_BUF_LEN > 0xFFFF
+	#define BAD_MAT_DST(mat_dst)	(!(mat_dst))
+#else
+	#define BAD_MAT_DST(mat_dst)	(!(mat_dst) || (mat_dst) > O_BUF_LEN)
+#endif
+
+//lz4_dec_stream_run decodes whole sequences without checking for
+//suspension as long as there's at least this much room on both sides
+#define FAST_IN_MARGIN			32 //token + 16-byte wild literal read (covers the offset too)
+#define FAST_OUT_MARGIN			32 //16-byte wild literal write
+#define FAST_MAT_SLACK			32 //how far lz4_dec_cpy_mat_wild may write past the match
+
+//with LZ4_DEC_STREAM_XXH32, how much output piles up before it's hashed (and, for
+//the decoders working through o_buf, the most one copy adds, so none of it gets
+//overwritten before it's hashed), a quarter of a small window
+#if O_BUF_LEN >= 0x10000
+	#define HASH_STEP			0x4000
+#else
+	#define HASH_STEP			(O_BUF_LEN / 4)
+#endif
+
+/*
+	Statistics (see LZ4_STREAM_STATS), which compile away to nothing
+	unless they're on. STAT_LIT and STAT_MAT are called once per
+	sequence, as soon as the literal's (or match's) length is known.
+*/
+
+#if LZ4_STREAM_STATS
+	#define STAT_ADD(s, field, n)	((s)->p_.stats.field += (n))
+	#define STAT_LIT(len)			lz4_dec_stat_lit(&s->p_.stats, (len))
+	#define STAT_MAT(dst, len)		lz4_dec_stat_mat(&s->p_.stats, (dst), (len))
+
+static unsigned int lz4_dec_stat_bucket(size_t v)
+{
+	unsigned int k = 0;
+	while (v && k < LZ4_DEC_STREAM_STATS_BUCKETS - 1)
+	{
+		v >>= 1;
+		k++;
+	}
+
+	return k;
+}
+
+static void lz4_dec_stat_lit(lz4_dec_stream_stats *st, unsigned int lit_len)
+{
+	st->tokens++;
+	st->lit_bytes += lit_len;
+	st->lit_lens[lz4_dec_stat_bucket(lit_len)]++;
+}
+
+static void lz4_dec_stat_mat(lz4_dec_stream_stats *st, unsigned int mat_dst, unsigned int mat_len)
+{
+	st->mat_bytes += mat_len;
+	st->mat_lens[lz4_dec_stat_bucket(mat_len)]++;
+	st->mat_dsts[lz4_dec_stat_bucket(mat_dst)]++;
+}
+#else
+	#define STAT_ADD(s, field, n)	((void)0)
+	#define STAT_LIT(len)			((void)0)
+	#define STAT_MAT(dst, len)		((void)0)
+#endif
+
 /*
 	Helper macros to make the state machine easier to see.
 */
 
+#if defined(_MSC_VER)
+	#define STREAM_RUN_INLINE			__forceinline
+#elif defined(__GNUC__)
+	#define STREAM_RUN_INLINE			inline __attribute__((always_inline))
+#else
+	#define STREAM_RUN_INLINE			inline
+#endif
+
 #if defined(_MSC_VER)
 	#define ASSUME(fact)				__assume(fact)
 	#define LIKELY(x)					(x)
@@ -65,6 +127,7 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 
 #ifndef LZ4_BYTE_ORDER
 	#if (defined(__BYTE_ORDER) && __BYTE_ORDER == __LITTLE_ENDIAN) || \
+		(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
 		defined(__LITTLE_ENDIAN__) || \
 		defined(__ARMEL__) || \
 		defined(__THUMBEL__) || \
@@ -75,6 +138,7 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 		#define LZ4_BYTE_ORDER LITTLE_ENDIAN
 
 	#elif (defined(__BYTE_ORDER) && __BYTE_ORDER == __BIG_ENDIAN) || \
+		(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) || \
 		defined(__BIG_ENDIAN__) || \
 		defined(__ARMEB__) || \
 		defined(__THUMBEB__) || \
@@ -110,7 +174,7 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 	/* pull s apart into stack locals */ \
 	\
 	const uint8_t* restrict in = s->in; \
-	const uint8_t* restrict const in_end = s->in + s->avail_in; \
+	const uint8_t* restrict const in_end = s->in + lz4_dec_avail_in(s); \
 	\
 	uint8_t* restrict out = s->out; \
 	size_t avail_out = s->avail_out; \
@@ -122,7 +186,9 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 	unsigned int mat_len = s->p_.mat_len; /* the length of the current match */ \
 	unsigned int mat_dst = s->p_.mat_dst; /* the distance to the current match */ \
 	\
-	unsigned int phase = s->p_.phase
+	unsigned int phase = s->p_.phase; \
+	\
+	STAT_ADD(s, runs, 1)
 
 #define STREAM_RESUME_FROM_SUSPEND() \
 	switch (phase) \
@@ -149,8 +215,12 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 	MACRO_IF_BLOCK_(in == in_end, SUSPEND_FOR_NOW();)
 
 #define STREAM_RUN_SUSPEND_EPILOG() \
+	if (s->p_.dict) \
+		lz4_dec_dict_advance(s, s->avail_out - avail_out); \
+	if (s->p_.flags & FLAG_IN_BLOCK) \
+		s->p_.blk_left -= (size_t)(in - s->in); \
+	s->avail_in -= (size_t)(in - s->in); \
 	s->in = in; \
-	s->avail_in = in_end - in; \
 	\
 	s->out = out; \
 	s->avail_out = avail_out; \
@@ -160,379 +230,840 @@ _Static_assert((O_BUF_LEN & (O_BUF_LEN - 1)) == 0, "o_buf not pow2 size; fix bel
 	s->p_.o_pos = o_pos; \
 	s->p_.mat_dst = mat_dst; \
 	\
-	s->p_.phase = phase
+	s->p_.phase = phase; \
+	STAT_ADD(s, suspends[phase], 1)
 
-void lz4_dec_stream_init(lz4_dec_stream_state *s)
+//how much of the input the decoder may look at, which is
+//all of it unless we've been told where the block ends
+static size_t lz4_dec_avail_in(const lz4_dec_stream_state *s)
 {
-	s->in = 0;
-	s->avail_in = 0;
-	
-	s->out = 0;
-	s->avail_out = 0;
-
-	s->p_.o_pos = 0;
-
-	s->p_.lit_len = 0;
-	s->p_.mat_len = 0;
-	s->p_.mat_dst = 0;
+	if (UNLIKELY(s->p_.flags & FLAG_IN_BLOCK) && s->avail_in > s->p_.blk_left)
+		return s->p_.blk_left;
 
-	s->p_.phase = PHASE_READ_TOK;
+	return s->avail_in;
 }
 
-int lz4_dec_stream_run(lz4_dec_stream_state *s)
+//called on suspend, checks whether we've just consumed the last of the
+//current block's input: returns 1 if so (and resets the decoder so it's
+//ready for the next block), 0 if not, or -1 if the block ended badly
+static int lz4_dec_check_block_end(lz4_dec_stream_state *s, size_t n_in, size_t n_out, unsigned int *phase)
 {
-	STREAM_RUN_PROLOG();
-
-	uint8_t *out_start = s->out;
-
-	STREAM_RESUME_FROM_SUSPEND();
+	if (LIKELY(!(s->p_.flags & FLAG_IN_BLOCK)))
+		return 0;
 
-phase_READ_TOK: //read a token
+	if (s->p_.flags & FLAG_BLK_OUT_LEN)
 	{
-		SUSPEND_IF_INPUT_EMPTY();
-		uint8_t c = *in++;
+		if (n_out > s->p_.blk_out_left)
+			return -1; //more output than the block was said to hold
+		s->p_.blk_out_left -= n_out;
 
-		lit_len = c >> 4;
-		mat_len = (c & 0xF) + 4;
+		//and some still to come
+		if (!s->p_.blk_out_left && (*phase == PHASE_COPY_LIT || *phase == PHASE_COPY_MAT))
+			return -1;
 	}
 
-	switch (lit_len)
-	{
-	case 0: TRANSITION_TO_PHASE(READ_OFS); //we just read a match
-	case 0xF: TRANSITION_TO_PHASE(READ_EX_LIT_LEN); //we have a long literal, read more length bytes
-	default: TRANSITION_TO_PHASE(COPY_LIT); //copy lit_len bytes to the output
-	}
+	if (n_in != s->p_.blk_left)
+		return 0;
 
-phase_READ_EX_LIT_LEN: //loop; read an additional byte of literal length
-	{
-		SUSPEND_IF_INPUT_EMPTY();
-		uint8_t c = *in++;
+	//a block's last sequence is all literals, so a complete
+	//block leaves the decoder waiting for a match offset
+	if (*phase != PHASE_READ_OFS)
+		return -1;
 
-		if (c > MAX_BLOCK_LEN - lit_len)
-			TRANSITION_TO_PHASE(REPORT_ERROR);
+	if ((s->p_.flags & FLAG_BLK_OUT_LEN) && s->p_.blk_out_left)
+		return -1; //less output than the block was said to hold
 
-		lit_len += c;
+	*phase = PHASE_READ_TOK;
 
-		if (c == 0xFF)
-			goto phase_READ_EX_LIT_LEN; //loop
-	}
+	s->p_.flags &= ~(FLAG_IN_BLOCK | FLAG_BLK_OUT_LEN);
+	s->p_.blk_left = 0;
 
-	TRANSITION_TO_PHASE(COPY_LIT);
+	return 1;
+}
 
-phase_COPY_LIT: //copy lit_len bytes from the input to the output
-	assert(lit_len > 0);
+//append len bytes from src to the history in o_buf, returns the new o_pos
+static unsigned int lz4_dec_push_history(
+	uint8_t* restrict o_buf, unsigned int o_pos,
+	const uint8_t* restrict src, size_t len)
+{
+	if (len >= O_BUF_LEN)
 	{
-		unsigned int clamped_lit_len = lit_len;
-
-		size_t avail_in = in_end - in;
-		if (clamped_lit_len > avail_in)
-			clamped_lit_len = (unsigned int)avail_in;
-		if (clamped_lit_len > avail_out)
-			clamped_lit_len = (unsigned int)avail_out;
+		memcpy(o_buf, src + len - O_BUF_LEN, O_BUF_LEN);
+		return 0;
+	}
 
-		memcpy(out, in, clamped_lit_len);
-		in += clamped_lit_len;
-		out += clamped_lit_len;
+	//nb: len < O_BUF_LEN
+	unsigned int e = o_pos + (unsigned int)len;
+	if (e > O_BUF_LEN)
+	{
+		e = O_BUF_LEN - o_pos;
+		memcpy(o_buf + o_pos, src, e);
 
-		avail_out -= clamped_lit_len;
-		lit_len -= clamped_lit_len;
+		o_pos = (unsigned int)len - e;
+		memcpy(o_buf, src + e, o_pos);
+	}
+	else
+	{
+		memcpy(o_buf + o_pos, src, len);
+		o_pos += (unsigned int)len;
+		if (o_pos == O_BUF_LEN) o_pos = 0;
 	}
 
-	if (lit_len)
-		//there's more literal to copy, but either src or dst bufs ran out
-		SUSPEND_FOR_NOW();
+	return o_pos;
+}
 
-	TRANSITION_TO_PHASE(READ_OFS);
+/*
+	lz4_dec_stream_runv's output segments. They all stay put for the
+	whole call, and each one is filled completely before the next is
+	started, so the output decoded so far is every segment before cur,
+	followed by the start of cur itself. Matches reaching back past the
+	start of cur are read straight out of the earlier segments (or, for
+	anything older than the call, out of o_buf), and the history is only
+	saved once, when the call is done.
+*/
+typedef struct lz4_dec_out_segs
+{
+	const lz4_dec_stream_iov	*seg;
+	size_t						cur;
+	size_t						prev_len; //the total length of the segments before cur
+} lz4_dec_out_segs;
+
+//copies len bytes of a match starting dst bytes back from the start of the
+//current segment (nb: len <= dst, so it never reaches into that segment)
+static void lz4_dec_cpy_segs(
+	const lz4_dec_out_segs *segs, const uint8_t *o_buf, unsigned int o_pos,
+	size_t dst, size_t len, uint8_t *out)
+{
+	if (dst > segs->prev_len)
+	{
+		//the oldest part comes from before the call, out of the ring
+		size_t buf_dst = dst - segs->prev_len;
+		size_t buf_cnt = buf_dst < len ? buf_dst : len;
+		unsigned int buf_src = WRAP_OBUF_IDX(o_pos - (unsigned int)buf_dst);
+
+		size_t e = O_BUF_LEN - buf_src;
+		if (e > buf_cnt)
+			e = buf_cnt;
+		memcpy(out, o_buf + buf_src, e);
+		memcpy(out + e, o_buf, buf_cnt - e);
+
+		out += buf_cnt;
+		dst -= buf_cnt;
+		len -= buf_cnt;
+
+		if (!len)
+			return;
+	}
 
-phase_READ_OFS: //read the first byte of a match offset
-	SUSPEND_IF_INPUT_EMPTY();
-	mat_dst = *in++;
+	//find the segment the rest starts in...
+	size_t k = segs->cur - 1;
+	while (dst > segs->seg[k].len)
+		dst -= segs->seg[k--].len;
 
-	TRANSITION_TO_PHASE(READ_OFS2);
+	//...and copy on from there
+	size_t at = segs->seg[k].len - dst;
+	while (len)
+	{
+		size_t n = segs->seg[k].len - at;
+		if (n > len)
+			n = len;
 
-phase_READ_OFS2: //read the second byte of a match offset
-	SUSPEND_IF_INPUT_EMPTY();
-	mat_dst |= (unsigned int)*in++ << 8;
-	_Static_assert(0xFFFF < O_BUF_LEN, "mat_dst must never reach beyond o_buf");
+		if (n) //empty segments may well have null data
+			memcpy(out, segs->seg[k].data + at, n);
+		out += n;
+		len -= n;
 
-	if (!mat_dst)
-		TRANSITION_TO_PHASE(REPORT_ERROR);
+		k++;
+		at = 0;
+	}
+}
 
-	if (mat_len == 0xF + 4)
-		TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
-	else
-		TRANSITION_TO_PHASE(COPY_MAT);
+//returns how many of the next len bytes of a match mat_dst back come out of the
+//dictionary (starting at *src), or -1 if the match reaches back past its start;
+//n_decoded is how much the caller has decoded since it was called
+static int lz4_dec_dict_part(
+	const lz4_dec_stream_state *s, size_t n_decoded,
+	unsigned int mat_dst, unsigned int len, const uint8_t **src)
+{
+	size_t hist = s->p_.dict_hist + n_decoded;
+	if (mat_dst <= hist)
+		return 0;
 
-phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
-	{
-		SUSPEND_IF_INPUT_EMPTY();
-		uint8_t c = *in++;
+	size_t d = mat_dst - hist;
+	if (d > s->p_.dict_len)
+		return -1;
 
-		if (c > MAX_BLOCK_LEN - mat_len)
-			TRANSITION_TO_PHASE(REPORT_ERROR);
+	*src = s->p_.dict + s->p_.dict_len - d;
+	return (int)(d < len ? d : len);
+}
 
-		mat_len += c;
+//notes that n_decoded more bytes of the stream are in, and forgets the
+//dictionary once no match can reach back into it anymore
+static void lz4_dec_dict_advance(lz4_dec_stream_state *s, size_t n_decoded)
+{
+	s->p_.dict_hist += n_decoded;
+	if (s->p_.dict_hist >= O_BUF_LEN)
+		s->p_.dict = 0;
+}
 
-		if (c == 0xFF)
-			goto phase_READ_EX_MAT_LEN; //loop
-	}
+/*
+	xxHash32, incrementally.
 
-	TRANSITION_TO_PHASE(COPY_MAT);
+	This is the hash LZ4 frames use for their checksums. The decoders
+	feed it as they go (see LZ4_DEC_STREAM_XXH32), and the frame
+	decoder uses it to verify frames.
+*/
 
-phase_COPY_MAT: //copy mat_len bytes from mat_dst bytes behind the output cursor
-	assert(mat_len > 0);
-	{
-		//nb: mat_dst will not be more than O_BUF_LEN
-		unsigned int clamped_mat_len = mat_len < avail_out ?
-			mat_len :
-			(unsigned int)avail_out;
+#define XXH_PRIME32_1		0x9E3779B1u
+#define XXH_PRIME32_2		0x85EBCA77u
+#define XXH_PRIME32_3		0xC2B2AE3Du
+#define XXH_PRIME32_4		0x27D4EB2Fu
+#define XXH_PRIME32_5		0x165667B1u
 
-		if (clamped_mat_len)
-		{
-			size_t n_in_out = out - out_start;
-			if (mat_dst > n_in_out)
-			{
-				//we're reading far enough back that we need to hit the buffer
+#define XXH_ROTL32(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
 
-				//figure out how far back into the buffer we need to go
-				unsigned int buf_dst = mat_dst - (unsigned int)n_in_out; //nb: n_in_out <= mat_dst
-				//and how many bytes we'll pull from it
-				unsigned int buf_cnt = buf_dst < clamped_mat_len ? buf_dst : clamped_mat_len;
+static uint32_t lz4_xxh32_read32(const uint8_t *p)
+{
+	return
+		(uint32_t)p[0] |
+		(uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+}
 
-				//and exactly where in the buffer we'll copy from
-				unsigned int buf_src = WRAP_OBUF_IDX(o_pos - buf_dst);
+static uint32_t lz4_xxh32_round(uint32_t acc, uint32_t in)
+{
+	acc += in * XXH_PRIME32_2;
+	acc = XXH_ROTL32(acc, 13);
+#if defined(__GNUC__)
+	//keeps the four lanes in scalar registers: vectorized without SSE4.1,
+	//the multiplies get emulated with shifts and adds, at half the speed
+	__asm__("" : "+r" (acc));
+#endif
+	return acc * XXH_PRIME32_1;
+}
 
-				unsigned int e = buf_src + buf_cnt;
-				if (e > O_BUF_LEN)
-				{
-					e = O_BUF_LEN - buf_src;
-					memcpy(out, o_buf + buf_src, e);
-					memcpy(out + e, o_buf, buf_cnt - e);
-				}
-				else
-				{
-					memcpy(out, o_buf + buf_src, buf_cnt);
-				}
+static void lz4_xxh32_init(lz4_stream_xxh32 *h, uint32_t seed)
+{
+	h->v[0] = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+	h->v[1] = seed + XXH_PRIME32_2;
+	h->v[2] = seed;
+	h->v[3] = seed - XXH_PRIME32_1;
 
-				out += buf_cnt;
-				avail_out -= buf_cnt;
+	h->total_len = 0;
+	h->mem_len = 0;
+}
 
-				clamped_mat_len -= buf_cnt;
-				mat_len -= buf_cnt;
-			}
+static void lz4_xxh32_update(lz4_stream_xxh32 *restrict h, const uint8_t *restrict p, size_t len)
+{
+	if (!len)
+		return; //p may well be null
 
-			size_t c = clamped_mat_len;
-			const uint8_t *out_src = out - mat_dst;
-			while (c--)
-				*out++ = *out_src++;
+	h->total_len += len;
 
-			avail_out -= clamped_mat_len;
-			mat_len -= clamped_mat_len;
-		}
+	if (h->mem_len + len < 16)
+	{
+		memcpy(h->mem + h->mem_len, p, len);
+		h->mem_len += (unsigned int)len;
+		return;
 	}
 
-	if (mat_len)
-		//we ran out of avail_out before we finished
-		SUSPEND_FOR_NOW();
-
-	TRANSITION_TO_PHASE(READ_TOK);
+	uint32_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
 
-suspend_for_now:
-	//tuck everything away for the next call
+	if (h->mem_len)
 	{
-		size_t len = out - out_start;
-		if (len >= O_BUF_LEN)
-		{
-			memcpy(o_buf, out - O_BUF_LEN, O_BUF_LEN);
-			o_pos = 0;
-		}
-		else //nb: len < O_BUF_LEN
-		{
-			unsigned int e = o_pos + (unsigned int)len;
-			if (e > O_BUF_LEN)
-			{
-				e = O_BUF_LEN - o_pos;
-				memcpy(o_buf + o_pos, out - len, e);
+		//finish off the stripe left over from last time
+		unsigned int n = 16 - h->mem_len;
+		memcpy(h->mem + h->mem_len, p, n);
+		p += n;
+		len -= n;
+
+		v0 = lz4_xxh32_round(v0, lz4_xxh32_read32(h->mem + 0));
+		v1 = lz4_xxh32_round(v1, lz4_xxh32_read32(h->mem + 4));
+		v2 = lz4_xxh32_round(v2, lz4_xxh32_read32(h->mem + 8));
+		v3 = lz4_xxh32_round(v3, lz4_xxh32_read32(h->mem + 12));
+	}
 
-				o_pos = (unsigned int)len - e;
-				memcpy(o_buf, out - o_pos, o_pos);
-			}
-			else
-			{
-				memcpy(o_buf + o_pos, out - len, len);
-				o_pos += (unsigned int)len;
-				if (o_pos == O_BUF_LEN) o_pos = 0;
-			}
-		}
+	for (; len >= 16; p += 16, len -= 16)
+	{
+		v0 = lz4_xxh32_round(v0, lz4_xxh32_read32(p + 0));
+		v1 = lz4_xxh32_round(v1, lz4_xxh32_read32(p + 4));
+		v2 = lz4_xxh32_round(v2, lz4_xxh32_read32(p + 8));
+		v3 = lz4_xxh32_round(v3, lz4_xxh32_read32(p + 12));
 	}
 
-	STREAM_RUN_SUSPEND_EPILOG();
-	return 0;
+	h->v[0] = v0;
+	h->v[1] = v1;
+	h->v[2] = v2;
+	h->v[3] = v3;
 
-phase_REPORT_ERROR:
-	s->p_.phase = PHASE_REPORT_ERROR;
-	return -1;
+	memcpy(h->mem, p, len);
+	h->mem_len = (unsigned int)len;
 }
 
-static unsigned int lz4_dec_cpy_mat_no_overlap(
-	unsigned int copy_mat_len,
-	unsigned int o_inpos, unsigned int o_pos,
-	uint8_t* restrict o_buf, uint8_t* restrict out)
+static uint32_t lz4_xxh32_digest(const lz4_stream_xxh32 *h)
 {
-	for (unsigned int copy_len, copy_mat_len_left = copy_mat_len; copy_mat_len_left != 0; copy_mat_len_left -= copy_len)
-	{
-		copy_len = copy_mat_len_left;
-
-		unsigned int pos_avail = O_BUF_LEN - o_pos;
-		if (UNLIKELY(copy_len > pos_avail))
-			copy_len = pos_avail;
+	uint32_t acc;
+	if (h->total_len >= 16)
+		acc =
+			XXH_ROTL32(h->v[0], 1) + XXH_ROTL32(h->v[1], 7) +
+			XXH_ROTL32(h->v[2], 12) + XXH_ROTL32(h->v[3], 18);
+	else
+		acc = h->v[2] + XXH_PRIME32_5; //nb: v[2] is still the seed
 
-		unsigned int inpos_avail = O_BUF_LEN - o_inpos;
-		if (UNLIKELY(copy_len > inpos_avail))
-			copy_len = inpos_avail;
+	acc += (uint32_t)h->total_len;
 
-		memcpy(o_buf + o_pos, o_buf + o_inpos, copy_len);
-		memcpy(out, o_buf + o_inpos, copy_len);
+	const uint8_t *p = h->mem;
+	unsigned int len = h->mem_len;
 
-		o_pos = WRAP_OBUF_IDX(o_pos + copy_len);
-		o_inpos = WRAP_OBUF_IDX(o_inpos + copy_len);
+	for (; len >= 4; p += 4, len -= 4)
+	{
+		acc += lz4_xxh32_read32(p) * XXH_PRIME32_3;
+		acc = XXH_ROTL32(acc, 17) * XXH_PRIME32_4;
+	}
 
-		out += copy_len;
+	for (; len; p++, len--)
+	{
+		acc += *p * XXH_PRIME32_5;
+		acc = XXH_ROTL32(acc, 11) * XXH_PRIME32_1;
 	}
 
-	return copy_mat_len;
+	acc ^= acc >> 15;
+	acc *= XXH_PRIME32_2;
+	acc ^= acc >> 13;
+	acc *= XXH_PRIME32_3;
+	acc ^= acc >> 16;
+
+	return acc;
 }
 
-static unsigned int lz4_dec_cpy_mat_rle_long_dst(
-	unsigned int copy_mat_len,
-	unsigned int o_inpos, unsigned int o_pos,
-	uint8_t* restrict o_buf, uint8_t* restrict out)
+//hashes o_buf[from, to), which may wrap around, returns to
+static unsigned int lz4_dec_hash_obuf(lz4_dec_stream_state *s,
+	const uint8_t *o_buf, unsigned int from, unsigned int to)
 {
-	_Static_assert(sizeof(uintptr_t) <= O_BUF_PAD, "padding insufficient for sloppy reads");
+	//nb: never more than O_BUF_LEN - 1 bytes, so from == to means none
+	unsigned int n = WRAP_OBUF_IDX(to - from);
 
-	unsigned int n_copied = 0;
+	unsigned int first = O_BUF_LEN - from;
+	if (first > n)
+		first = n;
 
-	while (copy_mat_len >= sizeof(uintptr_t))
-	{
-		uintptr_t c;
+	lz4_xxh32_update(&s->p_.xxh, o_buf + from, first);
+	lz4_xxh32_update(&s->p_.xxh, o_buf, n - first);
 
-		//read the next word from o_buf's read cursor
+	return to;
+}
 
-		memcpy(&c, o_buf + o_inpos, sizeof(c));
+//in the decoders working through o_buf, hash what's piled up there once there's enough of it
+#define HASH_OBUF_CATCH_UP() \
+	MACRO_IF_BLOCK_(hash && WRAP_OBUF_IDX(o_pos - h_pos) >= HASH_STEP, \
+		{h_pos = lz4_dec_hash_obuf(s, o_buf, h_pos, o_pos);})
 
-		unsigned int n_read = O_BUF_LEN - o_inpos;
-		if (UNLIKELY(n_read < sizeof(c)))
-		{
-			//we read off the end of o_buf's active area into the scratch space
-			//read from the beginning and patch the read values
+/*
+	Vector kernels.
 
-			uintptr_t c2;
-			memcpy(&c2, o_buf, sizeof(c2));
+	Which ones get used is decided at runtime (see lz4_dec_simd_level),
+	so the library can be built for baseline x86-64 and still use AVX2
+	where it's there. The scalar code is always the fallback, and can
+	be forced with LZ4_DEC_STREAM_NO_SIMD (or by defining
+	LZ4STREAM_NO_SIMD at build time).
+*/
 
-			c &= MASK_N(uintptr_t, n_read);
-			c |= c2 LBOS n_read * 8;
-		}
-		o_inpos = WRAP_OBUF_IDX(o_inpos + sizeof(c));
+#define SIMD_NONE		0
+#define SIMD_SSSE3		1
+#define SIMD_AVX2		2
 
-		//write the word back to o_buf's write cursor
+#if !defined(LZ4STREAM_NO_SIMD) && \
+	(defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || (defined(_M_IX86) && !defined(_M_ARM64EC)))
 
-		memcpy(o_buf + o_pos, &c, sizeof(c));
+	#define HAVE_X86_SIMD	1
 
-		unsigned int n_written = O_BUF_LEN - o_pos;
-		o_pos = WRAP_OBUF_IDX(o_pos + sizeof(c));
+	#include <immintrin.h>
 
-		if (UNLIKELY(n_written < sizeof(c)))
-			//some bytes went into the scratch pad past the end
-			//need to copy those to the beginning of the buffer
-			memcpy(o_buf + o_pos - sizeof(c), &c, sizeof(c));
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#define TARGET_SSSE3
+		#define TARGET_AVX2
+	#else
+		#define TARGET_SSSE3	__attribute__((target("ssse3")))
+		#define TARGET_AVX2		__attribute__((target("avx2")))
+	#endif
+#else
+	#define HAVE_X86_SIMD	0
+#endif
 
-		memcpy(out + n_copied, &c, sizeof(c));
-		n_copied += sizeof(c);
+static unsigned int lz4_dec_simd_level(void)
+{
+#if HAVE_X86_SIMD
+	#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
 
-		copy_mat_len -= sizeof(c);
-	}
+		__cpuid(info, 0);
+		int max_leaf = info[0];
 
-	return n_copied;
+		__cpuid(info, 1);
+		int ssse3 = (info[2] >> 9) & 1;
+		int os_avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6;
+
+		int avx2 = 0;
+		if (max_leaf >= 7 && os_avx)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] >> 5) & 1;
+		}
+	#else
+		__builtin_cpu_init();
+
+		int ssse3 = __builtin_cpu_supports("ssse3");
+		int avx2 = __builtin_cpu_supports("avx2");
+	#endif
+
+	if (avx2)
+		return SIMD_AVX2;
+	if (ssse3)
+		return SIMD_SSSE3;
+#endif
+
+	return SIMD_NONE;
 }
 
-static unsigned int lz4_dec_cpy_mat_rle_short_dst(
-	unsigned int copy_mat_len, unsigned int mat_dst,
-	unsigned int o_inpos, unsigned int o_pos,
-	uint8_t* restrict o_buf, uint8_t* restrict out)
+#if HAVE_X86_SIMD
+
+//lz4_dec_rep_masks[n][i] = i % n, spreads an n-byte pattern across a vector
+static const uint8_t lz4_dec_rep_masks[16][32] =
 {
-	_Static_assert(sizeof(uintptr_t) <= O_BUF_PAD, "padding insufficient for sloppy reads");
-	assert(mat_dst < sizeof(uintptr_t));
-	ASSUME(mat_dst < sizeof(uintptr_t));
+	{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	{0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1},
+	{0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1},
+	{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+	{0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1},
+	{0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1},
+	{0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3},
+	{0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3},
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1}
+};
+
+//fills len bytes of out with the mat_dst-byte (< 16) pattern at pat, which
+//must be readable for 16 bytes, may write up to 16 bytes past out + len
+TARGET_SSSE3
+static void lz4_dec_rep_ssse3(uint8_t *out, const uint8_t *pat, unsigned int mat_dst, size_t len)
+{
+	__m128i p = _mm_shuffle_epi8(
+		_mm_loadu_si128((const __m128i *)pat),
+		_mm_loadu_si128((const __m128i *)lz4_dec_rep_masks[mat_dst]));
 
-	if (copy_mat_len < sizeof(uintptr_t))
-		return 0;
+	//the largest multiple of the pattern length that fits in a vector
+	unsigned int step = 16 - 16 % mat_dst;
 
-	unsigned int n_copied = 0;
+	for (uint8_t *const end = out + len; out < end; out += step)
+		_mm_storeu_si128((__m128i *)out, p);
+}
 
-	uintptr_t c;
-	memcpy(&c, o_buf + o_inpos, sizeof(c));
-	unsigned int n_read = O_BUF_LEN - o_inpos;
-	if (UNLIKELY(n_read < mat_dst))
-	{
-		uintptr_t c2;
-		memcpy(&c2, o_buf, sizeof(c2));
+//as lz4_dec_rep_ssse3, but may write up to 32 bytes past out + len
+TARGET_AVX2
+static void lz4_dec_rep_avx2(uint8_t *out, const uint8_t *pat, unsigned int mat_dst, size_t len)
+{
+	__m128i src = _mm_loadu_si128((const __m128i *)pat);
+	__m128i lo = _mm_shuffle_epi8(src, _mm_loadu_si128((const __m128i *)lz4_dec_rep_masks[mat_dst]));
+	__m128i hi = _mm_shuffle_epi8(src, _mm_loadu_si128((const __m128i *)(lz4_dec_rep_masks[mat_dst] + 16)));
+	__m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
 
-		c &= MASK_N(uintptr_t, n_read);
-		c |= c2 LBOS n_read * 8;
+	unsigned int step = 32 - 32 % mat_dst;
+
+	for (uint8_t *const end = out + len; out < end; out += step)
+		_mm256_storeu_si256((__m256i *)out, p);
+}
+
+//copies a non-overlapping (mat_dst >= 32) match, may write up to 32 bytes past its end
+TARGET_AVX2
+static void lz4_dec_cpy_far_avx2(uint8_t *out, unsigned int mat_dst, size_t len)
+{
+	const uint8_t *src = out - mat_dst;
+
+	for (uint8_t *const end = out + len; out < end; out += 32, src += 32)
+		_mm256_storeu_si256((__m256i *)out, _mm256_loadu_si256((const __m256i *)src));
+}
+
+#endif
+
+//fills exactly len bytes of out with the mat_dst-byte (< 16) pattern in pat[16]
+static void lz4_dec_rep_exact(
+	uint8_t *restrict out, const uint8_t *restrict pat, unsigned int mat_dst,
+	size_t len, unsigned int simd)
+{
+	size_t n = 0;
+
+#if HAVE_X86_SIMD
+	if (len > 32 && simd != SIMD_NONE)
+	{
+		//overshoot lands inside len, and gets rewritten (identically) below
+		n = len - 32;
+		if (simd >= SIMD_AVX2)
+			lz4_dec_rep_avx2(out, pat, mat_dst, n);
+		else
+			lz4_dec_rep_ssse3(out, pat, mat_dst, n);
 	}
+#else
+	(void)simd;
+#endif
 
-	c &= MASK_N(uintptr_t, mat_dst);
-	for (unsigned int n = mat_dst; n < sizeof(uintptr_t); n *= 2)
-		c |= c LBOS n * 8;
+	for (unsigned int i = (unsigned int)(n % mat_dst); n < len; n++)
+	{
+		out[n] = pat[i];
+		if (++i == mat_dst) i = 0;
+	}
+}
 
-	unsigned int shift = (sizeof(uintptr_t) % mat_dst) * 8;
+//copies a match which lies entirely within the output buffer, may write
+//up to FAST_MAT_SLACK bytes past its end, returns the end of the match
+static uint8_t *lz4_dec_cpy_mat_wild(uint8_t *out, unsigned int mat_dst, unsigned int mat_len, unsigned int simd)
+{
+	const uint8_t *src = out - mat_dst;
+	uint8_t *const end = out + mat_len;
 
-	while (copy_mat_len >= sizeof(c))
+#if HAVE_X86_SIMD
+	if (simd != SIMD_NONE)
 	{
-		memcpy(o_buf + o_pos, &c, sizeof(c));
+		if (mat_dst < 16)
+		{
+			if (simd >= SIMD_AVX2 && mat_len > 16)
+				lz4_dec_rep_avx2(out, src, mat_dst, mat_len);
+			else
+				lz4_dec_rep_ssse3(out, src, mat_dst, mat_len);
 
-		unsigned int n_written = O_BUF_LEN - o_pos;
-		o_pos = WRAP_OBUF_IDX(o_pos + sizeof(c));
+			return end;
+		}
 
-		if (UNLIKELY(n_written < sizeof(c)))
-			//some bytes went into the scratch pad past the end
-			//need to copy those to the beginning of the buffer
-			memcpy(o_buf + o_pos - sizeof(c), &c, sizeof(c));
+		if (simd >= SIMD_AVX2 && mat_dst >= 32 && mat_len > 32)
+		{
+			lz4_dec_cpy_far_avx2(out, mat_dst, mat_len);
+			return end;
+		}
+	}
+#else
+	(void)simd;
+#endif
 
-		memcpy(out + n_copied, &c, sizeof(c));
-		n_copied += sizeof(c);
+	if (LIKELY(mat_dst >= 16))
+	{
+		do
+		{
+			memcpy(out, src, 16);
+			out += 16;
+			src += 16;
+		} while (out < end);
 
-		c = c RBOS shift;
-		c |= c LBOS (sizeof(uintptr_t) * 8 - shift);
+		return end;
+	}
 
-		copy_mat_len -= sizeof(c);
+	if (mat_dst < 8)
+	{
+		//spread the pattern out over the first eight bytes, leaving src
+		//a multiple of mat_dst behind and at least eight bytes back
+		static const unsigned int inc[8] = {0, 1, 2, 1, 0, 4, 4, 4};
+		static const int dec[8] = {0, 0, 0, -1, -4, 1, 2, 3};
+
+		out[0] = src[0];
+		out[1] = src[1];
+		out[2] = src[2];
+		out[3] = src[3];
+		src += inc[mat_dst];
+		memcpy(out + 4, src, 4);
+		src -= dec[mat_dst];
+	}
+	else
+	{
+		memcpy(out, src, 8);
+		src += 8;
 	}
+	out += 8;
 
-	return n_copied;
+	while (out < end)
+	{
+		memcpy(out, src, 8);
+		out += 8;
+		src += 8;
+	}
+
+	return end;
 }
 
-static void lz4_dec_cpy_mat_bytes(
-	unsigned int copy_mat_len, unsigned int o_inpos, unsigned int o_pos,
-	uint8_t* restrict o_buf, uint8_t* restrict out)
+void lz4_dec_stream_init(lz4_dec_stream_state *s)
 {
-	for (unsigned int i = 0; i < copy_mat_len; i++)
+	lz4_dec_stream_init_ex(s, 0);
+}
+
+//everything lz4_dec_stream_init_ex does but clear the statistics,
+//so the frame decoder can start each frame without losing count
+static void lz4_dec_stream_reset(lz4_dec_stream_state *s, unsigned int flags)
+{
+	assert(!(flags & (FLAG_IN_BLOCK | FLAG_BLK_OUT_LEN | FLAG_AUTO_UNCACHED)));
+
+	s->in = 0;
+	s->avail_in = 0;
+	
+	s->out = 0;
+	s->avail_out = 0;
+
+	s->p_.o_pos = 0;
+	s->p_.o_pending = 0;
+
+	s->p_.auto_in = 0;
+	s->p_.auto_out = 0;
+
+	s->p_.dict = 0;
+	s->p_.dict_len = 0;
+	s->p_.dict_hist = 0;
+
+	s->p_.o_retained = 0;
+
+	s->p_.lit_len = 0;
+	s->p_.mat_len = 0;
+	s->p_.mat_dst = 0;
+
+	s->p_.blk_left = 0;
+	s->p_.blk_out_left = 0;
+
+	s->p_.flags = flags;
+	s->p_.simd = flags & LZ4_DEC_STREAM_NO_SIMD ? SIMD_NONE : lz4_dec_simd_level();
+	s->p_.phase = PHASE_READ_TOK;
+
+	lz4_xxh32_init(&s->p_.xxh, 0);
+}
+
+void lz4_dec_stream_init_ex(lz4_dec_stream_state *s, unsigned int flags)
+{
+	lz4_dec_stream_reset(s, flags);
+
+#if LZ4_STREAM_STATS
+	memset(&s->p_.stats, 0, sizeof(s->p_.stats));
+#endif
+}
+
+uint32_t lz4_dec_stream_xxh32(const lz4_dec_stream_state *s)
+{
+	return lz4_xxh32_digest(&s->p_.xxh);
+}
+
+const lz4_dec_stream_stats *lz4_dec_stream_get_stats(const lz4_dec_stream_state *s)
+{
+#if LZ4_STREAM_STATS
+	return &s->p_.stats;
+#else
+	(void)s;
+	return 0;
+#endif
+}
+
+size_t lz4_dec_stream_stats_format(const lz4_dec_stream_stats *st, char *buf, size_t buf_len)
+{
+	static const char *const phase_names[8] =
 	{
-		uint8_t c = o_buf[o_inpos];
-		o_inpos = WRAP_OBUF_IDX(o_inpos + 1);
+		"read_tok", "read_ex_lit_len", "copy_lit", "read_ofs",
+		"read_ofs2", "read_ex_mat_len", "copy_mat", "report_error",
+	};
+
+	size_t len = 0;
+
+	//appends a line, keeping count of how long the text would be even once buf is full
+	#define STATS_LINE(...) \
+		do \
+		{ \
+			int n = snprintf(len < buf_len ? buf + len : 0, len < buf_len ? buf_len - len : 0, __VA_ARGS__); \
+			if (n > 0) len += (size_t)n; \
+		} while (0)
+	#define STATS_FIELD(field) \
+		STATS_LINE(#field " %llu\n", (unsigned long long)st->field)
+	#define STATS_HISTOGRAM(field) \
+		for (unsigned int i = 0; i < LZ4_DEC_STREAM_STATS_BUCKETS; i++) \
+			STATS_LINE(#field ".%u %llu\n", i, (unsigned long long)st->field[i])
+
+	STATS_FIELD(runs);
+	for (unsigned int i = 0; i < 8; i++)
+		STATS_LINE("suspends.%s %llu\n", phase_names[i], (unsigned long long)st->suspends[i]);
+
+	STATS_FIELD(tokens);
+	STATS_FIELD(lit_bytes);
+	STATS_FIELD(mat_bytes);
+	STATS_FIELD(hist_bytes);
+
+	STATS_HISTOGRAM(lit_lens);
+	STATS_HISTOGRAM(mat_lens);
+	STATS_HISTOGRAM(mat_dsts);
+
+	STATS_FIELD(cpy_mat_wild);
+	STATS_FIELD(cpy_mat_history);
+	STATS_FIELD(cpy_mat_dict);
+	STATS_FIELD(cpy_mat_no_overlap);
+	STATS_FIELD(cpy_mat_rle_simd);
+	STATS_FIELD(cpy_mat_rle_long_dst);
+	STATS_FIELD(cpy_mat_rle_short_dst);
+	STATS_FIELD(cpy_mat_obuf);
+
+	#undef STATS_HISTOGRAM
+	#undef STATS_FIELD
+	#undef STATS_LINE
+
+	return len;
+}
 
-		o_buf[o_pos] = c;
-		o_pos = WRAP_OBUF_IDX(o_pos + 1);
+void lz4_dec_stream_begin_block(lz4_dec_stream_state *s, size_t blk_len)
+{
+	lz4_dec_stream_begin_block_ex(s, blk_len, SIZE_MAX);
+}
 
-		*out++ = c;
+void lz4_dec_stream_begin_block_ex(lz4_dec_stream_state *s, size_t blk_len, size_t out_len)
+{
+	assert(s->p_.phase == PHASE_READ_TOK && !(s->p_.flags & FLAG_IN_BLOCK) && "the previous block isn't finished");
+
+	s->p_.flags |= FLAG_IN_BLOCK;
+	s->p_.blk_left = blk_len;
+
+	if (out_len != SIZE_MAX)
+	{
+		s->p_.flags |= FLAG_BLK_OUT_LEN;
+		s->p_.blk_out_left = out_len;
 	}
 }
 
-int lz4_dec_stream_run_dst_uncached(lz4_dec_stream_state* s)
+int lz4_dec_stream_block_done(const lz4_dec_stream_state *s)
+{
+	return !(s->p_.flags & FLAG_IN_BLOCK);
+}
+
+int lz4_dec_stream_may_end(const lz4_dec_stream_state *s)
+{
+	//the last sequence has no match, so a whole
+	//block leaves us waiting for a match offset
+	return s->p_.phase == PHASE_READ_OFS;
+}
+
+void lz4_dec_stream_set_dict(lz4_dec_stream_state *s, const uint8_t *dict, size_t dict_len)
+{
+	assert(s->p_.phase == PHASE_READ_TOK && s->p_.o_pos == 0 && "set the dictionary before decoding anything");
+
+	s->p_.dict = dict_len ? dict : 0;
+	s->p_.dict_len = dict_len;
+	s->p_.dict_hist = 0;
+}
+
+//slack: how many bytes past out + avail_out we're allowed to scribble over
+//hash: feed the output to the xxHash32 in chunks, right after writing it
+//segs: lz4_dec_stream_runv's output segments, out lies in the current one
+static STREAM_RUN_INLINE int lz4_dec_stream_run_impl(lz4_dec_stream_state *s, size_t slack, int hash,
+	const lz4_dec_out_segs *segs)
 {
 	STREAM_RUN_PROLOG();
+
+	//with LZ4_DEC_STREAM_RETAIN_OUTPUT, the history is all in front of out
+	//(out_start is where the output began), and o_buf is never touched;
+	//with segs, out_start is where the current segment starts
+	int const retain = (s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT) != 0;
+	uint8_t *out_start = segs ? segs->seg[segs->cur].data : s->out - s->p_.o_retained;
+	unsigned int const simd = s->p_.simd;
+
+	const uint8_t *h_from = s->out; //out[h_from, out) is decoded, but not yet hashed
+
 	STREAM_RESUME_FROM_SUSPEND();
 
 phase_READ_TOK: //read a token
+	while (LIKELY((size_t)(in_end - in) >= FAST_IN_MARGIN && avail_out + slack >= FAST_OUT_MARGIN))
+	{
+		//the fast path: with plenty of room on both sides, decode whole
+		//sequences at a time, handing off to the phases below whenever
+		//a sequence gets too close to either end
+
+		uint8_t c = *in++;
+
+		lit_len = c >> 4;
+		mat_len = (c & 0xF) + 4;
+
+		if (LIKELY(lit_len != 0xF))
+		{
+			STAT_LIT(lit_len);
+
+			if (UNLIKELY(lit_len > avail_out))
+				//only possible with slack, we'd write past the end for real
+				TRANSITION_TO_PHASE(COPY_LIT);
+
+			memcpy(out, in, 16);
+			in += lit_len;
+			out += lit_len;
+			avail_out -= lit_len;
+		}
+		else
+		{
+			do
+			{
+				if (in == in_end)
+					TRANSITION_TO_PHASE(READ_EX_LIT_LEN);
+
+				c = *in++;
+
+				if (c > MAX_BLOCK_LEN - lit_len)
+					TRANSITION_TO_PHASE(REPORT_ERROR);
+
+				lit_len += c;
+			} while (c == 0xFF);
+
+			STAT_LIT(lit_len);
+
+			if (lit_len + (size_t)2 > (size_t)(in_end - in) || lit_len > avail_out)
+				TRANSITION_TO_PHASE(COPY_LIT);
+
+			memcpy(out, in, lit_len);
+			in += lit_len;
+			out += lit_len;
+			avail_out -= lit_len;
+		}
+		lit_len = 0;
+
+		mat_dst = in[0] | (unsigned int)in[1] << 8;
+		in += 2;
+
+		if (UNLIKELY(BAD_MAT_DST(mat_dst)))
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		if (mat_len == 0xF + 4)
+			do
+			{
+				if (in == in_end)
+					TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
+
+				c = *in++;
+
+				if (c > MAX_BLOCK_LEN - mat_len)
+					TRANSITION_TO_PHASE(REPORT_ERROR);
+
+				mat_len += c;
+			} while (c == 0xFF);
+
+		STAT_MAT(mat_dst, mat_len);
+
+		if (UNLIKELY(mat_dst > (size_t)(out - out_start) ||
+			mat_len > avail_out || avail_out - mat_len + slack < FAST_MAT_SLACK))
+			//the match reaches back into o_buf, or runs up against the end of out
+			TRANSITION_TO_PHASE(COPY_MAT);
+
+		out = lz4_dec_cpy_mat_wild(out, mat_dst, mat_len, simd);
+		STAT_ADD(s, cpy_mat_wild, 1);
+		avail_out -= mat_len;
+		mat_len = 0;
+
+		if (hash && (size_t)(out - h_from) >= HASH_STEP)
+		{
+			lz4_xxh32_update(&s->p_.xxh, h_from, (size_t)(out - h_from));
+			h_from = out;
+		}
+	}
+
 	{
 		SUSPEND_IF_INPUT_EMPTY();
 		uint8_t c = *in++;
@@ -541,6 +1072,9 @@ phase_READ_TOK: //read a token
 		mat_len = (c & 0xF) + 4;
 	}
 
+	if (lit_len != 0xF)
+		STAT_LIT(lit_len);
+
 	switch (lit_len)
 	{
 	case 0: TRANSITION_TO_PHASE(READ_OFS); //we just read a match
@@ -562,6 +1096,7 @@ phase_READ_EX_LIT_LEN: //loop; read an additional byte of literal length
 			goto phase_READ_EX_LIT_LEN; //loop
 	}
 
+	STAT_LIT(lit_len);
 	TRANSITION_TO_PHASE(COPY_LIT);
 
 phase_COPY_LIT: //copy lit_len bytes from the input to the output
@@ -575,43 +1110,11 @@ phase_COPY_LIT: //copy lit_len bytes from the input to the output
 		if (clamped_lit_len > avail_out)
 			clamped_lit_len = (unsigned int)avail_out;
 
-		if (clamped_lit_len > O_BUF_LEN)
-		{
-			unsigned int first_copy_len = clamped_lit_len - O_BUF_LEN;
-			memcpy(out, in, first_copy_len);
-			in += first_copy_len;
-			out += first_copy_len;
-
-			memcpy(o_buf, in, O_BUF_LEN);
-			in += O_BUF_LEN;
-			memcpy(out, o_buf, O_BUF_LEN);
-			out += O_BUF_LEN;
-
-			o_pos = 0;
-		}
-		else
-		{
-			unsigned int o_buf_avail = O_BUF_LEN - o_pos;
-
-			unsigned int first_copy_len = clamped_lit_len < o_buf_avail ? clamped_lit_len : o_buf_avail;
-			memcpy(o_buf + o_pos, in, first_copy_len);
-			in += first_copy_len;
-			memcpy(out, o_buf + o_pos, first_copy_len);
-			out += first_copy_len;
-
-			o_pos = WRAP_OBUF_IDX(o_pos + first_copy_len);
-
-			unsigned int second_copy_len = clamped_lit_len - first_copy_len;
-			if (second_copy_len)
-			{
-				memcpy(o_buf, in, second_copy_len);
-				in += second_copy_len;
-				memcpy(out, o_buf, second_copy_len);
-				out += second_copy_len;
-
-				o_pos = second_copy_len;
-			}
-		}
+		//nb: runv may have no output segment at all, leaving out null
+		if (clamped_lit_len)
+			memcpy(out, in, clamped_lit_len);
+		in += clamped_lit_len;
+		out += clamped_lit_len;
 
 		avail_out -= clamped_lit_len;
 		lit_len -= clamped_lit_len;
@@ -632,15 +1135,15 @@ phase_READ_OFS: //read the first byte of a match offset
 phase_READ_OFS2: //read the second byte of a match offset
 	SUSPEND_IF_INPUT_EMPTY();
 	mat_dst |= (unsigned int)*in++ << 8;
-	_Static_assert(0xFFFF < O_BUF_LEN, "mat_dst must never reach beyond o_buf");
 
-	if (!mat_dst)
+	if (BAD_MAT_DST(mat_dst))
 		TRANSITION_TO_PHASE(REPORT_ERROR);
 
 	if (mat_len == 0xF + 4)
 		TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
-	else
-		TRANSITION_TO_PHASE(COPY_MAT);
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
 
 phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
 	{
@@ -656,41 +1159,104 @@ phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
 			goto phase_READ_EX_MAT_LEN; //loop
 	}
 
+	STAT_MAT(mat_dst, mat_len);
 	TRANSITION_TO_PHASE(COPY_MAT);
 
 phase_COPY_MAT: //copy mat_len bytes from mat_dst bytes behind the output cursor
 	assert(mat_len > 0);
+	if (UNLIKELY(s->p_.dict != 0))
 	{
-		//nb: mat_dst will not be more than O_BUF_LEN
-		unsigned int o_inpos = WRAP_OBUF_IDX(o_pos - mat_dst);
-
-		unsigned int clamped_mat_len = mat_len;
-		if (clamped_mat_len > avail_out)
-			clamped_mat_len = (unsigned int)avail_out;
+		//early on, a match may start out in the dictionary
+		const uint8_t *dict_src = 0;
+		int n = lz4_dec_dict_part(s, s->avail_out - avail_out, mat_dst,
+			mat_len < avail_out ? mat_len : (unsigned int)avail_out, &dict_src);
+		if (n < 0)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+		if (n)
+		{
+			STAT_ADD(s, cpy_mat_dict, 1);
+			memcpy(out, dict_src, n);
+		}
 
-		unsigned int copy_mat_len = clamped_mat_len;
+		out += n;
+		avail_out -= n;
+		mat_len -= n;
 
-		_Static_assert(sizeof(uintptr_t) < 16, "fix below");
-		unsigned int n_copied;
-		if (mat_dst >= copy_mat_len)
-			n_copied = lz4_dec_cpy_mat_no_overlap(copy_mat_len, o_inpos, o_pos, o_buf, out);
-		else if (mat_dst >= sizeof(uintptr_t))
-			n_copied = lz4_dec_cpy_mat_rle_long_dst(copy_mat_len, o_inpos, o_pos, o_buf, out);
-		else
-			n_copied = lz4_dec_cpy_mat_rle_short_dst(copy_mat_len, mat_dst, o_inpos, o_pos, o_buf, out);
+		if (!mat_len)
+			TRANSITION_TO_PHASE(READ_TOK);
+	}
+	{
+		//nb: mat_dst will not be more than O_BUF_LEN
+		unsigned int clamped_mat_len = mat_len < avail_out ?
+			mat_len :
+			(unsigned int)avail_out;
 
-		o_inpos = WRAP_OBUF_IDX(o_inpos + n_copied);
-		o_pos = WRAP_OBUF_IDX(o_pos + n_copied);
-		copy_mat_len -= n_copied;
-		out += n_copied;
+		if (clamped_mat_len)
+		{
+			size_t n_in_out = out - out_start;
+			if (mat_dst > n_in_out)
+			{
+				if (retain)
+					//reaching back past the start of the output
+					TRANSITION_TO_PHASE(REPORT_ERROR);
 
-		//consume any remaining bytes past the end of the last block
-		lz4_dec_cpy_mat_bytes(copy_mat_len, o_inpos, o_pos, o_buf, out);
-		o_pos = WRAP_OBUF_IDX(o_pos + copy_mat_len);
-		out += copy_mat_len;
+				//we're reading far enough back that we need to hit the buffer
+				//(or runv's earlier segments)
 
-		avail_out -= clamped_mat_len;
-		mat_len -= clamped_mat_len;
+				//figure out how far back into the buffer we need to go
+				unsigned int buf_dst = mat_dst - (unsigned int)n_in_out; //nb: n_in_out <= mat_dst
+				//and how many bytes we'll pull from it
+				unsigned int buf_cnt = buf_dst < clamped_mat_len ? buf_dst : clamped_mat_len;
+
+				STAT_ADD(s, cpy_mat_history, 1);
+
+				if (segs)
+					lz4_dec_cpy_segs(segs, o_buf, o_pos, buf_dst, buf_cnt, out);
+				else
+				{
+					//exactly where in the buffer we'll copy from
+					unsigned int buf_src = WRAP_OBUF_IDX(o_pos - buf_dst);
+
+					unsigned int e = buf_src + buf_cnt;
+					if (e > O_BUF_LEN)
+					{
+						e = O_BUF_LEN - buf_src;
+						memcpy(out, o_buf + buf_src, e);
+						memcpy(out + e, o_buf, buf_cnt - e);
+					}
+					else
+					{
+						memcpy(out, o_buf + buf_src, buf_cnt);
+					}
+				}
+
+				out += buf_cnt;
+				avail_out -= buf_cnt;
+
+				clamped_mat_len -= buf_cnt;
+				mat_len -= buf_cnt;
+			}
+
+			size_t c = clamped_mat_len;
+			size_t spare = avail_out - c + slack; //room past the end of what we'll copy
+			if (c && c + spare > FAST_MAT_SLACK)
+			{
+				//wild-copy as much as we can, the byte loop below fixes up any
+				//overshoot (nb: not when the whole match came out of o_buf, as
+				//out - mat_dst may then lie before out_start)
+				unsigned int n = (unsigned int)(c + spare - FAST_MAT_SLACK < c ? c + spare - FAST_MAT_SLACK : c);
+				out = lz4_dec_cpy_mat_wild(out, mat_dst, n, simd);
+				STAT_ADD(s, cpy_mat_wild, 1);
+				c -= n;
+			}
+
+			const uint8_t *out_src = out - mat_dst;
+			while (c--)
+				*out++ = *out_src++;
+
+			avail_out -= clamped_mat_len;
+			mat_len -= clamped_mat_len;
+		}
 	}
 
 	if (mat_len)
@@ -701,6 +1267,27 @@ phase_COPY_MAT: //copy mat_len bytes from mat_dst bytes behind the output cursor
 
 suspend_for_now:
 	//tuck everything away for the next call
+	if (hash)
+		lz4_xxh32_update(&s->p_.xxh, h_from, (size_t)(out - h_from));
+
+	{
+		int blk_end = lz4_dec_check_block_end(s, (size_t)(in - s->in), s->avail_out - avail_out, &phase);
+		if (blk_end < 0)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		if (retain)
+			s->p_.o_retained += (size_t)(out - s->out);
+		else if (segs)
+			; //runv saves the history once it's done with all of its segments
+		else if (!blk_end || !(s->p_.flags & LZ4_DEC_STREAM_INDEPENDENT_BLOCKS))
+		{
+			size_t n = (size_t)(out - out_start);
+			STAT_ADD(s, hist_bytes, n < O_BUF_LEN ? n : O_BUF_LEN);
+
+			o_pos = lz4_dec_push_history(o_buf, o_pos, out_start, n);
+		}
+		//else nothing that follows can reach back into this block
+	}
 
 	STREAM_RUN_SUSPEND_EPILOG();
 	return 0;
@@ -709,3 +1296,1625 @@ phase_REPORT_ERROR:
 	s->p_.phase = PHASE_REPORT_ERROR;
 	return -1;
 }
+
+int lz4_dec_stream_run(lz4_dec_stream_state *s)
+{
+	if (s->p_.flags & LZ4_DEC_STREAM_XXH32)
+		return lz4_dec_stream_run_impl(s, 0, 1, 0);
+
+	return lz4_dec_stream_run_impl(s, 0, 0, 0);
+}
+
+int lz4_dec_stream_run_slack(lz4_dec_stream_state *s, size_t slack)
+{
+	_Static_assert(FAST_OUT_MARGIN <= FAST_MAT_SLACK, "fix the clamp below");
+	if (slack > FAST_MAT_SLACK)
+		slack = FAST_MAT_SLACK; //nothing uses more, and this keeps the arithmetic from overflowing
+
+	if (s->p_.flags & LZ4_DEC_STREAM_XXH32)
+		return lz4_dec_stream_run_impl(s, slack, 1, 0);
+
+	return lz4_dec_stream_run_impl(s, slack, 0, 0);
+}
+
+static unsigned int lz4_dec_cpy_mat_no_overlap(
+	unsigned int copy_mat_len,
+	unsigned int o_inpos, unsigned int o_pos,
+	uint8_t* restrict o_buf, uint8_t* restrict out)
+{
+	for (unsigned int copy_len, copy_mat_len_left = copy_mat_len; copy_mat_len_left != 0; copy_mat_len_left -= copy_len)
+	{
+		copy_len = copy_mat_len_left;
+
+		unsigned int pos_avail = O_BUF_LEN - o_pos;
+		if (UNLIKELY(copy_len > pos_avail))
+			copy_len = pos_avail;
+
+		unsigned int inpos_avail = O_BUF_LEN - o_inpos;
+		if (UNLIKELY(copy_len > inpos_avail))
+			copy_len = inpos_avail;
+
+		//nb: the source and destination ranges can still overlap when
+		//mat_dst is within copy_len of O_BUF_LEN, the write cursor is
+		//then just *behind* the read cursor, hence the order and memmove
+		memcpy(out, o_buf + o_inpos, copy_len);
+		memmove(o_buf + o_pos, o_buf + o_inpos, copy_len);
+
+		o_pos = WRAP_OBUF_IDX(o_pos + copy_len);
+		o_inpos = WRAP_OBUF_IDX(o_inpos + copy_len);
+
+		out += copy_len;
+	}
+
+	return copy_mat_len;
+}
+
+static unsigned int lz4_dec_cpy_mat_rle_long_dst(
+	unsigned int copy_mat_len,
+	unsigned int o_inpos, unsigned int o_pos,
+	uint8_t* restrict o_buf, uint8_t* restrict out)
+{
+	_Static_assert(sizeof(uintptr_t) <= O_BUF_PAD, "padding insufficient for sloppy reads");
+
+	unsigned int n_copied = 0;
+
+	while (copy_mat_len >= sizeof(uintptr_t))
+	{
+		uintptr_t c;
+
+		//read the next word from o_buf's read cursor
+
+		memcpy(&c, o_buf + o_inpos, sizeof(c));
+
+		unsigned int n_read = O_BUF_LEN - o_inpos;
+		if (UNLIKELY(n_read < sizeof(c)))
+		{
+			//we read off the end of o_buf's active area into the scratch space
+			//read from the beginning and patch the read values
+
+			uintptr_t c2;
+			memcpy(&c2, o_buf, sizeof(c2));
+
+			c &= MASK_N(uintptr_t, n_read);
+			c |= c2 LBOS n_read * 8;
+		}
+		o_inpos = WRAP_OBUF_IDX(o_inpos + sizeof(c));
+
+		//write the word back to o_buf's write cursor
+
+		memcpy(o_buf + o_pos, &c, sizeof(c));
+
+		unsigned int n_written = O_BUF_LEN - o_pos;
+		o_pos = WRAP_OBUF_IDX(o_pos + sizeof(c));
+
+		if (UNLIKELY(n_written < sizeof(c)))
+			//some bytes went into the scratch pad past the end
+			//need to copy those to the beginning of the buffer
+			memcpy(o_buf + o_pos - sizeof(c), &c, sizeof(c));
+
+		memcpy(out + n_copied, &c, sizeof(c));
+		n_copied += sizeof(c);
+
+		copy_mat_len -= sizeof(c);
+	}
+
+	return n_copied;
+}
+
+static unsigned int lz4_dec_cpy_mat_rle_short_dst(
+	unsigned int copy_mat_len, unsigned int mat_dst,
+	unsigned int o_inpos, unsigned int o_pos,
+	uint8_t* restrict o_buf, uint8_t* restrict out)
+{
+	_Static_assert(sizeof(uintptr_t) <= O_BUF_PAD, "padding insufficient for sloppy reads");
+	assert(mat_dst < sizeof(uintptr_t));
+	ASSUME(mat_dst < sizeof(uintptr_t));
+
+	if (copy_mat_len < sizeof(uintptr_t))
+		return 0;
+
+	unsigned int n_copied = 0;
+
+	uintptr_t c;
+	memcpy(&c, o_buf + o_inpos, sizeof(c));
+	unsigned int n_read = O_BUF_LEN - o_inpos;
+	if (UNLIKELY(n_read < mat_dst))
+	{
+		uintptr_t c2;
+		memcpy(&c2, o_buf, sizeof(c2));
+
+		c &= MASK_N(uintptr_t, n_read);
+		c |= c2 LBOS n_read * 8;
+	}
+
+	c &= MASK_N(uintptr_t, mat_dst);
+	for (unsigned int n = mat_dst; n < sizeof(uintptr_t); n *= 2)
+		c |= c LBOS n * 8;
+
+	unsigned int shift = (sizeof(uintptr_t) % mat_dst) * 8;
+
+	while (copy_mat_len >= sizeof(c))
+	{
+		memcpy(o_buf + o_pos, &c, sizeof(c));
+
+		unsigned int n_written = O_BUF_LEN - o_pos;
+		o_pos = WRAP_OBUF_IDX(o_pos + sizeof(c));
+
+		if (UNLIKELY(n_written < sizeof(c)))
+			//some bytes went into the scratch pad past the end
+			//need to copy those to the beginning of the buffer
+			memcpy(o_buf + o_pos - sizeof(c), &c, sizeof(c));
+
+		memcpy(out + n_copied, &c, sizeof(c));
+		n_copied += sizeof(c);
+
+		if (shift) //a pattern that divides the word repeats as-is (and shifting by 64 is UB)
+		{
+			c = c RBOS shift;
+			c |= c LBOS (sizeof(uintptr_t) * 8 - shift);
+		}
+
+		copy_mat_len -= sizeof(c);
+	}
+
+	return n_copied;
+}
+
+//fills len bytes of o_buf starting at o_pos with the mat_dst-byte (< 16)
+//pattern in pat[16], a run at a time between wraps
+static void lz4_dec_rep_obuf(
+	unsigned int len, unsigned int mat_dst, const uint8_t* restrict pat,
+	unsigned int o_pos, uint8_t* restrict o_buf,
+	unsigned int simd)
+{
+	//only the final O_BUF_LEN bytes matter
+	unsigned int n_done = len > O_BUF_LEN ? len - O_BUF_LEN : 0;
+	o_pos = WRAP_OBUF_IDX(o_pos + n_done);
+
+	while (n_done < len)
+	{
+		unsigned int n = len - n_done;
+		if (n > O_BUF_LEN - o_pos)
+			n = O_BUF_LEN - o_pos;
+
+		uint8_t rot[16] = {0};
+		for (unsigned int i = 0, j = n_done % mat_dst; i < mat_dst; i++)
+		{
+			rot[i] = pat[j];
+			if (++j == mat_dst) j = 0;
+		}
+
+		lz4_dec_rep_exact(o_buf + o_pos, rot, mat_dst, n, simd);
+
+		n_done += n;
+		o_pos = WRAP_OBUF_IDX(o_pos + n);
+	}
+}
+
+static unsigned int lz4_dec_cpy_mat_rle_simd(
+	unsigned int copy_mat_len, unsigned int mat_dst,
+	unsigned int o_inpos, unsigned int o_pos,
+	uint8_t* restrict o_buf, uint8_t* restrict out,
+	unsigned int simd)
+{
+	assert(mat_dst < 16);
+
+	//gather the pattern, which might wrap around the end of o_buf
+	uint8_t pat[16] = {0};
+	for (unsigned int i = 0; i < mat_dst; i++)
+		pat[i] = o_buf[WRAP_OBUF_IDX(o_inpos + i)];
+
+	lz4_dec_rep_exact(out, pat, mat_dst, copy_mat_len, simd);
+
+	//then write it to o_buf (never reading back from out)
+	lz4_dec_rep_obuf(copy_mat_len, mat_dst, pat, o_pos, o_buf, simd);
+
+	return copy_mat_len;
+}
+
+static void lz4_dec_cpy_mat_bytes(
+	unsigned int copy_mat_len, unsigned int o_inpos, unsigned int o_pos,
+	uint8_t* restrict o_buf, uint8_t* restrict out)
+{
+	for (unsigned int i = 0; i < copy_mat_len; i++)
+	{
+		uint8_t c = o_buf[o_inpos];
+		o_inpos = WRAP_OBUF_IDX(o_inpos + 1);
+
+		o_buf[o_pos] = c;
+		o_pos = WRAP_OBUF_IDX(o_pos + 1);
+
+		*out++ = c;
+	}
+}
+
+//hash: feed the output to the xxHash32, in chunks, out of o_buf
+static STREAM_RUN_INLINE int lz4_dec_stream_run_dst_uncached_impl(lz4_dec_stream_state* s, int hash)
+{
+	STREAM_RUN_PROLOG();
+
+	unsigned int h_pos = o_pos; //o_buf[h_pos, o_pos) is decoded, but not yet hashed
+
+	STREAM_RESUME_FROM_SUSPEND();
+
+phase_READ_TOK: //read a token
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		lit_len = c >> 4;
+		mat_len = (c & 0xF) + 4;
+	}
+
+	if (lit_len != 0xF)
+		STAT_LIT(lit_len);
+
+	switch (lit_len)
+	{
+	case 0: TRANSITION_TO_PHASE(READ_OFS); //we just read a match
+	case 0xF: TRANSITION_TO_PHASE(READ_EX_LIT_LEN); //we have a long literal, read more length bytes
+	default: TRANSITION_TO_PHASE(COPY_LIT); //copy lit_len bytes to the output
+	}
+
+phase_READ_EX_LIT_LEN: //loop; read an additional byte of literal length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - lit_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		lit_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_LIT_LEN; //loop
+	}
+
+	STAT_LIT(lit_len);
+	TRANSITION_TO_PHASE(COPY_LIT);
+
+phase_COPY_LIT: //copy lit_len bytes from the input to the output
+	assert(lit_len > 0);
+	{
+		unsigned int clamped_lit_len = lit_len;
+
+		size_t avail_in = in_end - in;
+		if (clamped_lit_len > avail_in)
+			clamped_lit_len = (unsigned int)avail_in;
+		if (clamped_lit_len > avail_out)
+			clamped_lit_len = (unsigned int)avail_out;
+		if (hash && clamped_lit_len > HASH_STEP)
+			clamped_lit_len = HASH_STEP; //so o_buf never laps what's not hashed yet
+
+		if (clamped_lit_len > O_BUF_LEN)
+		{
+			unsigned int first_copy_len = clamped_lit_len - O_BUF_LEN;
+			memcpy(out, in, first_copy_len);
+			in += first_copy_len;
+			out += first_copy_len;
+
+			memcpy(o_buf, in, O_BUF_LEN);
+			in += O_BUF_LEN;
+			memcpy(out, o_buf, O_BUF_LEN);
+			out += O_BUF_LEN;
+
+			o_pos = 0;
+		}
+		else
+		{
+			unsigned int o_buf_avail = O_BUF_LEN - o_pos;
+
+			unsigned int first_copy_len = clamped_lit_len < o_buf_avail ? clamped_lit_len : o_buf_avail;
+			memcpy(o_buf + o_pos, in, first_copy_len);
+			in += first_copy_len;
+			memcpy(out, o_buf + o_pos, first_copy_len);
+			out += first_copy_len;
+
+			o_pos = WRAP_OBUF_IDX(o_pos + first_copy_len);
+
+			unsigned int second_copy_len = clamped_lit_len - first_copy_len;
+			if (second_copy_len)
+			{
+				memcpy(o_buf, in, second_copy_len);
+				in += second_copy_len;
+				memcpy(out, o_buf, second_copy_len);
+				out += second_copy_len;
+
+				o_pos = second_copy_len;
+			}
+		}
+
+		avail_out -= clamped_lit_len;
+		lit_len -= clamped_lit_len;
+
+		STAT_ADD(s, hist_bytes, clamped_lit_len < O_BUF_LEN ? clamped_lit_len : O_BUF_LEN);
+	}
+
+	HASH_OBUF_CATCH_UP();
+
+	if (lit_len)
+	{
+		if (hash && in != in_end && avail_out)
+			goto phase_COPY_LIT; //only stopped to hash
+
+		//there's more literal to copy, but either src or dst bufs ran out
+		SUSPEND_FOR_NOW();
+	}
+
+	TRANSITION_TO_PHASE(READ_OFS);
+
+phase_READ_OFS: //read the first byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst = *in++;
+
+	TRANSITION_TO_PHASE(READ_OFS2);
+
+phase_READ_OFS2: //read the second byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst |= (unsigned int)*in++ << 8;
+
+	if (BAD_MAT_DST(mat_dst))
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	if (mat_len == 0xF + 4)
+		TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - mat_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		mat_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_MAT_LEN; //loop
+	}
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_COPY_MAT: //copy mat_len bytes from mat_dst bytes behind the output cursor
+	assert(mat_len > 0);
+	if (UNLIKELY(s->p_.dict != 0))
+	{
+		//early on, a match may start out in the dictionary
+		const uint8_t *dict_src = 0;
+		unsigned int len = mat_len < avail_out ? mat_len : (unsigned int)avail_out;
+		if (hash && len > HASH_STEP)
+			len = HASH_STEP;
+
+		int n = lz4_dec_dict_part(s, s->avail_out - avail_out, mat_dst, len, &dict_src);
+		if (n < 0)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+		if (n)
+		{
+			STAT_ADD(s, cpy_mat_dict, 1);
+			STAT_ADD(s, hist_bytes, n);
+			memcpy(out, dict_src, n);
+			o_pos = lz4_dec_push_history(o_buf, o_pos, dict_src, n);
+		}
+
+		out += n;
+		avail_out -= n;
+		mat_len -= n;
+
+		HASH_OBUF_CATCH_UP();
+
+		if (!mat_len)
+			TRANSITION_TO_PHASE(READ_TOK);
+		if (!avail_out)
+			SUSPEND_FOR_NOW();
+		if ((unsigned int)n == len)
+			goto phase_COPY_MAT; //clamped for hashing, the rest may still be in the dictionary
+	}
+	{
+		//nb: mat_dst will not be more than O_BUF_LEN
+		unsigned int o_inpos = WRAP_OBUF_IDX(o_pos - mat_dst);
+
+		unsigned int clamped_mat_len = mat_len;
+		if (clamped_mat_len > avail_out)
+			clamped_mat_len = (unsigned int)avail_out;
+		if (hash && clamped_mat_len > HASH_STEP)
+			clamped_mat_len = HASH_STEP;
+
+		unsigned int copy_mat_len = clamped_mat_len;
+
+		_Static_assert(sizeof(uintptr_t) < 16, "fix below");
+		unsigned int n_copied;
+		if (mat_dst >= copy_mat_len)
+		{
+			n_copied = lz4_dec_cpy_mat_no_overlap(copy_mat_len, o_inpos, o_pos, o_buf, out);
+			STAT_ADD(s, cpy_mat_no_overlap, 1);
+		}
+		else if (mat_dst < 16 && s->p_.simd != SIMD_NONE)
+		{
+			n_copied = lz4_dec_cpy_mat_rle_simd(copy_mat_len, mat_dst, o_inpos, o_pos, o_buf, out, s->p_.simd);
+			STAT_ADD(s, cpy_mat_rle_simd, 1);
+		}
+		else if (mat_dst >= sizeof(uintptr_t))
+		{
+			n_copied = lz4_dec_cpy_mat_rle_long_dst(copy_mat_len, o_inpos, o_pos, o_buf, out);
+			STAT_ADD(s, cpy_mat_rle_long_dst, 1);
+		}
+		else
+		{
+			n_copied = lz4_dec_cpy_mat_rle_short_dst(copy_mat_len, mat_dst, o_inpos, o_pos, o_buf, out);
+			STAT_ADD(s, cpy_mat_rle_short_dst, 1);
+		}
+
+		o_inpos = WRAP_OBUF_IDX(o_inpos + n_copied);
+		o_pos = WRAP_OBUF_IDX(o_pos + n_copied);
+		copy_mat_len -= n_copied;
+		out += n_copied;
+
+		//consume any remaining bytes past the end of the last block
+		lz4_dec_cpy_mat_bytes(copy_mat_len, o_inpos, o_pos, o_buf, out);
+		o_pos = WRAP_OBUF_IDX(o_pos + copy_mat_len);
+		out += copy_mat_len;
+
+		avail_out -= clamped_mat_len;
+		mat_len -= clamped_mat_len;
+
+		STAT_ADD(s, hist_bytes, clamped_mat_len);
+	}
+
+	HASH_OBUF_CATCH_UP();
+
+	if (mat_len)
+	{
+		if (hash && avail_out)
+			goto phase_COPY_MAT; //only stopped to hash
+
+		//we ran out of avail_out before we finished
+		SUSPEND_FOR_NOW();
+	}
+
+	TRANSITION_TO_PHASE(READ_TOK);
+
+suspend_for_now:
+	//tuck everything away for the next call
+	if (hash)
+		lz4_dec_hash_obuf(s, o_buf, h_pos, o_pos);
+
+	if (lz4_dec_check_block_end(s, (size_t)(in - s->in), s->avail_out - avail_out, &phase) < 0)
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	STREAM_RUN_SUSPEND_EPILOG();
+	return 0;
+
+phase_REPORT_ERROR:
+	s->p_.phase = PHASE_REPORT_ERROR;
+	return -1;
+}
+
+int lz4_dec_stream_run_dst_uncached(lz4_dec_stream_state* s)
+{
+	assert(!(s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT) && "only lz4_dec_stream_run can retain output");
+
+	if (s->p_.flags & LZ4_DEC_STREAM_XXH32)
+		return lz4_dec_stream_run_dst_uncached_impl(s, 1);
+
+	return lz4_dec_stream_run_dst_uncached_impl(s, 0);
+}
+
+/*
+	Picking an engine call by call.
+
+	On ordinary (cached) memory, lz4_dec_stream_run wins wherever matches
+	make up much of the output, often by 2x or more, since its fast path
+	copies them straight out of out. Where the output is nearly all
+	literals, both end up copying every byte twice (in to out to o_buf,
+	or in to o_buf to out), and run_dst_uncached's simpler loop comes out
+	a little ahead, given a few KiB of output per call. Both
+	keep o_buf holding the latest history between calls, so switching
+	from one to the other costs nothing.
+
+	So calls with little room for output always go to lz4_dec_stream_run,
+	and the rest go by a running average of how much input each takes per
+	byte of output (close to 1 for literals, and far less for matches).
+	That falls out of avail_in and avail_out, so the engines themselves
+	don't have to keep count, and the bookkeeping is a handful of shifts
+	and adds a call.
+*/
+
+#define AUTO_MIN_OUT			4096 //calls with less room for output than this always go cached
+#define AUTO_LIT_ON				240 //at least this much input per 256 bytes of output goes uncached...
+#define AUTO_LIT_OFF			208 //...until it drops below this
+
+//a running average (times 8) of v, weighing each new value 1/8th
+#define AUTO_AVG(avg, v)		((avg) - ((avg) >> 3) + (unsigned int)(v))
+
+int lz4_dec_stream_run_auto(lz4_dec_stream_state *s)
+{
+	size_t avail_in = s->avail_in;
+	size_t avail_out = s->avail_out;
+
+	if (avail_out < AUTO_MIN_OUT || (s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT))
+		//too little to be worth even the bookkeeping (or nothing to gain)
+		return lz4_dec_stream_run(s);
+
+	int ret = (s->p_.flags & FLAG_AUTO_UNCACHED) ?
+		lz4_dec_stream_run_dst_uncached(s) :
+		lz4_dec_stream_run(s);
+
+	//nb: clamped so the averages can't overflow below
+	size_t n_in = avail_in - s->avail_in;
+	size_t n_out = avail_out - s->avail_out;
+	s->p_.auto_in = AUTO_AVG(s->p_.auto_in, n_in < O_BUF_LEN ? n_in : O_BUF_LEN);
+	s->p_.auto_out = AUTO_AVG(s->p_.auto_out, n_out < O_BUF_LEN ? n_out : O_BUF_LEN);
+
+	//and decide for the next call
+	unsigned int lit_limit = (s->p_.flags & FLAG_AUTO_UNCACHED) ? AUTO_LIT_OFF : AUTO_LIT_ON;
+	if (s->p_.auto_out && s->p_.auto_in * 256 >= s->p_.auto_out * lit_limit)
+		s->p_.flags |= FLAG_AUTO_UNCACHED;
+	else
+		s->p_.flags &= ~FLAG_AUTO_UNCACHED;
+
+	return ret;
+}
+
+static int lz4_dec_stream_run_segs(lz4_dec_stream_state *s, const lz4_dec_out_segs *segs)
+{
+	if (s->p_.flags & LZ4_DEC_STREAM_XXH32)
+		return lz4_dec_stream_run_impl(s, 0, 1, segs);
+
+	return lz4_dec_stream_run_impl(s, 0, 0, segs);
+}
+
+//saves the last window's worth of runv's output (the segments before cur, and
+//cur up to s->out) as history, which is what a suspend would've done each time
+static void lz4_dec_segs_push_history(lz4_dec_stream_state *s, const lz4_dec_out_segs *segs)
+{
+	uint8_t *o_buf = s->p_.o_buf + O_BUF_PAD;
+
+	size_t k = segs->cur;
+	size_t cur_len = (size_t)(s->out - segs->seg[k].data);
+
+	//step back to the segment the window starts in
+	size_t n = cur_len;
+	while (k && n < O_BUF_LEN)
+		n += segs->seg[--k].len;
+
+	size_t skip = n > O_BUF_LEN ? n - O_BUF_LEN : 0;
+	STAT_ADD(s, hist_bytes, n - skip);
+
+	//nb: empty segments may well have null data
+	unsigned int o_pos = s->p_.o_pos;
+	for (; k <= segs->cur; k++, skip = 0)
+	{
+		size_t len = k < segs->cur ? segs->seg[k].len : cur_len;
+		if (len > skip)
+			o_pos = lz4_dec_push_history(o_buf, o_pos, segs->seg[k].data + skip, len - skip);
+	}
+
+	s->p_.o_pos = o_pos;
+}
+
+int lz4_dec_stream_runv(lz4_dec_stream_state *s,
+	const lz4_dec_stream_span *in, size_t in_cnt, size_t *in_len,
+	const lz4_dec_stream_iov *out, size_t out_cnt, size_t *out_len)
+{
+	assert(!(s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT) && "segments aren't contiguous");
+
+	*in_len = 0;
+	*out_len = 0;
+
+	if (!out_cnt)
+	{
+		//nothing to decode into, but maybe the end of a block to reach
+		static const lz4_dec_stream_iov none = {0, 0};
+		out = &none;
+		out_cnt = 1;
+	}
+
+	lz4_dec_out_segs segs;
+	segs.seg = out;
+	segs.cur = 0;
+	segs.prev_len = 0;
+
+	size_t i = 0;
+
+	s->avail_in = 0;
+	s->out = out[0].data;
+	s->avail_out = out[0].len;
+
+	for (;;)
+	{
+		for (; !s->avail_in && i < in_cnt; i++)
+		{
+			s->in = in[i].data;
+			s->avail_in = in[i].len;
+		}
+		while (!s->avail_out && segs.cur + 1 < out_cnt)
+		{
+			//nb: the segment's full, so it's all history now
+			segs.prev_len += out[segs.cur].len;
+			segs.cur++;
+
+			s->out = out[segs.cur].data;
+			s->avail_out = out[segs.cur].len;
+		}
+
+		size_t prev_avail_in = s->avail_in;
+		size_t prev_avail_out = s->avail_out;
+
+		if (lz4_dec_stream_run_segs(s, &segs))
+			return -1;
+
+		*in_len += prev_avail_in - s->avail_in;
+		*out_len += prev_avail_out - s->avail_out;
+
+		if (s->avail_in == prev_avail_in && s->avail_out == prev_avail_out)
+			//out of input or output segments, or at the end of a block
+			break;
+	}
+
+	lz4_dec_segs_push_history(s, &segs);
+	return 0;
+}
+
+/*
+	Batches of small, independent streams: what hurts there is mostly
+	waiting on memory for each state (and its input and output) in turn,
+	so run_prefetched prefetches a few streams ahead of the one it's decoding.
+	That's done in two stages, as the input and output pointers have to be
+	loaded from the state before what they point to can be prefetched.
+
+	The streams aren't interleaved. Round-robin over short avail_out slices
+	was tried, and paying the run prolog and epilog once per slice cost far
+	more than overlapping the streams' misses won back.
+*/
+
+#if defined(__GNUC__)
+	#define PREFETCH(p)			__builtin_prefetch((p), 0)
+	#define PREFETCH_W(p)		__builtin_prefetch((p), 1)
+#elif HAVE_X86_SIMD
+	#define PREFETCH(p)			_mm_prefetch((const char *)(p), _MM_HINT_T0)
+	#define PREFETCH_W(p)		_mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+	#define PREFETCH(p)			((void)(p))
+	#define PREFETCH_W(p)		((void)(p))
+#endif
+
+#define BATCH_PREFETCH_AHEAD	4 //how many streams ahead to pull in the input and output
+
+//the state's own fields live at both ends of it (o_buf sits in between)
+static void lz4_dec_prefetch_state(const lz4_dec_stream_state *s)
+{
+	PREFETCH_W(s);
+	PREFETCH_W(&s->p_.lit_len);
+}
+
+//what the first sequences of the next call will touch
+static void lz4_dec_prefetch_data(const lz4_dec_stream_state *s)
+{
+	if (s->avail_in)
+	{
+		PREFETCH(s->in);
+		if (s->avail_in > 64)
+			PREFETCH(s->in + 64);
+	}
+
+	if (s->avail_out)
+		PREFETCH_W(s->out);
+
+	//suspend saves history at o_pos, and early matches may read from just behind it
+	PREFETCH_W(s->p_.o_buf + O_BUF_PAD + s->p_.o_pos);
+}
+
+int lz4_dec_stream_run_prefetched(lz4_dec_stream_state *const *s, size_t n, int *results)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < n && i < 2 * BATCH_PREFETCH_AHEAD; i++)
+		lz4_dec_prefetch_state(s[i]);
+	for (size_t i = 0; i < n && i < BATCH_PREFETCH_AHEAD; i++)
+		lz4_dec_prefetch_data(s[i]);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i + 2 * BATCH_PREFETCH_AHEAD < n)
+			lz4_dec_prefetch_state(s[i + 2 * BATCH_PREFETCH_AHEAD]);
+		if (i + BATCH_PREFETCH_AHEAD < n)
+			lz4_dec_prefetch_data(s[i + BATCH_PREFETCH_AHEAD]);
+
+		int r = lz4_dec_stream_run(s[i]);
+		if (results)
+			results[i] = r;
+		if (r)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/*
+	The dst_nt engine decodes into o_buf alone, then moves the result out
+	in bulk with streaming stores, so that out is only ever written (never
+	read) and written in whole 64-byte lines wherever possible.
+
+	The pull API shares it, minus the moving out: lz4_dec_stream_peek lets
+	it decode into o_buf only as far as there's room without overwriting
+	anything not yet consumed, and then hands out o_buf itself.
+*/
+
+#if HAVE_X86_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define HAVE_STREAM_STORES	1
+#else
+	#define HAVE_STREAM_STORES	0
+#endif
+
+//the most a single literal or match copy may add to o_buf, and how much decoded
+//output we collect before flushing it (a quarter of a small window apiece)
+#if O_BUF_LEN >= 0x10000
+	#define NT_STEP			0x4000
+	#define NT_FLUSH_LEN	0x4000
+#else
+	#define NT_STEP			(O_BUF_LEN / 4)
+	#define NT_FLUSH_LEN	(O_BUF_LEN / 4)
+#endif
+
+_Static_assert(NT_STEP + NT_FLUSH_LEN < O_BUF_LEN, "unflushed output mustn't be overwritten");
+
+static void lz4_dec_nt_copy(uint8_t* restrict dst, const uint8_t* restrict src, size_t len)
+{
+#if HAVE_STREAM_STORES
+	if (len >= 128)
+	{
+		//ordinary stores up to a line boundary, then whole lines
+		size_t head = (size_t)(-(uintptr_t)dst & 63);
+		memcpy(dst, src, head);
+		dst += head;
+		src += head;
+		len -= head;
+
+		for (; len >= 64; len -= 64, dst += 64, src += 64)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)src + 0);
+			__m128i b = _mm_loadu_si128((const __m128i *)src + 1);
+			__m128i c = _mm_loadu_si128((const __m128i *)src + 2);
+			__m128i d = _mm_loadu_si128((const __m128i *)src + 3);
+
+			_mm_stream_si128((__m128i *)dst + 0, a);
+			_mm_stream_si128((__m128i *)dst + 1, b);
+			_mm_stream_si128((__m128i *)dst + 2, c);
+			_mm_stream_si128((__m128i *)dst + 3, d);
+		}
+	}
+#endif
+
+	memcpy(dst, src, len);
+}
+
+//moves the decoded bytes in o_buf[*o_flush, o_pos) to out: all of them if final,
+//otherwise nothing until there are NT_FLUSH_LEN of them, and then only up to a
+//line boundary in out, returns the new out
+static uint8_t *lz4_dec_nt_flush(
+	const uint8_t* restrict o_buf, unsigned int *o_flush, unsigned int o_pos,
+	uint8_t* restrict out, int final)
+{
+	unsigned int n = WRAP_OBUF_IDX(o_pos - *o_flush);
+
+	if (!final)
+	{
+		if (n < NT_FLUSH_LEN)
+			return out;
+		n -= (unsigned int)((uintptr_t)(out + n) & 63);
+	}
+
+	unsigned int first = O_BUF_LEN - *o_flush;
+	if (first > n)
+		first = n;
+
+	lz4_dec_nt_copy(out, o_buf + *o_flush, first);
+	lz4_dec_nt_copy(out + first, o_buf, n - first);
+
+	*o_flush = WRAP_OBUF_IDX(*o_flush + n);
+	return out + n;
+}
+
+//copies a len-byte match within o_buf (len <= NT_STEP)
+static void lz4_dec_cpy_mat_obuf(
+	unsigned int len, unsigned int mat_dst, unsigned int o_pos,
+	uint8_t *o_buf, unsigned int simd)
+{
+	unsigned int o_inpos = WRAP_OBUF_IDX(o_pos - mat_dst);
+
+	if (mat_dst < 16 && mat_dst < len)
+	{
+		uint8_t pat[16] = {0};
+		for (unsigned int i = 0; i < mat_dst; i++)
+			pat[i] = o_buf[WRAP_OBUF_IDX(o_inpos + i)];
+
+		lz4_dec_rep_obuf(len, mat_dst, pat, o_pos, o_buf, simd);
+		return;
+	}
+
+	while (len)
+	{
+		//pieces no longer than mat_dst don't overlap themselves, but
+		//memmove anyway since mat_dst near O_BUF_LEN overlaps from behind
+		unsigned int n = len < mat_dst ? len : mat_dst;
+		if (n > O_BUF_LEN - o_inpos)
+			n = O_BUF_LEN - o_inpos;
+		if (n > O_BUF_LEN - o_pos)
+			n = O_BUF_LEN - o_pos;
+
+		memmove(o_buf + o_pos, o_buf + o_inpos, n);
+
+		o_inpos = WRAP_OBUF_IDX(o_inpos + n);
+		o_pos = WRAP_OBUF_IDX(o_pos + n);
+		len -= n;
+	}
+}
+
+//with nt set, decoded output is flushed to out as usual, otherwise it's left
+//in o_buf and avail_out merely limits how much gets decoded
+//hash: feed the output to the xxHash32 as it piles up in o_buf
+static STREAM_RUN_INLINE int lz4_dec_stream_run_obuf_impl(lz4_dec_stream_state* s, int nt, int hash)
+{
+	STREAM_RUN_PROLOG();
+
+	unsigned int const simd = s->p_.simd;
+	unsigned int o_flush = o_pos; //o_buf[o_flush, o_pos) is decoded, but not yet in out
+	unsigned int h_pos = o_pos; //o_buf[h_pos, o_pos) is decoded, but not yet hashed
+
+	STREAM_RESUME_FROM_SUSPEND();
+
+phase_READ_TOK: //read a token
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		lit_len = c >> 4;
+		mat_len = (c & 0xF) + 4;
+	}
+
+	if (lit_len != 0xF)
+		STAT_LIT(lit_len);
+
+	switch (lit_len)
+	{
+	case 0: TRANSITION_TO_PHASE(READ_OFS); //we just read a match
+	case 0xF: TRANSITION_TO_PHASE(READ_EX_LIT_LEN); //we have a long literal, read more length bytes
+	default: TRANSITION_TO_PHASE(COPY_LIT); //copy lit_len bytes to the output
+	}
+
+phase_READ_EX_LIT_LEN: //loop; read an additional byte of literal length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - lit_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		lit_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_LIT_LEN; //loop
+	}
+
+	STAT_LIT(lit_len);
+	TRANSITION_TO_PHASE(COPY_LIT);
+
+phase_COPY_LIT: //copy lit_len bytes from the input to o_buf
+	assert(lit_len > 0);
+	{
+		unsigned int clamped_lit_len = lit_len < NT_STEP ? lit_len : NT_STEP;
+
+		size_t avail_in = in_end - in;
+		if (clamped_lit_len > avail_in)
+			clamped_lit_len = (unsigned int)avail_in;
+		if (clamped_lit_len > avail_out)
+			clamped_lit_len = (unsigned int)avail_out;
+
+		o_pos = lz4_dec_push_history(o_buf, o_pos, in, clamped_lit_len);
+		STAT_ADD(s, hist_bytes, clamped_lit_len);
+		in += clamped_lit_len;
+
+		avail_out -= clamped_lit_len;
+		lit_len -= clamped_lit_len;
+
+		if (nt)
+			out = lz4_dec_nt_flush(o_buf, &o_flush, o_pos, out, 0);
+		HASH_OBUF_CATCH_UP();
+	}
+
+	if (lit_len)
+	{
+		if (in == in_end || !avail_out)
+			//there's more literal to copy, but either src or dst bufs ran out
+			SUSPEND_FOR_NOW();
+
+		goto phase_COPY_LIT; //loop
+	}
+
+	TRANSITION_TO_PHASE(READ_OFS);
+
+phase_READ_OFS: //read the first byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst = *in++;
+
+	TRANSITION_TO_PHASE(READ_OFS2);
+
+phase_READ_OFS2: //read the second byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst |= (unsigned int)*in++ << 8;
+
+	if (BAD_MAT_DST(mat_dst))
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	if (mat_len == 0xF + 4)
+		TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - mat_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		mat_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_MAT_LEN; //loop
+	}
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_COPY_MAT: //copy mat_len bytes from mat_dst bytes behind o_pos
+	assert(mat_len > 0);
+	if (UNLIKELY(s->p_.dict != 0))
+	{
+		//early on, a match may start out in the dictionary
+		const uint8_t *dict_src = 0;
+		unsigned int clamped_mat_len = mat_len < NT_STEP ? mat_len : NT_STEP;
+		if (clamped_mat_len > avail_out)
+			clamped_mat_len = (unsigned int)avail_out;
+
+		int n = lz4_dec_dict_part(s, s->avail_out - avail_out, mat_dst, clamped_mat_len, &dict_src);
+		if (n < 0)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+		if (n)
+		{
+			STAT_ADD(s, cpy_mat_dict, 1);
+			STAT_ADD(s, hist_bytes, n);
+			o_pos = lz4_dec_push_history(o_buf, o_pos, dict_src, n);
+		}
+
+		avail_out -= n;
+		mat_len -= n;
+
+		if (nt)
+			out = lz4_dec_nt_flush(o_buf, &o_flush, o_pos, out, 0);
+		HASH_OBUF_CATCH_UP();
+
+		if (!mat_len)
+			TRANSITION_TO_PHASE(READ_TOK);
+		if (!avail_out)
+			SUSPEND_FOR_NOW();
+		if ((unsigned int)n == clamped_mat_len)
+			goto phase_COPY_MAT; //the clamp may have cut it short, the rest may still be in the dictionary
+	}
+	{
+		unsigned int clamped_mat_len = mat_len < NT_STEP ? mat_len : NT_STEP;
+		if (clamped_mat_len > avail_out)
+			clamped_mat_len = (unsigned int)avail_out;
+
+		lz4_dec_cpy_mat_obuf(clamped_mat_len, mat_dst, o_pos, o_buf, simd);
+		o_pos = WRAP_OBUF_IDX(o_pos + clamped_mat_len);
+		STAT_ADD(s, cpy_mat_obuf, 1);
+		STAT_ADD(s, hist_bytes, clamped_mat_len);
+
+		avail_out -= clamped_mat_len;
+		mat_len -= clamped_mat_len;
+
+		if (nt)
+			out = lz4_dec_nt_flush(o_buf, &o_flush, o_pos, out, 0);
+		HASH_OBUF_CATCH_UP();
+	}
+
+	if (mat_len)
+	{
+		if (!avail_out)
+			//we ran out of avail_out before we finished
+			SUSPEND_FOR_NOW();
+
+		goto phase_COPY_MAT; //loop
+	}
+
+	TRANSITION_TO_PHASE(READ_TOK);
+
+suspend_for_now:
+	//tuck everything away for the next call
+	if (lz4_dec_check_block_end(s, (size_t)(in - s->in), s->avail_out - avail_out, &phase) < 0)
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	if (hash)
+		lz4_dec_hash_obuf(s, o_buf, h_pos, o_pos);
+
+	if (nt)
+	{
+		out = lz4_dec_nt_flush(o_buf, &o_flush, o_pos, out, 1);
+#if HAVE_STREAM_STORES
+		//make the streaming stores visible before handing out back to the caller
+		_mm_sfence();
+#endif
+	}
+
+	STREAM_RUN_SUSPEND_EPILOG();
+	return 0;
+
+phase_REPORT_ERROR:
+	s->p_.phase = PHASE_REPORT_ERROR;
+	return -1;
+}
+
+int lz4_dec_stream_run_dst_nt(lz4_dec_stream_state* s)
+{
+	assert(!(s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT) && "only lz4_dec_stream_run can retain output");
+
+	if (s->p_.flags & LZ4_DEC_STREAM_XXH32)
+		return lz4_dec_stream_run_obuf_impl(s, 1, 1);
+
+	return lz4_dec_stream_run_obuf_impl(s, 1, 0);
+}
+
+int lz4_dec_stream_peek(lz4_dec_stream_state *s, lz4_dec_stream_span span[2])
+{
+	assert(!(s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT) && "only lz4_dec_stream_run can retain output");
+
+	uint8_t *out = s->out;
+	size_t avail_out = s->avail_out;
+
+	//decode as much as fits without overwriting unconsumed output
+	unsigned int room = O_BUF_LEN - s->p_.o_pending;
+	s->out = 0;
+	s->avail_out = room;
+
+	int ret = (s->p_.flags & LZ4_DEC_STREAM_XXH32) ?
+		lz4_dec_stream_run_obuf_impl(s, 0, 1) :
+		lz4_dec_stream_run_obuf_impl(s, 0, 0);
+
+	if (!ret)
+		s->p_.o_pending += room - (unsigned int)s->avail_out;
+
+	s->out = out;
+	s->avail_out = avail_out;
+
+	const uint8_t *o_buf = s->p_.o_buf + O_BUF_PAD;
+	unsigned int pending = ret ? 0 : s->p_.o_pending;
+	unsigned int start = WRAP_OBUF_IDX(s->p_.o_pos - pending);
+
+	unsigned int first = O_BUF_LEN - start;
+	if (first > pending)
+		first = pending;
+
+	span[0].data = o_buf + start;
+	span[0].len = first;
+	span[1].data = o_buf;
+	span[1].len = pending - first;
+
+	return ret;
+}
+
+void lz4_dec_stream_consume(lz4_dec_stream_state *s, size_t len)
+{
+	assert(len <= s->p_.o_pending && "consuming more than lz4_dec_stream_peek handed out");
+
+	if (len > s->p_.o_pending)
+		len = s->p_.o_pending;
+
+	s->p_.o_pending -= (unsigned int)len;
+}
+
+/*
+	Scanning.
+
+	The same phase machine once more, minus the output: literals are
+	stepped over rather than copied, and matches are just counted, so
+	nothing is written anywhere and o_buf is left alone. It's resumable
+	the same way, since the phases that read input are exactly the ones
+	the run functions suspend in. With seq, it stops after each sequence
+	(or after as much of one as the input holds) and reports it; without,
+	it runs through all the input it has, only adding up out_len.
+*/
+
+static STREAM_RUN_INLINE int lz4_dec_stream_scan_impl(lz4_dec_stream_state *s, lz4_dec_stream_seq *seq, size_t *out_len)
+{
+	STREAM_RUN_PROLOG();
+	(void)out;
+	(void)o_buf;
+
+	size_t n_out = 0; //what everything scanned in this call decodes to
+
+	if (seq)
+	{
+		seq->lit = in;
+		seq->lit_len = 0;
+		seq->mat_len = 0;
+		seq->mat_dst = 0;
+	}
+
+	STREAM_RESUME_FROM_SUSPEND();
+
+phase_READ_TOK: //read a token
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		lit_len = c >> 4;
+		mat_len = (c & 0xF) + 4;
+	}
+
+	if (lit_len != 0xF)
+		STAT_LIT(lit_len);
+
+	switch (lit_len)
+	{
+	case 0: TRANSITION_TO_PHASE(READ_OFS); //we just read a match
+	case 0xF: TRANSITION_TO_PHASE(READ_EX_LIT_LEN); //we have a long literal, read more length bytes
+	default: TRANSITION_TO_PHASE(COPY_LIT); //step over lit_len bytes of input
+	}
+
+phase_READ_EX_LIT_LEN: //loop; read an additional byte of literal length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - lit_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		lit_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_LIT_LEN; //loop
+	}
+
+	STAT_LIT(lit_len);
+	TRANSITION_TO_PHASE(COPY_LIT);
+
+phase_COPY_LIT: //step over lit_len bytes of input, no copying needed
+	assert(lit_len > 0);
+	{
+		unsigned int clamped_lit_len = lit_len;
+
+		size_t avail_in = in_end - in;
+		if (clamped_lit_len > avail_in)
+			clamped_lit_len = (unsigned int)avail_in;
+
+		if (seq)
+		{
+			//nb: the literal's the first thing in a sequence, so this is the only piece of it this call
+			seq->lit = in;
+			seq->lit_len = clamped_lit_len;
+		}
+
+		in += clamped_lit_len;
+		n_out += clamped_lit_len;
+		lit_len -= clamped_lit_len;
+	}
+
+	if (lit_len)
+		//there's more literal, but the input ran out
+		SUSPEND_FOR_NOW();
+
+	TRANSITION_TO_PHASE(READ_OFS);
+
+phase_READ_OFS: //read the first byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst = *in++;
+
+	TRANSITION_TO_PHASE(READ_OFS2);
+
+phase_READ_OFS2: //read the second byte of a match offset
+	SUSPEND_IF_INPUT_EMPTY();
+	mat_dst |= (unsigned int)*in++ << 8;
+
+	if (BAD_MAT_DST(mat_dst))
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	if (mat_len == 0xF + 4)
+		TRANSITION_TO_PHASE(READ_EX_MAT_LEN);
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_READ_EX_MAT_LEN: //loop; read an additional byte of match length
+	{
+		SUSPEND_IF_INPUT_EMPTY();
+		uint8_t c = *in++;
+
+		if (c > MAX_BLOCK_LEN - mat_len)
+			TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		mat_len += c;
+
+		if (c == 0xFF)
+			goto phase_READ_EX_MAT_LEN; //loop
+	}
+
+	STAT_MAT(mat_dst, mat_len);
+	TRANSITION_TO_PHASE(COPY_MAT);
+
+phase_COPY_MAT: //count the match, which finishes the sequence
+	assert(mat_len > 0);
+	n_out += mat_len;
+
+	if (seq)
+	{
+		seq->mat_len = mat_len;
+		seq->mat_dst = mat_dst;
+
+		phase = PHASE_READ_TOK;
+		SUSPEND_FOR_NOW();
+	}
+
+	TRANSITION_TO_PHASE(READ_TOK);
+
+suspend_for_now:
+	//tuck everything away for the next call
+	if (lz4_dec_check_block_end(s, (size_t)(in - s->in), n_out, &phase) < 0)
+		TRANSITION_TO_PHASE(REPORT_ERROR);
+
+	STREAM_RUN_SUSPEND_EPILOG();
+
+	if (out_len)
+		*out_len += n_out;
+
+	return seq && n_out;
+
+phase_REPORT_ERROR:
+	s->p_.phase = PHASE_REPORT_ERROR;
+	return -1;
+}
+
+int lz4_dec_stream_next_seq(lz4_dec_stream_state *s, lz4_dec_stream_seq *seq)
+{
+	assert(!(s->p_.flags & (LZ4_DEC_STREAM_XXH32 | LZ4_DEC_STREAM_RETAIN_OUTPUT)) && "scanning produces no output");
+
+	return lz4_dec_stream_scan_impl(s, seq, 0);
+}
+
+int lz4_dec_stream_scan(lz4_dec_stream_state *s, size_t *out_len)
+{
+	assert(!(s->p_.flags & (LZ4_DEC_STREAM_XXH32 | LZ4_DEC_STREAM_RETAIN_OUTPUT)) && "scanning produces no output");
+
+	return lz4_dec_stream_scan_impl(s, 0, out_len);
+}
+
+/*
+	Frame decoding.
+
+	The frame decoder is a second, much simpler, state machine wrapped
+	around the block decoder. It collects the small fixed-size fields
+	(magic numbers, the frame descriptor, block sizes, checksums) in
+	hdr, and hands the blocks themselves off to a lz4_dec_stream_state.
+*/
+
+_Static_assert(sizeof(((lz4_frame_dec_state *)0)->p_.hdr) >= 8 + 1, "hdr must fit the descriptor's optional fields");
+
+#define FRAME_TRANSITION_TO_PHASE(next_phase, hdr_bytes) \
+	MACRO_IF_BLOCK_(1, { \
+		phase = FRAME_PHASE_##next_phase; \
+		s->p_.hdr_len = 0; \
+		s->p_.hdr_need = (hdr_bytes); \
+		goto frame_phase_##next_phase; \
+	})
+#define FRAME_GATHER_OR_SUSPEND() \
+	MACRO_IF_BLOCK_(!lz4_frame_dec_gather(s, &in, in_end), SUSPEND_FOR_NOW();)
+
+static uint32_t lz4_read_le32(const uint8_t *p)
+{
+	return
+		(uint32_t)p[0] |
+		(uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+}
+
+//collect input into hdr until it holds hdr_need bytes, returns nonzero once it does
+static int lz4_frame_dec_gather(lz4_frame_dec_state *s, const uint8_t **in, const uint8_t *in_end)
+{
+	size_t n = s->p_.hdr_need - s->p_.hdr_len;
+	if (n > (size_t)(in_end - *in))
+		n = (size_t)(in_end - *in);
+
+	memcpy(s->p_.hdr + s->p_.hdr_len, *in, n);
+	*in += n;
+	s->p_.hdr_len += (unsigned int)n;
+
+	return s->p_.hdr_len == s->p_.hdr_need;
+}
+
+void lz4_frame_dec_init(lz4_frame_dec_state *s)
+{
+	lz4_frame_dec_init_ex(s, 0);
+}
+
+void lz4_frame_dec_init_ex(lz4_frame_dec_state *s, unsigned int flags)
+{
+	s->in = 0;
+	s->avail_in = 0;
+
+	s->out = 0;
+	s->avail_out = 0;
+
+	lz4_dec_stream_init(&s->p_.blk);
+
+	s->p_.len = 0;
+	s->p_.max_blk_len = 0;
+
+	s->p_.hdr_len = 0;
+	s->p_.hdr_need = 4;
+
+	s->p_.flg = 0;
+	s->p_.phase = FRAME_PHASE_MAGIC;
+
+	s->p_.flags = flags;
+	lz4_xxh32_init(&s->p_.blk_xxh, 0);
+}
+
+int lz4_frame_dec_done(const lz4_frame_dec_state *s)
+{
+	return s->p_.phase == FRAME_PHASE_MAGIC && s->p_.hdr_len == 0;
+}
+
+const lz4_dec_stream_stats *lz4_frame_dec_get_stats(const lz4_frame_dec_state *s)
+{
+	return lz4_dec_stream_get_stats(&s->p_.blk);
+}
+
+static int lz4_frame_dec_run_with(lz4_frame_dec_state *s, int (*blk_run)(lz4_dec_stream_state *))
+{
+	const uint8_t *in = s->in;
+	const uint8_t *const in_end = s->in + s->avail_in;
+
+	uint8_t *out = s->out;
+	size_t avail_out = s->avail_out;
+
+	unsigned int phase = s->p_.phase;
+
+	switch (phase)
+	{
+	case FRAME_PHASE_MAGIC:			goto frame_phase_MAGIC;
+	case FRAME_PHASE_SKIP_LEN:		goto frame_phase_SKIP_LEN;
+	case FRAME_PHASE_SKIP:			goto frame_phase_SKIP;
+	case FRAME_PHASE_DESC:			goto frame_phase_DESC;
+	case FRAME_PHASE_DESC_EXTRA:	goto frame_phase_DESC_EXTRA;
+	case FRAME_PHASE_BLK_LEN:		goto frame_phase_BLK_LEN;
+	case FRAME_PHASE_BLK_DATA:		goto frame_phase_BLK_DATA;
+	case FRAME_PHASE_BLK_RAW:		goto frame_phase_BLK_RAW;
+	case FRAME_PHASE_BLK_CHECKSUM:	goto frame_phase_BLK_CHECKSUM;
+	case FRAME_PHASE_CHECKSUM:		goto frame_phase_CHECKSUM;
+	case FRAME_PHASE_REPORT_ERROR:	goto frame_phase_REPORT_ERROR;
+	default:
+		assert(0 && "corrupt frame decoder state");
+		STREAM_RUN_UNREACHABLE();
+	}
+
+frame_phase_MAGIC: //read the magic number, which tells us what sort of frame we're in
+	FRAME_GATHER_OR_SUSPEND();
+	{
+		uint32_t magic = lz4_read_le32(s->p_.hdr);
+
+		if (magic == FRAME_MAGIC)
+			FRAME_TRANSITION_TO_PHASE(DESC, 2);
+		if ((magic & FRAME_SKIPPABLE_MAGIC_MASK) == FRAME_SKIPPABLE_MAGIC)
+			FRAME_TRANSITION_TO_PHASE(SKIP_LEN, 4);
+	}
+
+	FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+frame_phase_SKIP_LEN: //read the length of a skippable frame
+	FRAME_GATHER_OR_SUSPEND();
+	s->p_.len = lz4_read_le32(s->p_.hdr);
+
+	FRAME_TRANSITION_TO_PHASE(SKIP, 0);
+
+frame_phase_SKIP: //loop; discard the skippable frame's contents
+	{
+		size_t n = (size_t)(in_end - in);
+		if (n > s->p_.len)
+			n = s->p_.len;
+
+		in += n;
+		s->p_.len -= (uint32_t)n;
+	}
+
+	if (s->p_.len)
+		SUSPEND_FOR_NOW();
+
+	FRAME_TRANSITION_TO_PHASE(MAGIC, 4);
+
+frame_phase_DESC: //read the FLG and BD bytes
+	FRAME_GATHER_OR_SUSPEND();
+	{
+		unsigned int flg = s->p_.hdr[0];
+		unsigned int bd = s->p_.hdr[1];
+
+		if ((flg & (FRAME_FLG_VERSION_MASK | FRAME_FLG_RESERVED)) != FRAME_FLG_VERSION ||
+			(bd & FRAME_BD_RESERVED) || FRAME_BD_MAX_SIZE(bd) < 4)
+			FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+		if (flg & FRAME_FLG_DICT_ID)
+			//we've no way to get at the dictionary
+			FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+		s->p_.flg = flg;
+		s->p_.max_blk_len = (uint32_t)1 << (FRAME_BD_MAX_SIZE(bd) * 2 + 8);
+
+		//the header checksum covers the whole descriptor, starting here
+		lz4_xxh32_init(&s->p_.blk_xxh, 0);
+		lz4_xxh32_update(&s->p_.blk_xxh, s->p_.hdr, 2);
+
+		//the content size (which we don't need) and the header checksum
+		FRAME_TRANSITION_TO_PHASE(DESC_EXTRA, (flg & FRAME_FLG_CONTENT_SIZE ? 8 : 0) + 1);
+	}
+
+frame_phase_DESC_EXTRA: //read the rest of the frame descriptor
+	FRAME_GATHER_OR_SUSPEND();
+	if (s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS)
+	{
+		lz4_xxh32_update(&s->p_.blk_xxh, s->p_.hdr, s->p_.hdr_len - 1);
+		if (((lz4_xxh32_digest(&s->p_.blk_xxh) >> 8) & 0xFF) != s->p_.hdr[s->p_.hdr_len - 1])
+			FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+	}
+
+	lz4_dec_stream_reset(&s->p_.blk,
+		(s->p_.flg & FRAME_FLG_BLOCK_INDEP ? LZ4_DEC_STREAM_INDEPENDENT_BLOCKS : 0) |
+		((s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS) && (s->p_.flg & FRAME_FLG_CONTENT_CHECKSUM) ?
+			LZ4_DEC_STREAM_XXH32 : 0));
+
+	FRAME_TRANSITION_TO_PHASE(BLK_LEN, 4);
+
+frame_phase_BLK_LEN: //read a block's size, or the end mark
+	FRAME_GATHER_OR_SUSPEND();
+	{
+		uint32_t blk_len = lz4_read_le32(s->p_.hdr);
+
+		if (!blk_len)
+		{
+			if (s->p_.flg & FRAME_FLG_CONTENT_CHECKSUM)
+				FRAME_TRANSITION_TO_PHASE(CHECKSUM, 4);
+			else
+				FRAME_TRANSITION_TO_PHASE(MAGIC, 4);
+		}
+
+		s->p_.len = blk_len & ~FRAME_BLK_UNCOMPRESSED;
+		if (s->p_.len > s->p_.max_blk_len)
+			FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+		lz4_xxh32_init(&s->p_.blk_xxh, 0);
+
+		if (blk_len & FRAME_BLK_UNCOMPRESSED)
+			FRAME_TRANSITION_TO_PHASE(BLK_RAW, 0);
+
+		lz4_dec_stream_begin_block(&s->p_.blk, s->p_.len);
+		FRAME_TRANSITION_TO_PHASE(BLK_DATA, 0);
+	}
+
+frame_phase_BLK_DATA: //run the block decoder over the rest of the block
+	{
+		lz4_dec_stream_state *blk = &s->p_.blk;
+
+		//nb: the block decoder won't read past the end of the block
+		blk->in = in;
+		blk->avail_in = (size_t)(in_end - in);
+		blk->out = out;
+		blk->avail_out = avail_out;
+
+		if (blk_run(blk))
+			FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+		s->p_.len -= (uint32_t)(blk->in - in);
+
+		if ((s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS) && (s->p_.flg & FRAME_FLG_BLOCK_CHECKSUM))
+			lz4_xxh32_update(&s->p_.blk_xxh, in, (size_t)(blk->in - in));
+
+		in = blk->in;
+		out = blk->out;
+		avail_out = blk->avail_out;
+	}
+
+	if (s->p_.len)
+		//either the input or the output buffer ran out
+		SUSPEND_FOR_NOW();
+
+	//nb: the block decoder checked that the block ended cleanly
+	goto frame_blk_done;
+
+frame_phase_BLK_RAW: //loop; copy an uncompressed block to the output
+	{
+		size_t n = (size_t)(in_end - in);
+		if (n > s->p_.len)
+			n = s->p_.len;
+		if (n > avail_out)
+			n = avail_out;
+
+		memcpy(out, in, n);
+
+		if (s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS)
+		{
+			//nb: hashed from in rather than out, which is just as good and stays out of out
+			if (s->p_.flg & FRAME_FLG_BLOCK_CHECKSUM)
+				lz4_xxh32_update(&s->p_.blk_xxh, in, n);
+			if (s->p_.flg & FRAME_FLG_CONTENT_CHECKSUM)
+				lz4_xxh32_update(&s->p_.blk.p_.xxh, in, n);
+		}
+
+		if (!(s->p_.flg & FRAME_FLG_BLOCK_INDEP))
+			//later blocks may refer back into this one
+		{
+			s->p_.blk.p_.o_pos = lz4_dec_push_history(
+				s->p_.blk.p_.o_buf + O_BUF_PAD, s->p_.blk.p_.o_pos, in, n);
+			STAT_ADD(&s->p_.blk, hist_bytes, n);
+		}
+
+		in += n;
+		out += n;
+		avail_out -= n;
+
+		s->p_.len -= (uint32_t)n;
+	}
+
+	if (s->p_.len)
+		SUSPEND_FOR_NOW();
+
+frame_blk_done:
+	if (s->p_.flg & FRAME_FLG_BLOCK_CHECKSUM)
+		FRAME_TRANSITION_TO_PHASE(BLK_CHECKSUM, 4);
+	else
+		FRAME_TRANSITION_TO_PHASE(BLK_LEN, 4);
+
+frame_phase_BLK_CHECKSUM: //read a block checksum
+	FRAME_GATHER_OR_SUSPEND();
+	if ((s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS) &&
+		lz4_read_le32(s->p_.hdr) != lz4_xxh32_digest(&s->p_.blk_xxh))
+		FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+	FRAME_TRANSITION_TO_PHASE(BLK_LEN, 4);
+
+frame_phase_CHECKSUM: //read the content checksum
+	FRAME_GATHER_OR_SUSPEND();
+	if ((s->p_.flags & LZ4_FRAME_DEC_VERIFY_CHECKSUMS) &&
+		lz4_read_le32(s->p_.hdr) != lz4_dec_stream_xxh32(&s->p_.blk))
+		FRAME_TRANSITION_TO_PHASE(REPORT_ERROR, 0);
+
+	FRAME_TRANSITION_TO_PHASE(MAGIC, 4);
+
+suspend_for_now:
+	s->in = in;
+	s->avail_in = (size_t)(in_end - in);
+
+	s->out = out;
+	s->avail_out = avail_out;
+
+	s->p_.phase = phase;
+	return 0;
+
+frame_phase_REPORT_ERROR:
+	s->p_.phase = FRAME_PHASE_REPORT_ERROR;
+	return -1;
+}
+
+int lz4_frame_dec_run(lz4_frame_dec_state *s)
+{
+	return lz4_frame_dec_run_with(s, lz4_dec_stream_run);
+}
+
+int lz4_frame_dec_run_dst_uncached(lz4_frame_dec_state *s)
+{
+	return lz4_frame_dec_run_with(s, lz4_dec_stream_run_dst_uncached);
+}
@@ -0,0 +1,606 @@
+#include "lz4_stream.h"
+#include "lz4_stream_private.h"
+
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#define ENC_PHASE_SCAN				0
+#define ENC_PHASE_TOKEN				1
+#define ENC_PHASE_EX_LIT_LEN		2
+#define ENC_PHASE_COPY_LIT			3
+#define ENC_PHASE_OFS				4
+#define ENC_PHASE_OFS2				5
+#define ENC_PHASE_EX_MAT_LEN		6
+#define ENC_PHASE_DONE				7
+
+#define ENC_PHASE_REPORT_ERROR		8
+
+#define ENC_BUF_LEN					0x20000
+#define ENC_HASH_LOG				12
+
+#define ENC_MIN_MATCH				4
+#if LZ4_STREAM_WINDOW_LEN > 0xFFFF
+	#define ENC_MAX_OFS				0xFFFF
+#else
+	#define ENC_MAX_OFS				LZ4_STREAM_WINDOW_LEN //don't emit what our own decoder would reject
+#endif
+#define ENC_LAST_LITERALS			5	//the block must end with at least this many literals
+#define ENC_MFLIMIT					12	//and no match may start closer than this to the end
+
+_Static_assert(sizeof(((lz4_enc_stream_state *)0)->p_.buf) == ENC_BUF_LEN, "fix ENC_BUF_LEN");
+_Static_assert(sizeof(((lz4_enc_stream_state *)0)->p_.hash) == sizeof(uint32_t) << ENC_HASH_LOG, "fix ENC_HASH_LOG");
+_Static_assert(ENC_BUF_LEN > ENC_MAX_OFS + ENC_MFLIMIT, "the window must hold a full match distance");
+
+#define FRAME_ENC_BLK_LEN			0x10000 //and the BD byte below says so
+#define FRAME_ENC_HEADER_LEN		7
+
+#define FRAME_ENC_PHASE_HEADER		0
+#define FRAME_ENC_PHASE_GATHER		1
+#define FRAME_ENC_PHASE_BLK_LEN		2
+#define FRAME_ENC_PHASE_BLK_DATA	3
+#define FRAME_ENC_PHASE_END_MARK	4
+#define FRAME_ENC_PHASE_DONE		5
+
+#define FRAME_ENC_PHASE_REPORT_ERROR	6
+
+_Static_assert(sizeof(((lz4_frame_enc_state *)0)->p_.raw) == FRAME_ENC_BLK_LEN, "fix FRAME_ENC_BLK_LEN");
+_Static_assert(sizeof(((lz4_frame_enc_state *)0)->p_.packed) == FRAME_ENC_BLK_LEN, "fix FRAME_ENC_BLK_LEN");
+_Static_assert(ENC_BUF_LEN >= ENC_MAX_OFS + FRAME_ENC_BLK_LEN, "a block's literals must fit behind a full match distance");
+
+#define ENC_TRANSITION_TO_PHASE(next_phase) \
+	do { phase = ENC_PHASE_##next_phase; goto enc_phase_##next_phase; } while (0)
+#define ENC_SUSPEND_IF_OUTPUT_FULL() \
+	do { if (!avail_out) goto suspend_for_now; } while (0)
+
+static uint32_t lz4_enc_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t lz4_enc_read64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz4_enc_hash(uint32_t seq)
+{
+	//nb: byte order changes the hash, but not which bytes it covers
+	return (seq * 2654435761u) >> (32 - ENC_HASH_LOG);
+}
+
+//discard whatever's no longer needed from the front of buf,
+//returns the number of bytes discarded
+static uint32_t lz4_enc_slide(lz4_enc_stream_state *s)
+{
+	//keep the pending literals and a full match distance of history
+	uint32_t keep = s->p_.pos > ENC_MAX_OFS ? s->p_.pos - ENC_MAX_OFS : 0;
+	if (keep > s->p_.anchor)
+		keep = s->p_.anchor;
+
+	if (keep)
+	{
+		memmove(s->p_.buf, s->p_.buf + keep, s->p_.end - keep);
+
+		s->p_.base += keep;
+		s->p_.anchor -= keep;
+		s->p_.pos -= keep;
+		s->p_.end -= keep;
+	}
+
+	return keep;
+}
+
+//pull as much input as fits into buf
+static void lz4_enc_fill(lz4_enc_stream_state *s)
+{
+	if (s->p_.end == ENC_BUF_LEN && s->avail_in)
+		lz4_enc_slide(s);
+
+	size_t n = ENC_BUF_LEN - s->p_.end;
+	if (n > s->avail_in)
+		n = s->avail_in;
+	if (!n)
+		return;
+
+	memcpy(s->p_.buf + s->p_.end, s->in, n);
+	s->p_.end += (uint32_t)n;
+
+	s->in += n;
+	s->avail_in -= n;
+}
+
+void lz4_enc_stream_init(lz4_enc_stream_state *s)
+{
+	s->in = 0;
+	s->avail_in = 0;
+
+	s->out = 0;
+	s->avail_out = 0;
+
+	//zero is as good a position as any, candidates are
+	//always checked against the data before they're used
+	memset(s->p_.hash, 0, sizeof(s->p_.hash));
+
+	s->p_.base = 0;
+	s->p_.anchor = 0;
+	s->p_.pos = 0;
+	s->p_.end = 0;
+
+	s->p_.mat_len = 0;
+	s->p_.mat_ofs = 0;
+	s->p_.ex_len = 0;
+
+	s->p_.phase = ENC_PHASE_SCAN;
+}
+
+static int lz4_enc_stream_run_with(lz4_enc_stream_state *s, int finish)
+{
+	uint8_t *restrict const buf = s->p_.buf;
+	uint32_t *restrict const hash = s->p_.hash;
+
+	uint8_t *restrict out = s->out;
+	size_t avail_out = s->avail_out;
+
+	unsigned int phase = s->p_.phase;
+
+	switch (phase)
+	{
+	case ENC_PHASE_SCAN:			goto enc_phase_SCAN;
+	case ENC_PHASE_TOKEN:			goto enc_phase_TOKEN;
+	case ENC_PHASE_EX_LIT_LEN:		goto enc_phase_EX_LIT_LEN;
+	case ENC_PHASE_COPY_LIT:		goto enc_phase_COPY_LIT;
+	case ENC_PHASE_OFS:				goto enc_phase_OFS;
+	case ENC_PHASE_OFS2:			goto enc_phase_OFS2;
+	case ENC_PHASE_EX_MAT_LEN:		goto enc_phase_EX_MAT_LEN;
+	case ENC_PHASE_DONE:			goto enc_phase_DONE;
+	case ENC_PHASE_REPORT_ERROR:	goto enc_phase_REPORT_ERROR;
+	default:
+		assert(0 && "corrupt encoder stream state");
+		goto enc_phase_REPORT_ERROR;
+	}
+
+enc_phase_SCAN:
+	for (;;)
+	{
+		lz4_enc_fill(s);
+
+		int at_end = finish && !s->avail_in;
+		int full = s->p_.end == ENC_BUF_LEN;
+
+		uint32_t anchor = s->p_.anchor;
+		uint32_t pos = s->p_.pos;
+		uint32_t const end = s->p_.end;
+
+		while (pos + ENC_MFLIMIT <= end)
+		{
+			uint32_t seq = lz4_enc_read32(buf + pos);
+			uint32_t h = lz4_enc_hash(seq);
+
+			uint32_t cand = hash[h];
+			uint32_t cur = s->p_.base + pos;
+			hash[h] = cur;
+
+			//unsigned wraparound takes care of candidates from before base
+			uint32_t ofs = cur - cand;
+			if (ofs - 1 < ENC_MAX_OFS && ofs <= pos && lz4_enc_read32(buf + pos - ofs) == seq)
+			{
+				uint32_t const limit = end - ENC_LAST_LITERALS;
+
+				uint32_t m = pos + ENC_MIN_MATCH;
+				while (m + 8 <= limit && lz4_enc_read64(buf + m) == lz4_enc_read64(buf + m - ofs))
+					m += 8;
+				while (m < limit && buf[m] == buf[m - ofs])
+					m++;
+
+				if (m == limit && !at_end && !full)
+				{
+					//the match might well run on into input we haven't seen
+					//yet, so wait for it rather than cutting the match short
+					hash[h] = cand;
+					break;
+				}
+
+				while (pos > anchor && pos > ofs && buf[pos - 1] == buf[pos - 1 - ofs])
+					pos--;
+
+				if (m - 2 > pos)
+					hash[lz4_enc_hash(lz4_enc_read32(buf + m - 2))] = s->p_.base + m - 2;
+
+				s->p_.pos = pos;
+				s->p_.mat_len = m - pos;
+				s->p_.mat_ofs = ofs;
+
+				ENC_TRANSITION_TO_PHASE(TOKEN);
+			}
+
+			//skip ahead faster the longer we go without finding anything
+			pos += 1 + ((pos - anchor) >> 11);
+		}
+
+		s->p_.pos = pos;
+
+		if (at_end)
+		{
+			//emit everything that's left as the final literal-only sequence
+			s->p_.pos = end;
+			s->p_.mat_len = 0;
+
+			ENC_TRANSITION_TO_PHASE(TOKEN);
+		}
+
+		if (!s->avail_in)
+			goto suspend_for_now;
+
+		if (!lz4_enc_slide(s))
+			//the pending literals fill the whole window, and we can't write
+			//them out before we know how long the literal run will be
+			ENC_TRANSITION_TO_PHASE(REPORT_ERROR);
+	}
+
+enc_phase_TOKEN:
+	ENC_SUSPEND_IF_OUTPUT_FULL();
+	{
+		uint32_t lit_len = s->p_.pos - s->p_.anchor;
+		uint32_t mat_len = s->p_.mat_len;
+
+		unsigned int tok = (lit_len < 15 ? lit_len : 15) << 4;
+		if (mat_len)
+			tok |= mat_len - ENC_MIN_MATCH < 15 ? mat_len - ENC_MIN_MATCH : 15;
+
+		*out++ = (uint8_t)tok;
+		avail_out--;
+
+		if (lit_len >= 15)
+		{
+			s->p_.ex_len = lit_len - 15;
+			ENC_TRANSITION_TO_PHASE(EX_LIT_LEN);
+		}
+	}
+	ENC_TRANSITION_TO_PHASE(COPY_LIT);
+
+enc_phase_EX_LIT_LEN:
+	for (;;)
+	{
+		ENC_SUSPEND_IF_OUTPUT_FULL();
+
+		uint32_t b = s->p_.ex_len < 255 ? s->p_.ex_len : 255;
+		*out++ = (uint8_t)b;
+		avail_out--;
+
+		if (b < 255)
+			break;
+		s->p_.ex_len -= 255;
+	}
+	ENC_TRANSITION_TO_PHASE(COPY_LIT);
+
+enc_phase_COPY_LIT:
+	{
+		size_t n = s->p_.pos - s->p_.anchor;
+		if (n > avail_out)
+			n = avail_out;
+
+		memcpy(out, buf + s->p_.anchor, n);
+		out += n;
+		avail_out -= n;
+		s->p_.anchor += (uint32_t)n;
+
+		if (s->p_.anchor != s->p_.pos)
+			goto suspend_for_now;
+	}
+
+	if (!s->p_.mat_len)
+		ENC_TRANSITION_TO_PHASE(DONE);
+
+	ENC_TRANSITION_TO_PHASE(OFS);
+
+enc_phase_OFS:
+	ENC_SUSPEND_IF_OUTPUT_FULL();
+	*out++ = (uint8_t)s->p_.mat_ofs;
+	avail_out--;
+	ENC_TRANSITION_TO_PHASE(OFS2);
+
+enc_phase_OFS2:
+	ENC_SUSPEND_IF_OUTPUT_FULL();
+	*out++ = (uint8_t)(s->p_.mat_ofs >> 8);
+	avail_out--;
+
+	if (s->p_.mat_len - ENC_MIN_MATCH >= 15)
+	{
+		s->p_.ex_len = s->p_.mat_len - ENC_MIN_MATCH - 15;
+		ENC_TRANSITION_TO_PHASE(EX_MAT_LEN);
+	}
+	goto end_of_sequence;
+
+enc_phase_EX_MAT_LEN:
+	for (;;)
+	{
+		ENC_SUSPEND_IF_OUTPUT_FULL();
+
+		uint32_t b = s->p_.ex_len < 255 ? s->p_.ex_len : 255;
+		*out++ = (uint8_t)b;
+		avail_out--;
+
+		if (b < 255)
+			break;
+		s->p_.ex_len -= 255;
+	}
+
+end_of_sequence:
+	s->p_.pos += s->p_.mat_len;
+	s->p_.anchor = s->p_.pos;
+	ENC_TRANSITION_TO_PHASE(SCAN);
+
+enc_phase_DONE:
+	if (s->avail_in)
+		//nothing can follow the final sequence
+		ENC_TRANSITION_TO_PHASE(REPORT_ERROR);
+	goto suspend_for_now;
+
+enc_phase_REPORT_ERROR:
+	s->p_.phase = ENC_PHASE_REPORT_ERROR;
+	return -1;
+
+suspend_for_now:
+	s->out = out;
+	s->avail_out = avail_out;
+
+	s->p_.phase = phase;
+
+	return phase == ENC_PHASE_DONE;
+}
+
+int lz4_enc_stream_run(lz4_enc_stream_state *s)
+{
+	int ret = lz4_enc_stream_run_with(s, 0);
+	return ret < 0 ? ret : 0;
+}
+
+int lz4_enc_stream_finish(lz4_enc_stream_state *s)
+{
+	return lz4_enc_stream_run_with(s, 1);
+}
+
+/*
+	The frame encoder.
+*/
+
+#define FRAME_ENC_TRANSITION_TO_PHASE(next_phase) \
+	do { phase = FRAME_ENC_PHASE_##next_phase; goto frame_enc_phase_##next_phase; } while (0)
+
+//once lz4_enc_stream_finish has ended a block, get ready
+//for the next one, keeping everything as history
+static void lz4_enc_next_block(lz4_enc_stream_state *s)
+{
+	assert(s->p_.phase == ENC_PHASE_DONE && !s->avail_in);
+	s->p_.phase = ENC_PHASE_SCAN;
+}
+
+//give up on the block being encoded (whatever's been written of it is
+//thrown away), taking the rest of its input in as history all the same
+static void lz4_enc_drop_block(lz4_enc_stream_state *s)
+{
+	for (;;)
+	{
+		s->p_.anchor = s->p_.end;
+		s->p_.pos = s->p_.end;
+
+		if (!s->avail_in)
+			break;
+
+		lz4_enc_fill(s);
+	}
+
+	s->p_.mat_len = 0;
+	s->p_.phase = ENC_PHASE_SCAN;
+}
+
+static void lz4_frame_enc_set_hdr(lz4_frame_enc_state *s, uint32_t v)
+{
+	s->p_.hdr[0] = (uint8_t)v;
+	s->p_.hdr[1] = (uint8_t)(v >> 8);
+	s->p_.hdr[2] = (uint8_t)(v >> 16);
+	s->p_.hdr[3] = (uint8_t)(v >> 24);
+
+	s->p_.hdr_len = 4;
+	s->p_.hdr_pos = 0;
+}
+
+//write out what's left of hdr, returns nonzero once it's all gone
+static int lz4_frame_enc_put_hdr(lz4_frame_enc_state *s, uint8_t **out, size_t *avail_out)
+{
+	size_t n = s->p_.hdr_len - s->p_.hdr_pos;
+	if (n > *avail_out)
+		n = *avail_out;
+
+	memcpy(*out, s->p_.hdr + s->p_.hdr_pos, n);
+	*out += n;
+	*avail_out -= n;
+	s->p_.hdr_pos += (unsigned int)n;
+
+	return s->p_.hdr_pos == s->p_.hdr_len;
+}
+
+void lz4_frame_enc_init(lz4_frame_enc_state *s)
+{
+	s->in = 0;
+	s->avail_in = 0;
+
+	s->out = 0;
+	s->avail_out = 0;
+
+	lz4_enc_stream_init(&s->p_.blk);
+
+	s->p_.raw_len = 0;
+	s->p_.blk_len = 0;
+	s->p_.blk_pos = 0;
+	s->p_.stored = 0;
+
+	//FLG: version 01, linked blocks, no checksums or content size; BD: 64 KiB
+	//blocks; then the second byte of the descriptor's xxHash32
+	static const uint8_t header[FRAME_ENC_HEADER_LEN] =
+	{
+		(uint8_t)FRAME_MAGIC, (uint8_t)(FRAME_MAGIC >> 8),
+		(uint8_t)(FRAME_MAGIC >> 16), (uint8_t)(FRAME_MAGIC >> 24),
+		0x40, 0x40, 0xC0,
+	};
+	memcpy(s->p_.hdr, header, sizeof(header));
+	s->p_.hdr_len = sizeof(header);
+	s->p_.hdr_pos = 0;
+
+	s->p_.phase = FRAME_ENC_PHASE_HEADER;
+}
+
+static int lz4_frame_enc_run_with(lz4_frame_enc_state *s, int finish)
+{
+	const uint8_t *in = s->in;
+	const uint8_t *const in_end = in + s->avail_in;
+
+	uint8_t *out = s->out;
+	size_t avail_out = s->avail_out;
+
+	unsigned int phase = s->p_.phase;
+
+	switch (phase)
+	{
+	case FRAME_ENC_PHASE_HEADER:		goto frame_enc_phase_HEADER;
+	case FRAME_ENC_PHASE_GATHER:		goto frame_enc_phase_GATHER;
+	case FRAME_ENC_PHASE_BLK_LEN:		goto frame_enc_phase_BLK_LEN;
+	case FRAME_ENC_PHASE_BLK_DATA:		goto frame_enc_phase_BLK_DATA;
+	case FRAME_ENC_PHASE_END_MARK:		goto frame_enc_phase_END_MARK;
+	case FRAME_ENC_PHASE_DONE:			goto frame_enc_phase_DONE;
+	case FRAME_ENC_PHASE_REPORT_ERROR:	goto frame_enc_phase_REPORT_ERROR;
+	default:
+		assert(0 && "corrupt encoder stream state");
+		goto frame_enc_phase_REPORT_ERROR;
+	}
+
+frame_enc_phase_HEADER: //write the frame header
+	if (!lz4_frame_enc_put_hdr(s, &out, &avail_out))
+		goto suspend_for_now;
+	FRAME_ENC_TRANSITION_TO_PHASE(GATHER);
+
+frame_enc_phase_GATHER: //loop; collect a block's worth of input, then encode it
+	{
+		size_t n = (size_t)(in_end - in);
+		if (n > FRAME_ENC_BLK_LEN - s->p_.raw_len)
+			n = FRAME_ENC_BLK_LEN - s->p_.raw_len;
+
+		if (n) //in may be null when finishing
+		{
+			memcpy(s->p_.raw + s->p_.raw_len, in, n);
+			in += n;
+			s->p_.raw_len += (uint32_t)n;
+		}
+	}
+
+	if (s->p_.raw_len < FRAME_ENC_BLK_LEN)
+	{
+		if (!finish)
+			goto suspend_for_now;
+
+		if (!s->p_.raw_len)
+		{
+			lz4_frame_enc_set_hdr(s, 0);
+			FRAME_ENC_TRANSITION_TO_PHASE(END_MARK);
+		}
+	}
+
+	{
+		lz4_enc_stream_state *blk = &s->p_.blk;
+
+		//anything that doesn't come out smaller is stored as it is
+		blk->in = s->p_.raw;
+		blk->avail_in = s->p_.raw_len;
+		blk->out = s->p_.packed;
+		blk->avail_out = s->p_.raw_len - 1;
+
+		int ret = lz4_enc_stream_run_with(blk, 1);
+		if (ret < 0)
+			FRAME_ENC_TRANSITION_TO_PHASE(REPORT_ERROR);
+
+		if (ret)
+		{
+			s->p_.blk_len = (uint32_t)(blk->out - s->p_.packed);
+			s->p_.stored = 0;
+			lz4_enc_next_block(blk);
+		}
+		else
+		{
+			//out of room, so there's no point going on
+			s->p_.blk_len = s->p_.raw_len;
+			s->p_.stored = 1;
+			lz4_enc_drop_block(blk);
+		}
+
+		s->p_.blk_pos = 0;
+		lz4_frame_enc_set_hdr(s, s->p_.blk_len | (s->p_.stored ? FRAME_BLK_UNCOMPRESSED : 0));
+	}
+	FRAME_ENC_TRANSITION_TO_PHASE(BLK_LEN);
+
+frame_enc_phase_BLK_LEN: //write a block's size
+	if (!lz4_frame_enc_put_hdr(s, &out, &avail_out))
+		goto suspend_for_now;
+	FRAME_ENC_TRANSITION_TO_PHASE(BLK_DATA);
+
+frame_enc_phase_BLK_DATA: //write a block's data
+	{
+		const uint8_t *src = s->p_.stored ? s->p_.raw : s->p_.packed;
+
+		size_t n = s->p_.blk_len - s->p_.blk_pos;
+		if (n > avail_out)
+			n = avail_out;
+
+		memcpy(out, src + s->p_.blk_pos, n);
+		out += n;
+		avail_out -= n;
+		s->p_.blk_pos += (uint32_t)n;
+
+		if (s->p_.blk_pos != s->p_.blk_len)
+			goto suspend_for_now;
+	}
+
+	s->p_.raw_len = 0;
+	FRAME_ENC_TRANSITION_TO_PHASE(GATHER);
+
+frame_enc_phase_END_MARK: //write the (zero) size that ends the frame
+	if (!lz4_frame_enc_put_hdr(s, &out, &avail_out))
+		goto suspend_for_now;
+	FRAME_ENC_TRANSITION_TO_PHASE(DONE);
+
+frame_enc_phase_DONE:
+	if (in != in_end)
+		//nothing can follow the end of the frame
+		FRAME_ENC_TRANSITION_TO_PHASE(REPORT_ERROR);
+	goto suspend_for_now;
+
+frame_enc_phase_REPORT_ERROR:
+	s->p_.phase = FRAME_ENC_PHASE_REPORT_ERROR;
+	return -1;
+
+suspend_for_now:
+	s->in = in;
+	s->avail_in = (size_t)(in_end - in);
+
+	s->out = out;
+	s->avail_out = avail_out;
+
+	s->p_.phase = phase;
+
+	return phase == FRAME_ENC_PHASE_DONE;
+}
+
+int lz4_frame_enc_run(lz4_frame_enc_state *s)
+{
+	int ret = lz4_frame_enc_run_with(s, 0);
+	return ret < 0 ? ret : 0;
+}
+
+int lz4_frame_enc_finish(lz4_frame_enc_state *s)
+{
+	return lz4_frame_enc_run_with(s, 1);
+}
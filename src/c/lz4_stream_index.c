@@ -0,0 +1,644 @@
+#include "lz4_stream_index.h"
+#include "lz4_stream_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//all a checkpoint can hold; anything else (LZ4_DEC_STREAM_RETAIN_OUTPUT,
+//lz4_dec_stream_run_auto's pick) has no business in a saved state
+#define INDEX_FLAGS					(LZ4_DEC_STREAM_INDEPENDENT_BLOCKS | LZ4_DEC_STREAM_NO_SIMD | \
+										LZ4_DEC_STREAM_XXH32 | FLAG_IN_BLOCK | FLAG_BLK_OUT_LEN)
+
+//and of those, the ones a seek restores: the rest are the caller's to set
+//(except in a frame, where the frame decoder sets them from the frame header)
+#define INDEX_BLK_FLAGS				(FLAG_IN_BLOCK | FLAG_BLK_OUT_LEN)
+#define INDEX_FRAME_BLK_FLAGS		(INDEX_BLK_FLAGS | LZ4_DEC_STREAM_INDEPENDENT_BLOCKS | LZ4_DEC_STREAM_XXH32)
+
+#define INDEX_MAGIC					0x58493453u //"S4IX"
+#define INDEX_VERSION				3
+
+#define INDEX_WIN_RAW				0x80000000u //the window is stored uncompressed
+
+typedef struct index_cp
+{
+	uint64_t		in_pos, out_pos;
+
+	//the block decoder
+	uint32_t		lit_len, mat_len, mat_dst;
+	uint32_t		phase, flags;
+	uint64_t		blk_left, blk_out_left;
+	lz4_stream_xxh32	xxh;
+
+	//the frame decoder around it, if any
+	uint32_t		f_len, f_max_blk_len;
+	uint8_t			f_hdr[16];
+	uint32_t		f_hdr_len, f_hdr_need;
+	uint32_t		f_flg, f_phase;
+	lz4_stream_xxh32	f_xxh;
+
+	uint32_t		win_len;	//bytes of history
+	uint32_t		win_packed;	//bytes stored, | INDEX_WIN_RAW if not compressed
+	uint8_t			*win;
+} index_cp;
+
+struct lz4_dec_index
+{
+	uint64_t				spacing;
+	int						frames;
+
+	index_cp				*cps;
+	size_t					n_cps, cap_cps;
+
+	//where the decoding pass has got to
+	uint64_t				in_pos, out_pos;
+	uint64_t				next_cp;
+
+	lz4_enc_stream_state	*enc;
+	uint8_t					*scratch;
+};
+
+lz4_dec_index *lz4_dec_index_create(uint64_t spacing)
+{
+	lz4_dec_index *idx = (lz4_dec_index *)calloc(1, sizeof(lz4_dec_index));
+	if (!idx)
+		return 0;
+
+	idx->spacing = spacing ? spacing : 1;
+	idx->next_cp = idx->spacing;
+	idx->frames = -1;
+
+	return idx;
+}
+
+void lz4_dec_index_free(lz4_dec_index *idx)
+{
+	if (!idx)
+		return;
+
+	for (size_t i = 0; i < idx->n_cps; i++)
+		free(idx->cps[i].win);
+
+	free(idx->cps);
+	free(idx->enc);
+	free(idx->scratch);
+	free(idx);
+}
+
+size_t lz4_dec_index_count(const lz4_dec_index *idx)
+{
+	return idx->n_cps;
+}
+
+//compresses len bytes of history, returns the packed length (with INDEX_WIN_RAW if it didn't shrink)
+static uint32_t index_pack_window(lz4_enc_stream_state *enc, const uint8_t *win, uint32_t len, uint8_t *packed)
+{
+	//nb: packed has room for len bytes, anything bigger isn't worth keeping
+	lz4_enc_stream_init(enc);
+	enc->in = win;
+	enc->avail_in = len;
+	enc->out = packed;
+	enc->avail_out = len;
+
+	if (len && lz4_enc_stream_finish(enc) == 1)
+		return (uint32_t)(len - enc->avail_out);
+
+	memcpy(packed, win, len);
+	return len | INDEX_WIN_RAW;
+}
+
+static int index_add_cp(lz4_dec_index *idx, const lz4_dec_stream_state *blk, const lz4_frame_dec_state *frame)
+{
+	if (idx->n_cps == idx->cap_cps)
+	{
+		size_t cap = idx->cap_cps ? idx->cap_cps * 2 : 16;
+		index_cp *cps = (index_cp *)realloc(idx->cps, cap * sizeof(index_cp));
+		if (!cps)
+			return -1;
+
+		idx->cps = cps;
+		idx->cap_cps = cap;
+	}
+
+	if (!idx->enc)
+	{
+		idx->enc = (lz4_enc_stream_state *)malloc(sizeof(lz4_enc_stream_state));
+		idx->scratch = (uint8_t *)malloc(2 * O_BUF_LEN);
+		if (!idx->enc || !idx->scratch)
+			return -1;
+	}
+
+	index_cp *cp = &idx->cps[idx->n_cps];
+	memset(cp, 0, sizeof(*cp));
+
+	cp->in_pos = idx->in_pos;
+	cp->out_pos = idx->out_pos;
+
+	cp->lit_len = blk->p_.lit_len;
+	cp->mat_len = blk->p_.mat_len;
+	cp->mat_dst = blk->p_.mat_dst;
+	cp->phase = blk->p_.phase;
+	cp->flags = blk->p_.flags & INDEX_FLAGS;
+	cp->blk_left = blk->p_.blk_left;
+	cp->blk_out_left = blk->p_.blk_out_left;
+	cp->xxh = blk->p_.xxh;
+
+	//no later match can reach back past the start of the stream
+	uint64_t win_len = idx->out_pos < O_BUF_LEN ? idx->out_pos : O_BUF_LEN;
+
+	if (frame)
+	{
+		cp->f_len = frame->p_.len;
+		cp->f_max_blk_len = frame->p_.max_blk_len;
+		memcpy(cp->f_hdr, frame->p_.hdr, sizeof(cp->f_hdr));
+		cp->f_hdr_len = frame->p_.hdr_len;
+		cp->f_hdr_need = frame->p_.hdr_need;
+		cp->f_flg = frame->p_.flg;
+		cp->f_phase = frame->p_.phase;
+		cp->f_xxh = frame->p_.blk_xxh;
+
+		//between frames, the block decoder's about to be reset, and between
+		//independent blocks, nothing can reach back past the next block's start
+		if (frame->p_.phase <= FRAME_PHASE_DESC_EXTRA || frame->p_.phase == FRAME_PHASE_CHECKSUM)
+			win_len = 0;
+		else if ((frame->p_.flg & FRAME_FLG_BLOCK_INDEP) && !(blk->p_.flags & FLAG_IN_BLOCK))
+			win_len = 0;
+	}
+
+	//unroll the ring so the history ends at win_len
+	const uint8_t *o_buf = blk->p_.o_buf + O_BUF_PAD;
+	uint32_t n = (uint32_t)win_len;
+	uint32_t start = (blk->p_.o_pos - n) & (O_BUF_LEN - 1);
+	uint32_t e = O_BUF_LEN - start < n ? O_BUF_LEN - start : n;
+	memcpy(idx->scratch, o_buf + start, e);
+	memcpy(idx->scratch + e, o_buf, n - e);
+
+	cp->win_len = n;
+	cp->win_packed = index_pack_window(idx->enc, idx->scratch, n, idx->scratch + O_BUF_LEN);
+
+	size_t packed_len = cp->win_packed & ~INDEX_WIN_RAW;
+	cp->win = (uint8_t *)malloc(packed_len ? packed_len : 1);
+	if (!cp->win)
+		return -1;
+	memcpy(cp->win, idx->scratch + O_BUF_LEN, packed_len);
+
+	idx->n_cps++;
+	return 0;
+}
+
+//runs the decoder in steps which stop on every multiple of spacing
+static int index_run(lz4_dec_index *idx, int frames,
+	lz4_dec_stream_state *blk, lz4_frame_dec_state *frame,
+	const uint8_t **in, uint8_t **out, size_t *avail_out)
+{
+	//matches would be read from behind out, and the window we'd save is stale
+	if (!frames && (blk->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT))
+		return -1;
+
+	if (idx->frames != frames)
+	{
+		if (idx->frames >= 0)
+			return -1; //don't mix the two
+		idx->frames = frames;
+	}
+
+	for (;;)
+	{
+		size_t caller_avail = *avail_out;
+		size_t step = caller_avail;
+		if (idx->next_cp - idx->out_pos < step)
+			step = (size_t)(idx->next_cp - idx->out_pos);
+
+		const uint8_t *in_start = *in;
+		uint8_t *out_start = *out;
+
+		*avail_out = step;
+		int err = frames ? lz4_frame_dec_run(frame) : lz4_dec_stream_run(blk);
+
+		size_t n_out = (size_t)(*out - out_start);
+		*avail_out = caller_avail - n_out;
+
+		idx->in_pos += (uint64_t)(*in - in_start);
+		idx->out_pos += n_out;
+
+		if (err)
+			return err;
+
+		if (idx->out_pos != idx->next_cp)
+			return 0; //out of input (or output)
+
+		if (index_add_cp(idx, frames ? &frame->p_.blk : blk, frame))
+			return -1;
+		idx->next_cp += idx->spacing;
+
+		if (!*avail_out)
+			return 0;
+	}
+}
+
+int lz4_dec_index_run(lz4_dec_index *idx, lz4_dec_stream_state *s)
+{
+	return index_run(idx, 0, s, 0, &s->in, &s->out, &s->avail_out);
+}
+
+int lz4_frame_dec_index_run(lz4_dec_index *idx, lz4_frame_dec_state *s)
+{
+	return index_run(idx, 1, 0, s, &s->in, &s->out, &s->avail_out);
+}
+
+/*
+	Serialized format, all little-endian:
+
+		u32 magic, u32 version, u32 window log, u32 frames,
+		u64 spacing, u64 count,
+		count checkpoints, each:
+			u64 in_pos, u64 out_pos,
+			u32 lit_len, u32 mat_len, u32 mat_dst, u32 phase, u32 flags, u64 blk_left, u64 blk_out_left, xxh,
+			u32 f_len, u32 f_max_blk_len, u8 f_hdr[16], u32 f_hdr_len, u32 f_hdr_need, u32 f_flg, u32 f_phase, f_xxh,
+			u32 win_len, u32 win_packed, then the window's packed bytes
+		with each xxHash32 state (the content's and the frame's current block's) as:
+			u32 v[4], u64 total_len, u8 mem[16], u32 mem_len
+*/
+
+#define INDEX_HDR_LEN		32
+#define INDEX_XXH_LEN		(16 + 8 + 16 + 4)
+#define INDEX_CP_LEN		(16 + 20 + 16 + INDEX_XXH_LEN + 8 + 16 + 16 + INDEX_XXH_LEN + 8)
+
+static uint8_t *index_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+	return p + 4;
+}
+
+static uint8_t *index_put64(uint8_t *p, uint64_t v)
+{
+	p = index_put32(p, (uint32_t)v);
+	return index_put32(p, (uint32_t)(v >> 32));
+}
+
+static const uint8_t *index_get32(const uint8_t *p, uint32_t *v)
+{
+	*v =
+		(uint32_t)p[0] |
+		(uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+	return p + 4;
+}
+
+static const uint8_t *index_get64(const uint8_t *p, uint64_t *v)
+{
+	uint32_t lo, hi;
+	p = index_get32(p, &lo);
+	p = index_get32(p, &hi);
+	*v = (uint64_t)hi << 32 | lo;
+	return p;
+}
+
+static uint8_t *index_put_xxh(uint8_t *p, const lz4_stream_xxh32 *h)
+{
+	for (int i = 0; i < 4; i++)
+		p = index_put32(p, h->v[i]);
+	p = index_put64(p, h->total_len);
+	memcpy(p, h->mem, 16);
+	p += 16;
+	return index_put32(p, h->mem_len);
+}
+
+static const uint8_t *index_get_xxh(const uint8_t *p, lz4_stream_xxh32 *h)
+{
+	uint32_t mem_len;
+	for (int i = 0; i < 4; i++)
+		p = index_get32(p, &h->v[i]);
+	p = index_get64(p, &h->total_len);
+	memcpy(h->mem, p, 16);
+	p += 16;
+	p = index_get32(p, &mem_len);
+	h->mem_len = mem_len;
+	return p;
+}
+
+size_t lz4_dec_index_save(const lz4_dec_index *idx, uint8_t *buf, size_t buf_len)
+{
+	size_t len = INDEX_HDR_LEN;
+	for (size_t i = 0; i < idx->n_cps; i++)
+		len += INDEX_CP_LEN + (idx->cps[i].win_packed & ~INDEX_WIN_RAW);
+
+	if (!buf || buf_len < len)
+		return len;
+
+	uint8_t *p = buf;
+	p = index_put32(p, INDEX_MAGIC);
+	p = index_put32(p, INDEX_VERSION);
+	p = index_put32(p, LZ4_STREAM_WINDOW_LOG);
+	p = index_put32(p, idx->frames > 0);
+	p = index_put64(p, idx->spacing);
+	p = index_put64(p, idx->n_cps);
+
+	for (size_t i = 0; i < idx->n_cps; i++)
+	{
+		const index_cp *cp = &idx->cps[i];
+
+		p = index_put64(p, cp->in_pos);
+		p = index_put64(p, cp->out_pos);
+
+		p = index_put32(p, cp->lit_len);
+		p = index_put32(p, cp->mat_len);
+		p = index_put32(p, cp->mat_dst);
+		p = index_put32(p, cp->phase);
+		p = index_put32(p, cp->flags);
+		p = index_put64(p, cp->blk_left);
+		p = index_put64(p, cp->blk_out_left);
+		p = index_put_xxh(p, &cp->xxh);
+
+		p = index_put32(p, cp->f_len);
+		p = index_put32(p, cp->f_max_blk_len);
+		memcpy(p, cp->f_hdr, 16);
+		p += 16;
+		p = index_put32(p, cp->f_hdr_len);
+		p = index_put32(p, cp->f_hdr_need);
+		p = index_put32(p, cp->f_flg);
+		p = index_put32(p, cp->f_phase);
+		p = index_put_xxh(p, &cp->f_xxh);
+
+		p = index_put32(p, cp->win_len);
+		p = index_put32(p, cp->win_packed);
+		memcpy(p, cp->win, cp->win_packed & ~INDEX_WIN_RAW);
+		p += cp->win_packed & ~INDEX_WIN_RAW;
+	}
+
+	return len;
+}
+
+//whether a loaded checkpoint's block decoder state is one the decoder could
+//have left behind (it trusts its own state, so a bad offset or length would
+//have it read out of bounds or divide by zero)
+static int index_blk_state_ok(const index_cp *cp)
+{
+	if (cp->phase > PHASE_REPORT_ERROR)
+		return 0;
+
+	if ((cp->flags & FLAG_BLK_OUT_LEN) && !(cp->flags & FLAG_IN_BLOCK))
+		return 0;
+
+	switch (cp->phase)
+	{
+	case PHASE_READ_EX_LIT_LEN:
+		if (cp->lit_len < 0xF)
+			return 0;
+		break;
+
+	case PHASE_COPY_LIT:
+		if (!cp->lit_len)
+			return 0;
+		if ((cp->flags & FLAG_IN_BLOCK) && cp->lit_len > cp->blk_left)
+			return 0; //the rest of the literal has to be in the block
+		break;
+
+	case PHASE_READ_OFS2:
+		if (cp->mat_dst > 0xFF)
+			return 0; //just the low byte so far
+		break;
+
+	case PHASE_READ_EX_MAT_LEN:
+	case PHASE_COPY_MAT:
+		if (!cp->mat_dst || cp->mat_dst > O_BUF_LEN)
+			return 0;
+		break;
+	}
+
+	switch (cp->phase)
+	{
+	case PHASE_READ_OFS:
+	case PHASE_READ_OFS2:
+	case PHASE_READ_EX_MAT_LEN:
+		if (cp->mat_len < 4)
+			return 0;
+		break;
+
+	case PHASE_COPY_MAT:
+		if (!cp->mat_len)
+			return 0;
+		break;
+
+	default:
+		return 1;
+	}
+
+	//nb: a block's output isn't limited unless it was declared
+	if ((cp->flags & FLAG_BLK_OUT_LEN) && cp->mat_len > cp->blk_out_left)
+		return 0;
+
+	return 1;
+}
+
+lz4_dec_index *lz4_dec_index_load(const uint8_t *buf, size_t len)
+{
+	if (len < INDEX_HDR_LEN)
+		return 0;
+
+	const uint8_t *p = buf;
+	const uint8_t *const end = buf + len;
+
+	uint32_t magic, version, window_log, frames;
+	uint64_t spacing, count;
+	p = index_get32(p, &magic);
+	p = index_get32(p, &version);
+	p = index_get32(p, &window_log);
+	p = index_get32(p, &frames);
+	p = index_get64(p, &spacing);
+	p = index_get64(p, &count);
+
+	if (magic != INDEX_MAGIC || version != INDEX_VERSION ||
+		window_log != LZ4_STREAM_WINDOW_LOG || frames > 1 ||
+		count > (uint64_t)(end - p) / INDEX_CP_LEN)
+		return 0;
+
+	lz4_dec_index *idx = lz4_dec_index_create(spacing);
+	if (!idx)
+		return 0;
+
+	idx->frames = (int)frames;
+	idx->cps = (index_cp *)calloc(count ? (size_t)count : 1, sizeof(index_cp));
+	if (!idx->cps)
+		goto fail;
+	idx->cap_cps = (size_t)count;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		index_cp *cp = &idx->cps[i];
+		if ((size_t)(end - p) < INDEX_CP_LEN)
+			goto fail;
+
+		p = index_get64(p, &cp->in_pos);
+		p = index_get64(p, &cp->out_pos);
+
+		p = index_get32(p, &cp->lit_len);
+		p = index_get32(p, &cp->mat_len);
+		p = index_get32(p, &cp->mat_dst);
+		p = index_get32(p, &cp->phase);
+		p = index_get32(p, &cp->flags);
+		cp->flags &= INDEX_FLAGS;
+		p = index_get64(p, &cp->blk_left);
+		p = index_get64(p, &cp->blk_out_left);
+		p = index_get_xxh(p, &cp->xxh);
+
+		p = index_get32(p, &cp->f_len);
+		p = index_get32(p, &cp->f_max_blk_len);
+		memcpy(cp->f_hdr, p, 16);
+		p += 16;
+		p = index_get32(p, &cp->f_hdr_len);
+		p = index_get32(p, &cp->f_hdr_need);
+		p = index_get32(p, &cp->f_flg);
+		p = index_get32(p, &cp->f_phase);
+		p = index_get_xxh(p, &cp->f_xxh);
+
+		p = index_get32(p, &cp->win_len);
+		p = index_get32(p, &cp->win_packed);
+
+		size_t packed_len = cp->win_packed & ~INDEX_WIN_RAW;
+		//nb: the decoders assume their state is sane, so make sure it is
+		if (!index_blk_state_ok(cp) || cp->f_phase > FRAME_PHASE_REPORT_ERROR ||
+			cp->f_hdr_need > sizeof(cp->f_hdr) || cp->f_hdr_len > cp->f_hdr_need ||
+			cp->xxh.mem_len >= 16 || cp->f_xxh.mem_len >= 16 ||
+			cp->win_len > O_BUF_LEN || packed_len > cp->win_len ||
+			((cp->win_packed & INDEX_WIN_RAW) && packed_len != cp->win_len) ||
+			packed_len > (size_t)(end - p) ||
+			(i && cp->out_pos < idx->cps[i - 1].out_pos))
+			goto fail;
+
+		cp->win = (uint8_t *)malloc(packed_len ? packed_len : 1);
+		if (!cp->win)
+			goto fail;
+		memcpy(cp->win, p, packed_len);
+		p += packed_len;
+
+		idx->n_cps++;
+	}
+
+	if (idx->n_cps)
+	{
+		idx->in_pos = idx->cps[idx->n_cps - 1].in_pos;
+		idx->out_pos = idx->cps[idx->n_cps - 1].out_pos;
+		idx->next_cp = idx->out_pos + idx->spacing;
+	}
+
+	return idx;
+
+fail:
+	lz4_dec_index_free(idx);
+	return 0;
+}
+
+//the last checkpoint at or before out_pos, or null
+static const index_cp *index_find(const lz4_dec_index *idx, uint64_t out_pos)
+{
+	size_t lo = 0, hi = idx->n_cps;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (idx->cps[mid].out_pos <= out_pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? &idx->cps[lo - 1] : 0;
+}
+
+static int index_restore_blk(const index_cp *cp, lz4_dec_stream_state *s, unsigned int cp_flags)
+{
+	uint8_t *o_buf = s->p_.o_buf + O_BUF_PAD;
+
+	if (cp->win_packed & INDEX_WIN_RAW)
+		memcpy(o_buf, cp->win, cp->win_len);
+	else if (cp->win_len)
+	{
+		lz4_dec_stream_state *dec = (lz4_dec_stream_state *)malloc(sizeof(lz4_dec_stream_state));
+		if (!dec)
+			return -1;
+
+		lz4_dec_stream_init(dec);
+		dec->in = cp->win;
+		dec->avail_in = cp->win_packed;
+		dec->out = o_buf;
+		dec->avail_out = cp->win_len;
+
+		int err = lz4_dec_stream_run(dec) || dec->avail_out || dec->avail_in;
+		free(dec);
+		if (err)
+			return -1;
+	}
+
+	s->p_.o_pos = cp->win_len & (O_BUF_LEN - 1);
+	s->p_.o_pending = 0;
+
+	s->p_.lit_len = cp->lit_len;
+	s->p_.mat_len = cp->mat_len;
+	s->p_.mat_dst = cp->mat_dst;
+	s->p_.phase = cp->phase;
+	s->p_.flags = (s->p_.flags & ~cp_flags) | (cp->flags & cp_flags);
+	s->p_.blk_left = (size_t)cp->blk_left;
+	s->p_.blk_out_left = (size_t)cp->blk_out_left;
+	s->p_.xxh = cp->xxh;
+
+	//a dictionary is only needed for the first window's worth of output
+	s->p_.dict_hist = (size_t)cp->out_pos;
+	if (s->p_.dict_hist >= O_BUF_LEN)
+		s->p_.dict = 0;
+
+	return 0;
+}
+
+int lz4_dec_index_seek(const lz4_dec_index *idx, uint64_t out_pos,
+	lz4_dec_stream_state *s, uint64_t *in_pos, uint64_t *at_out_pos)
+{
+	*in_pos = 0;
+	*at_out_pos = 0;
+
+	if (idx->frames > 0 || (s->p_.flags & LZ4_DEC_STREAM_RETAIN_OUTPUT))
+		return -1;
+
+	const index_cp *cp = index_find(idx, out_pos);
+	if (!cp)
+		return 0;
+
+	if (index_restore_blk(cp, s, INDEX_BLK_FLAGS))
+		return -1;
+
+	*in_pos = cp->in_pos;
+	*at_out_pos = cp->out_pos;
+	return 0;
+}
+
+int lz4_frame_dec_index_seek(const lz4_dec_index *idx, uint64_t out_pos,
+	lz4_frame_dec_state *s, uint64_t *in_pos, uint64_t *at_out_pos)
+{
+	*in_pos = 0;
+	*at_out_pos = 0;
+
+	if (idx->frames == 0)
+		return -1;
+
+	const index_cp *cp = index_find(idx, out_pos);
+	if (!cp)
+		return 0;
+
+	if (index_restore_blk(cp, &s->p_.blk, INDEX_FRAME_BLK_FLAGS))
+		return -1;
+
+	s->p_.len = cp->f_len;
+	s->p_.max_blk_len = cp->f_max_blk_len;
+	memcpy(s->p_.hdr, cp->f_hdr, sizeof(s->p_.hdr));
+	s->p_.hdr_len = cp->f_hdr_len;
+	s->p_.hdr_need = cp->f_hdr_need;
+	s->p_.flg = cp->f_flg;
+	s->p_.phase = cp->f_phase;
+	s->p_.blk_xxh = cp->f_xxh;
+
+	*in_pos = cp->in_pos;
+	*at_out_pos = cp->out_pos;
+	return 0;
+}
@@ -0,0 +1,470 @@
+#include "lz4_stream_mt.h"
+#include "lz4_stream_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(__STDC_NO_THREADS__) && !defined(__STDC_NO_ATOMICS__)
+	#define HAVE_THREADS 1
+	#include <threads.h>
+	#include <stdatomic.h>
+#else
+	#define HAVE_THREADS 0
+#endif
+
+typedef struct mt_block
+{
+	size_t			in_ofs;
+	uint32_t		len;
+	int				raw;
+
+	//filled in by whichever thread decodes the block
+	size_t			out_len;
+	int				ok;
+} mt_block;
+
+typedef struct mt_frame
+{
+	const uint8_t	*in;
+
+	uint8_t			*out;
+	size_t			out_cap;
+
+	uint32_t		max_blk_len;
+
+	mt_block		*blocks;
+	size_t			n_blocks;
+
+#if HAVE_THREADS
+	atomic_size_t	next_block;
+#else
+	size_t			next_block;
+#endif
+} mt_frame;
+
+/*
+	The threads (and their decoder states) are started once per call,
+	on the first frame that can be split up, and kept for the rest.
+	Between frames the helpers wait on wake; each new frame bumps gen,
+	and the calling thread waits on idle until they've all finished it.
+*/
+
+typedef struct mt_pool mt_pool;
+
+typedef struct mt_helper
+{
+	mt_pool					*pool;
+	lz4_dec_stream_state	*dec;
+#if HAVE_THREADS
+	thrd_t					thrd;
+#endif
+} mt_helper;
+
+struct mt_pool
+{
+	lz4_dec_stream_state	*decs; //one per thread, decs[0] is the calling thread's
+	int						failed; //couldn't be started, decode sequentially
+
+#if HAVE_THREADS
+	mt_helper		*helpers;
+	unsigned int	n_helpers;
+
+	mtx_t			lock;
+	cnd_t			wake, idle;
+
+	mt_frame		*frame; //the frame being decoded
+	unsigned long	gen; //bumped for each frame
+	unsigned int	n_busy; //helpers yet to finish the current frame
+	int				quit;
+#endif
+};
+
+static uint32_t mt_read_le32(const uint8_t *p)
+{
+	return
+		(uint32_t)p[0] |
+		(uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+}
+
+static void mt_decode_block(mt_frame *f, lz4_dec_stream_state *dec, size_t i)
+{
+	mt_block *b = &f->blocks[i];
+
+	//nb: this is where the block goes *if* all the blocks before it are full size
+	size_t out_ofs = i * f->max_blk_len;
+	if (out_ofs > f->out_cap)
+		out_ofs = f->out_cap;
+
+	size_t out_cap = f->out_cap - out_ofs;
+	if (out_cap > f->max_blk_len)
+		out_cap = f->max_blk_len;
+
+	b->ok = 0;
+
+	if (b->raw)
+	{
+		if (b->len > out_cap)
+			return;
+
+		memcpy(f->out + out_ofs, f->in + b->in_ofs, b->len);
+		b->out_len = b->len;
+		b->ok = 1;
+		return;
+	}
+
+	lz4_dec_stream_init_ex(dec, LZ4_DEC_STREAM_INDEPENDENT_BLOCKS);
+	lz4_dec_stream_begin_block(dec, b->len);
+
+	dec->in = f->in + b->in_ofs;
+	dec->avail_in = b->len;
+	dec->out = f->out + out_ofs;
+	dec->avail_out = out_cap;
+
+	if (lz4_dec_stream_run(dec) || dec->avail_in)
+		//bad data, or the block doesn't fit where we'd hoped
+		return;
+
+	b->out_len = (size_t)(dec->out - (f->out + out_ofs));
+	b->ok = 1;
+}
+
+static void mt_decode_blocks(mt_frame *f, lz4_dec_stream_state *dec)
+{
+	for (;;)
+	{
+#if HAVE_THREADS
+		size_t i = atomic_fetch_add(&f->next_block, 1);
+#else
+		size_t i = f->next_block++;
+#endif
+		if (i >= f->n_blocks)
+			break;
+
+		mt_decode_block(f, dec, i);
+	}
+}
+
+#if HAVE_THREADS
+static int mt_worker(void *arg)
+{
+	mt_helper *h = (mt_helper *)arg;
+	mt_pool *p = h->pool;
+
+	unsigned long seen = 0;
+
+	mtx_lock(&p->lock);
+	for (;;)
+	{
+		while (!p->quit && p->gen == seen)
+			cnd_wait(&p->wake, &p->lock);
+		if (p->quit)
+			break;
+
+		seen = p->gen;
+		mt_frame *f = p->frame;
+
+		mtx_unlock(&p->lock);
+		mt_decode_blocks(f, h->dec);
+		mtx_lock(&p->lock);
+
+		if (!--p->n_busy)
+			cnd_signal(&p->idle);
+	}
+	mtx_unlock(&p->lock);
+
+	return 0;
+}
+#endif
+
+//starts n_threads - 1 helpers, or fewer if some can't be started;
+//returns nonzero if not even the calling thread's state can be had
+static int mt_pool_start(mt_pool *p, unsigned int n_threads)
+{
+	p->decs = (lz4_dec_stream_state *)malloc(n_threads * sizeof(*p->decs));
+	if (!p->decs)
+		return -1;
+
+#if HAVE_THREADS
+	p->helpers = (mt_helper *)malloc((n_threads - 1) * sizeof(*p->helpers));
+	if (!p->helpers)
+		return 0;
+
+	if (mtx_init(&p->lock, mtx_plain) != thrd_success)
+		goto no_lock;
+	if (cnd_init(&p->wake) != thrd_success)
+		goto no_wake;
+	if (cnd_init(&p->idle) != thrd_success)
+		goto no_idle;
+
+	for (; p->n_helpers < n_threads - 1; p->n_helpers++)
+	{
+		mt_helper *h = &p->helpers[p->n_helpers];
+		h->pool = p;
+		h->dec = &p->decs[p->n_helpers + 1];
+
+		if (thrd_create(&h->thrd, mt_worker, h) != thrd_success)
+			break;
+	}
+
+	if (p->n_helpers)
+		return 0;
+
+	//no helpers after all, so no need for the rest
+	cnd_destroy(&p->idle);
+no_idle:
+	cnd_destroy(&p->wake);
+no_wake:
+	mtx_destroy(&p->lock);
+no_lock:
+	free(p->helpers);
+	p->helpers = NULL;
+#else
+	(void)n_threads;
+#endif
+
+	return 0;
+}
+
+static void mt_pool_stop(mt_pool *p)
+{
+#if HAVE_THREADS
+	if (p->n_helpers)
+	{
+		mtx_lock(&p->lock);
+		p->quit = 1;
+		cnd_broadcast(&p->wake);
+		mtx_unlock(&p->lock);
+
+		for (unsigned int i = 0; i < p->n_helpers; i++)
+			thrd_join(p->helpers[i].thrd, NULL);
+
+		cnd_destroy(&p->idle);
+		cnd_destroy(&p->wake);
+		mtx_destroy(&p->lock);
+		free(p->helpers);
+	}
+#endif
+
+	free(p->decs);
+}
+
+//decodes one frame in parallel, returns 0 on success, nonzero if
+//the frame has to be handed to the sequential decoder instead
+static int mt_decode_frame(mt_frame *f, mt_pool *p, size_t *out_len)
+{
+	f->next_block = 0;
+
+#if HAVE_THREADS
+	if (p->n_helpers)
+	{
+		mtx_lock(&p->lock);
+		p->frame = f;
+		p->gen++;
+		p->n_busy = p->n_helpers;
+		cnd_broadcast(&p->wake);
+		mtx_unlock(&p->lock);
+	}
+#endif
+
+	mt_decode_blocks(f, &p->decs[0]);
+
+#if HAVE_THREADS
+	if (p->n_helpers)
+	{
+		mtx_lock(&p->lock);
+		while (p->n_busy)
+			cnd_wait(&p->idle, &p->lock);
+		p->frame = NULL;
+		mtx_unlock(&p->lock);
+	}
+#endif
+
+	size_t len = 0;
+	for (size_t i = 0; i < f->n_blocks; i++)
+	{
+		const mt_block *b = &f->blocks[i];
+
+		if (!b->ok)
+			return -1;
+		if (i + 1 < f->n_blocks && b->out_len != f->max_blk_len)
+			//a short block in the middle, everything after it is in the wrong place
+			return -1;
+
+		len += b->out_len;
+	}
+
+	*out_len = len;
+	return 0;
+}
+
+static int mt_decode_frame_sequential(
+	const uint8_t *in, size_t in_len,
+	uint8_t *out, size_t out_cap,
+	size_t *out_len)
+{
+	lz4_frame_dec_state *dec = (lz4_frame_dec_state *)malloc(sizeof(*dec));
+	if (!dec)
+		return -1;
+
+	lz4_frame_dec_init(dec);
+	dec->in = in;
+	dec->avail_in = in_len;
+	dec->out = out;
+	dec->avail_out = out_cap;
+
+	int ret = lz4_frame_dec_run(dec);
+	if (!ret && (dec->avail_in || !lz4_frame_dec_done(dec)))
+		//the output buffer's too small
+		ret = -1;
+
+	*out_len = (size_t)(dec->out - out);
+
+	free(dec);
+	return ret;
+}
+
+//walks the block headers of a frame, filling in blocks (if it isn't NULL),
+//returns the number of blocks and sets *frame_len, or returns -1 on bad input
+static ptrdiff_t mt_scan_blocks(
+	const uint8_t *in, size_t in_len, size_t pos,
+	unsigned int flg, uint32_t max_blk_len,
+	mt_block *blocks, size_t *frame_len)
+{
+	ptrdiff_t n_blocks = 0;
+
+	for (;;)
+	{
+		if (in_len - pos < 4)
+			return -1;
+
+		uint32_t blk_len = mt_read_le32(in + pos);
+		pos += 4;
+
+		if (!blk_len)
+			break;
+
+		uint32_t len = blk_len & ~FRAME_BLK_UNCOMPRESSED;
+		if (len > max_blk_len || in_len - pos < len)
+			return -1;
+
+		if (blocks)
+		{
+			blocks[n_blocks].in_ofs = pos;
+			blocks[n_blocks].len = len;
+			blocks[n_blocks].raw = (blk_len & FRAME_BLK_UNCOMPRESSED) != 0;
+		}
+		n_blocks++;
+
+		pos += len;
+		if (flg & FRAME_FLG_BLOCK_CHECKSUM)
+			pos += 4;
+		if (pos > in_len)
+			return -1;
+	}
+
+	if (flg & FRAME_FLG_CONTENT_CHECKSUM)
+		pos += 4;
+	if (pos > in_len)
+		return -1;
+
+	*frame_len = pos;
+	return n_blocks;
+}
+
+int lz4_frame_dec_parallel(
+	const uint8_t *in, size_t in_len,
+	uint8_t *out, size_t *out_len,
+	unsigned int n_threads)
+{
+	size_t out_cap = *out_len;
+	size_t out_pos = 0;
+
+	mt_pool pool;
+	memset(&pool, 0, sizeof(pool));
+
+	int ret = 0;
+	while (in_len)
+	{
+		if (in_len < 8)
+			goto error;
+
+		uint32_t magic = mt_read_le32(in);
+		if ((magic & FRAME_SKIPPABLE_MAGIC_MASK) == FRAME_SKIPPABLE_MAGIC)
+		{
+			uint32_t skip_len = mt_read_le32(in + 4);
+			if (in_len - 8 < skip_len)
+				goto error;
+
+			in += 8 + skip_len;
+			in_len -= 8 + skip_len;
+			continue;
+		}
+
+		if (magic != FRAME_MAGIC)
+			goto error;
+
+		//the same checks as lz4_frame_dec_run's, so that no frame is
+		//decoded here that it would reject (header checksums aside,
+		//which it doesn't verify either, the way it's called below)
+		unsigned int flg = in[4];
+		unsigned int bd = in[5];
+
+		if ((flg & (FRAME_FLG_VERSION_MASK | FRAME_FLG_RESERVED)) != FRAME_FLG_VERSION ||
+			(bd & FRAME_BD_RESERVED) || FRAME_BD_MAX_SIZE(bd) < 4)
+			goto error;
+		if (flg & FRAME_FLG_DICT_ID)
+			goto error; //no dictionary to be had, just as for lz4_frame_dec_run
+
+		size_t hdr_len = 4 + 2 + (flg & FRAME_FLG_CONTENT_SIZE ? 8 : 0) + 1;
+		uint32_t max_blk_len = (uint32_t)1 << (FRAME_BD_MAX_SIZE(bd) * 2 + 8);
+		if (in_len < hdr_len)
+			goto error;
+
+		size_t frame_len;
+		ptrdiff_t n_blocks = mt_scan_blocks(in, in_len, hdr_len, flg, max_blk_len, NULL, &frame_len);
+		if (n_blocks < 0)
+			goto error;
+
+		size_t frame_out_len;
+		int decoded = 0;
+
+		if ((flg & FRAME_FLG_BLOCK_INDEP) && n_threads > 1 && n_blocks > 1 &&
+			!pool.failed && (pool.decs || !(pool.failed = mt_pool_start(&pool, n_threads))))
+		{
+			mt_frame f;
+			f.in = in;
+			f.out = out + out_pos;
+			f.out_cap = out_cap - out_pos;
+			f.max_blk_len = max_blk_len;
+			f.n_blocks = (size_t)n_blocks;
+			f.blocks = (mt_block *)malloc(f.n_blocks * sizeof(mt_block));
+
+			if (f.blocks)
+			{
+				mt_scan_blocks(in, in_len, hdr_len, flg, max_blk_len, f.blocks, &frame_len);
+				decoded = !mt_decode_frame(&f, &pool, &frame_out_len);
+				free(f.blocks);
+			}
+		}
+
+		if (!decoded &&
+			mt_decode_frame_sequential(in, frame_len, out + out_pos, out_cap - out_pos, &frame_out_len))
+			goto error;
+
+		out_pos += frame_out_len;
+
+		in += frame_len;
+		in_len -= frame_len;
+	}
+
+	*out_len = out_pos;
+	goto done;
+
+error:
+	ret = -1;
+done:
+	mt_pool_stop(&pool);
+	return ret;
+}
@@ -0,0 +1,68 @@
+#ifndef LZ4_STREAM_PRIVATE_H
+#define LZ4_STREAM_PRIVATE_H
+
+/*
+	Shared between the library's own source files, and not part of
+	its interface: the decoders' phase numbers and private flag bits
+	(which the checkpoint index saves and restores) and the frame
+	format's constants (which the frame decoder, the parallel decoder,
+	and the frame encoder all need).
+*/
+
+/*
+	The block decoder (lz4_dec_stream_state).
+*/
+
+#define PHASE_READ_TOK				0
+#define PHASE_READ_EX_LIT_LEN		1
+#define PHASE_COPY_LIT				2
+#define PHASE_READ_OFS				3
+#define PHASE_READ_OFS2				4
+#define PHASE_READ_EX_MAT_LEN		5
+#define PHASE_COPY_MAT				6
+
+#define PHASE_REPORT_ERROR			7
+
+#define FLAG_IN_BLOCK				0x80000000u //blk_left is valid
+#define FLAG_BLK_OUT_LEN			0x40000000u //blk_out_left is valid
+#define FLAG_AUTO_UNCACHED			0x20000000u //lz4_dec_stream_run_auto last picked run_dst_uncached
+
+#define O_BUF_LEN 					LZ4_STREAM_WINDOW_LEN
+#define O_BUF_PAD					32 //allows sloppy reads/writes at start+end
+
+/*
+	The frame format, and the frame decoder (lz4_frame_dec_state).
+*/
+
+#define FRAME_MAGIC					0x184D2204u
+#define FRAME_SKIPPABLE_MAGIC		0x184D2A50u //low nibble is user-defined
+#define FRAME_SKIPPABLE_MAGIC_MASK	0xFFFFFFF0u
+
+#define FRAME_FLG_VERSION_MASK		0xC0
+#define FRAME_FLG_VERSION			0x40
+#define FRAME_FLG_BLOCK_INDEP		0x20
+#define FRAME_FLG_BLOCK_CHECKSUM	0x10
+#define FRAME_FLG_CONTENT_SIZE		0x08
+#define FRAME_FLG_CONTENT_CHECKSUM	0x04
+#define FRAME_FLG_RESERVED			0x02
+#define FRAME_FLG_DICT_ID			0x01
+
+#define FRAME_BD_RESERVED			0x8F
+#define FRAME_BD_MAX_SIZE(bd)		(((bd) >> 4) & 7)
+
+#define FRAME_BLK_UNCOMPRESSED		0x80000000u
+
+#define FRAME_PHASE_MAGIC			0
+#define FRAME_PHASE_SKIP_LEN		1
+#define FRAME_PHASE_SKIP			2
+#define FRAME_PHASE_DESC			3
+#define FRAME_PHASE_DESC_EXTRA		4
+#define FRAME_PHASE_BLK_LEN			5
+#define FRAME_PHASE_BLK_DATA		6
+#define FRAME_PHASE_BLK_RAW			7
+#define FRAME_PHASE_BLK_CHECKSUM	8
+#define FRAME_PHASE_CHECKSUM		9
+
+#define FRAME_PHASE_REPORT_ERROR	10
+
+#endif
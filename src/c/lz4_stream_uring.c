@@ -0,0 +1,766 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE
+#endif
+
+#include "lz4_stream_uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+	#define HAVE_URING 1
+	#include <linux/io_uring.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+#else
+	#define HAVE_URING 0
+#endif
+
+#define URING_DEFAULT_DEPTH		8
+#define URING_DEFAULT_BUF_LEN	((size_t)256 << 10)
+#define URING_MAX_DEPTH			256
+
+#define SLOT_FREE				0 //input: empty; output: being filled by the decoder
+#define SLOT_BUSY				1 //a read or write is in flight
+#define SLOT_READY				2 //input: holds data to decode; output: full, waiting to be written
+
+typedef struct uring_slot
+{
+	uint8_t			*buf;
+	size_t			len;	//bytes read into buf, or decoded into it
+	size_t			done;	//bytes of those decoded, or written out
+	uint64_t		off;	//where buf[0] sits in the file
+	int				state;
+} uring_slot;
+
+typedef struct uring_dec
+{
+	int						frames;
+	int						sized;	//raw was told the block's size
+	lz4_dec_stream_state	raw;
+	lz4_frame_dec_state		frame;
+} uring_dec;
+
+typedef struct uring_job
+{
+	int				in_fd, out_fd;
+	int				in_seekable, out_seekable;
+	uint64_t		in_off, out_off;	//where the next read/write goes
+
+	unsigned int	depth;
+	size_t			buf_len;
+	uint8_t			*mem;
+
+	uring_slot		in[URING_MAX_DEPTH];
+	uring_slot		out[URING_MAX_DEPTH];
+	unsigned int	in_cur, in_next;	//decoding from, next to read into
+	unsigned int	out_cur, out_next;	//decoding into, next to write out
+
+	unsigned int	reads_in_flight, writes_in_flight;
+	int				eof, failed;
+
+	uring_dec		dec;
+	lz4_uring_stats	stats;
+} uring_job;
+
+static uint64_t uring_now_ns(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+//decodes as much of in into out as it can, returns nonzero on bad input
+static int uring_dec_run(uring_dec *d,
+	const uint8_t *in, size_t in_len, size_t *in_used,
+	uint8_t *out, size_t out_len, size_t *out_used)
+{
+	int err;
+
+	if (d->frames)
+	{
+		d->frame.in = in;
+		d->frame.avail_in = in_len;
+		d->frame.out = out;
+		d->frame.avail_out = out_len;
+
+		err = lz4_frame_dec_run(&d->frame);
+
+		*in_used = in_len - d->frame.avail_in;
+		*out_used = out_len - d->frame.avail_out;
+	}
+	else
+	{
+		d->raw.in = in;
+		d->raw.avail_in = in_len;
+		d->raw.out = out;
+		d->raw.avail_out = out_len;
+
+		err = lz4_dec_stream_run(&d->raw);
+
+		*in_used = in_len - d->raw.avail_in;
+		*out_used = out_len - d->raw.avail_out;
+	}
+
+	return err;
+}
+
+static int uring_dec_finished(const uring_dec *d)
+{
+	if (d->frames)
+		return lz4_frame_dec_done(&d->frame);
+
+	return d->sized ? lz4_dec_stream_block_done(&d->raw) : lz4_dec_stream_may_end(&d->raw);
+}
+
+static int uring_write_all(int fd, const uint8_t *p, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+//one thing at a time with plain read and write, for when there's no io_uring
+static int uring_run_serial(uring_job *j)
+{
+	uint8_t *in_buf = j->mem;
+	uint8_t *out_buf = j->mem + j->buf_len;
+	size_t out_fill = 0;
+
+	for (;;)
+	{
+		ssize_t n = read(j->in_fd, in_buf, j->buf_len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!n)
+			break;
+
+		j->stats.reads++;
+		j->stats.in_bytes += (uint64_t)n;
+
+		size_t at = 0;
+		while (at < (size_t)n)
+		{
+			size_t in_used, out_used;
+			if (uring_dec_run(&j->dec, in_buf + at, (size_t)n - at, &in_used,
+				out_buf + out_fill, j->buf_len - out_fill, &out_used))
+				return -1;
+
+			at += in_used;
+			out_fill += out_used;
+
+			if (out_fill == j->buf_len)
+			{
+				if (uring_write_all(j->out_fd, out_buf, out_fill))
+					return -1;
+				j->stats.writes++;
+				j->stats.out_bytes += out_fill;
+				out_fill = 0;
+			}
+			else if (!in_used && !out_used)
+				return -1; //stuck, which only bad input can do
+		}
+	}
+
+	//a match may still be waiting to be copied out
+	for (;;)
+	{
+		size_t in_used, out_used;
+		if (uring_dec_run(&j->dec, in_buf, 0, &in_used,
+			out_buf + out_fill, j->buf_len - out_fill, &out_used))
+			return -1;
+		if (!out_used)
+			break;
+
+		out_fill += out_used;
+		if (out_fill == j->buf_len)
+		{
+			if (uring_write_all(j->out_fd, out_buf, out_fill))
+				return -1;
+			j->stats.writes++;
+			j->stats.out_bytes += out_fill;
+			out_fill = 0;
+		}
+	}
+
+	if (out_fill)
+	{
+		if (uring_write_all(j->out_fd, out_buf, out_fill))
+			return -1;
+		j->stats.writes++;
+		j->stats.out_bytes += out_fill;
+	}
+
+	return uring_dec_finished(&j->dec) ? 0 : -1;
+}
+
+#if HAVE_URING
+
+typedef struct uring
+{
+	int					fd;
+
+	unsigned int		*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int		sq_entries;
+	struct io_uring_sqe	*sqes;
+	unsigned int		to_submit;
+
+	unsigned int		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void				*sq_map, *cq_map;
+	size_t				sq_map_len, cq_map_len, sqes_len;
+
+	int					fixed; //the buffers are registered
+} uring;
+
+static int uring_setup(uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0)
+		return -1;
+	r->fd = fd;
+
+	r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cq_map_len > r->sq_map_len)
+			r->sq_map_len = r->cq_map_len;
+		r->cq_map_len = r->sq_map_len;
+	}
+
+	r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (r->sq_map == MAP_FAILED)
+		return -1;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_map = r->sq_map;
+	else
+	{
+		r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (r->cq_map == MAP_FAILED)
+			return -1;
+	}
+
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -1;
+
+	uint8_t *sq = r->sq_map;
+	r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+
+	uint8_t *cq = r->cq_map;
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+static void uring_teardown(uring *r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+		munmap(r->cq_map, r->cq_map_len);
+	if (r->sq_map && r->sq_map != MAP_FAILED)
+		munmap(r->sq_map, r->sq_map_len);
+	if (r->fd >= 0)
+		close(r->fd);
+}
+
+//queues a read or write of len bytes at buf (registered buffer buf_index)
+static void uring_queue(uring *r, int write, int fd, uint8_t *buf, unsigned int buf_index,
+	size_t len, uint64_t off, uint64_t user_data)
+{
+	unsigned int tail = *r->sq_tail;
+	unsigned int idx = tail & *r->sq_mask;
+
+	//nb: never more in flight than there are slots, and the ring has room for all of them
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = r->fixed ?
+		(write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED) :
+		(write ? IORING_OP_WRITE : IORING_OP_READ);
+	sqe->fd = fd;
+	sqe->off = off;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (uint32_t)len;
+	sqe->buf_index = (uint16_t)buf_index;
+	sqe->user_data = user_data;
+
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+}
+
+//submits everything queued, waiting for at least min_complete completions
+static int uring_enter(uring *r, unsigned int min_complete)
+{
+	for (;;)
+	{
+		int n = (int)syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete,
+			min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		r->to_submit -= (unsigned int)n < r->to_submit ? (unsigned int)n : r->to_submit;
+		return 0;
+	}
+}
+
+#define URING_READ_TAG		((uint64_t)1 << 32)
+#define URING_WRITE_TAG		((uint64_t)2 << 32)
+
+static void uring_track_in_flight(uring_job *j)
+{
+	if (j->reads_in_flight > j->stats.max_reads_in_flight)
+		j->stats.max_reads_in_flight = j->reads_in_flight;
+	if (j->writes_in_flight > j->stats.max_writes_in_flight)
+		j->stats.max_writes_in_flight = j->writes_in_flight;
+}
+
+static void uring_queue_read(uring *r, uring_job *j, unsigned int i)
+{
+	uring_slot *s = &j->in[i];
+
+	//nb: a pipe's current position is the only one there is
+	uint64_t off = j->in_seekable ? s->off + s->len : (uint64_t)-1;
+	uring_queue(r, 0, j->in_fd, s->buf + s->len, i, j->buf_len - s->len, off, URING_READ_TAG | i);
+
+	s->state = SLOT_BUSY;
+	j->reads_in_flight++;
+	j->stats.reads++;
+	uring_track_in_flight(j);
+}
+
+static void uring_queue_write(uring *r, uring_job *j, unsigned int i)
+{
+	uring_slot *s = &j->out[i];
+
+	uint64_t off = j->out_seekable ? s->off + s->done : (uint64_t)-1;
+	uring_queue(r, 1, j->out_fd, s->buf + s->done, j->depth + i, s->len - s->done, off, URING_WRITE_TAG | i);
+
+	s->state = SLOT_BUSY;
+	j->writes_in_flight++;
+	j->stats.writes++;
+	uring_track_in_flight(j);
+}
+
+//starts reads into free input slots, in order, and writes of full output
+//slots, in order (one at a time for anything that isn't a regular file)
+static void uring_pump(uring *r, uring_job *j)
+{
+	if (j->failed)
+		return;
+
+	while (!j->eof && j->in[j->in_next].state == SLOT_FREE &&
+		(j->in_seekable || !j->reads_in_flight))
+	{
+		uring_slot *s = &j->in[j->in_next];
+		s->len = 0;
+		s->done = 0;
+		s->off = j->in_off;
+		j->in_off += j->buf_len;
+
+		uring_queue_read(r, j, j->in_next);
+		j->in_next = (j->in_next + 1) % j->depth;
+	}
+
+	while (j->out[j->out_next].state == SLOT_READY &&
+		(j->out_seekable || !j->writes_in_flight))
+	{
+		uring_slot *s = &j->out[j->out_next];
+		s->off = j->out_off;
+		j->out_off += s->len;
+
+		uring_queue_write(r, j, j->out_next);
+		j->out_next = (j->out_next + 1) % j->depth;
+	}
+}
+
+static void uring_complete(uring *r, uring_job *j, uint64_t user_data, int res)
+{
+	unsigned int i = (unsigned int)user_data;
+
+	if (user_data & URING_READ_TAG)
+		j->reads_in_flight--;
+	else
+		j->writes_in_flight--;
+
+	if (j->failed)
+		return; //just draining what's in flight
+
+	if (user_data & URING_READ_TAG)
+	{
+		uring_slot *s = &j->in[i];
+
+		if (res == -EINTR || res == -EAGAIN)
+			uring_queue_read(r, j, i);
+		else if (res < 0)
+		{
+			errno = -res;
+			j->failed = 1;
+		}
+		else if (res == 0)
+		{
+			s->state = SLOT_READY;
+			j->eof = 1;
+		}
+		else
+		{
+			s->len += (size_t)res;
+			j->stats.in_bytes += (uint64_t)res;
+
+			if (s->len < j->buf_len && j->in_seekable && !j->eof)
+				//a short read of a file, either the end or more's on its way
+				uring_queue_read(r, j, i);
+			else
+				s->state = SLOT_READY;
+		}
+	}
+	else
+	{
+		uring_slot *s = &j->out[i];
+
+		if (res == -EINTR || res == -EAGAIN)
+			uring_queue_write(r, j, i);
+		else if (res <= 0)
+		{
+			errno = res ? -res : EIO;
+			j->failed = 1;
+		}
+		else
+		{
+			s->done += (size_t)res;
+			j->stats.out_bytes += (uint64_t)res;
+
+			if (s->done < s->len)
+				uring_queue_write(r, j, i);
+			else
+			{
+				s->len = 0;
+				s->done = 0;
+				s->state = SLOT_FREE;
+			}
+		}
+	}
+}
+
+//handles whatever has completed, returns how many
+static unsigned int uring_reap(uring *r, uring_job *j)
+{
+	unsigned int head = *r->cq_head;
+	unsigned int tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	for (; head != tail; head++, n++)
+	{
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		uring_complete(r, j, cqe->user_data, cqe->res);
+	}
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+//submits, then blocks until something completes
+static int uring_wait(uring *r, uring_job *j, uint64_t *stall_count, uint64_t *stall_ns)
+{
+	uint64_t t0 = uring_now_ns();
+
+	if (!j->reads_in_flight && !j->writes_in_flight && !r->to_submit)
+		return -1; //nothing could ever complete
+
+	do
+	{
+		if (uring_enter(r, 1))
+			return -1;
+	} while (!uring_reap(r, j));
+
+	uring_pump(r, j);
+
+	if (stall_count)
+	{
+		(*stall_count)++;
+		*stall_ns += uring_now_ns() - t0;
+	}
+
+	return j->failed ? -1 : 0;
+}
+
+static int uring_run(uring_job *j)
+{
+	uring r;
+	if (uring_setup(&r, 2 * j->depth))
+	{
+		uring_teardown(&r);
+		return 1; //not available, use plain I/O
+	}
+
+	struct iovec iov[2 * URING_MAX_DEPTH];
+	for (unsigned int i = 0; i < j->depth; i++)
+	{
+		iov[i].iov_base = j->in[i].buf;
+		iov[i].iov_len = j->buf_len;
+		iov[j->depth + i].iov_base = j->out[i].buf;
+		iov[j->depth + i].iov_len = j->buf_len;
+	}
+	//fixed buffers save pinning pages on every operation, but count against
+	//RLIMIT_MEMLOCK, so go without them if they're refused
+	r.fixed = !syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, 2 * j->depth);
+
+	j->stats.used_uring = 1;
+
+	int ret = -1;
+	uring_pump(&r, j);
+
+	for (;;)
+	{
+		uring_slot *is = &j->in[j->in_cur];
+		uring_slot *os = &j->out[j->out_cur];
+
+		if (is->state == SLOT_FREE && j->eof)
+		{
+			//the input ended short of this slot, it stands in for the end
+			is->len = 0;
+			is->done = 0;
+			is->state = SLOT_READY;
+		}
+
+		if (is->state != SLOT_READY)
+		{
+			if (uring_wait(&r, j, &j->stats.read_stalls, &j->stats.read_stall_ns))
+				goto done;
+			continue;
+		}
+
+		//nb: the empty slot at the end of the input stays put, there may still
+		//be a match to finish copying out with no more input needed
+		if (is->done == is->len && is->len)
+		{
+			is->state = SLOT_FREE;
+			j->in_cur = (j->in_cur + 1) % j->depth;
+			uring_pump(&r, j);
+			continue;
+		}
+
+		if (os->state != SLOT_FREE)
+		{
+			if (uring_wait(&r, j, &j->stats.write_stalls, &j->stats.write_stall_ns))
+				goto done;
+			continue;
+		}
+
+		size_t in_used, out_used;
+		if (uring_dec_run(&j->dec, is->buf + is->done, is->len - is->done, &in_used,
+			os->buf + os->len, j->buf_len - os->len, &out_used))
+			goto done;
+
+		is->done += in_used;
+		os->len += out_used;
+
+		if (!is->len && !out_used)
+			break; //the end of the input, and nothing left to flush
+
+		if (os->len == j->buf_len)
+		{
+			os->state = SLOT_READY;
+			j->out_cur = (j->out_cur + 1) % j->depth;
+		}
+		else if (!in_used && !out_used)
+			goto done; //stuck, which only bad input can do
+
+		//pick up anything that's finished in the meantime, without waiting
+		uring_reap(&r, j);
+		uring_pump(&r, j);
+		if (r.to_submit && uring_enter(&r, 0))
+			goto done;
+		if (j->failed)
+			goto done;
+	}
+
+	if (!uring_dec_finished(&j->dec))
+		goto done;
+
+	//write out the last partial buffer, then wait for everything to land
+	if (j->out[j->out_cur].len)
+	{
+		j->out[j->out_cur].state = SLOT_READY;
+		j->out_cur = (j->out_cur + 1) % j->depth;
+	}
+	uring_pump(&r, j);
+
+	while (j->reads_in_flight || j->writes_in_flight || j->out[j->out_next].state == SLOT_READY)
+		if (uring_wait(&r, j, NULL, NULL))
+			goto done;
+
+	ret = 0;
+
+done:
+	if (ret)
+	{
+		//the kernel may still be reading into (or writing from) our buffers,
+		//so let everything in flight finish before they're freed
+		int e = errno;
+		j->failed = 1;
+		while ((j->reads_in_flight || j->writes_in_flight) && !uring_enter(&r, 1))
+			uring_reap(&r, j);
+		errno = e;
+	}
+
+	uring_teardown(&r);
+	return ret;
+}
+
+#endif
+
+int lz4_uring_dec_fd(
+	int in_fd, int out_fd, unsigned int flags,
+	unsigned int queue_depth, size_t buf_len,
+	lz4_uring_stats *stats)
+{
+	if (!queue_depth)
+		queue_depth = URING_DEFAULT_DEPTH;
+	if (queue_depth > URING_MAX_DEPTH)
+		queue_depth = URING_MAX_DEPTH;
+	if (!buf_len)
+		buf_len = URING_DEFAULT_BUF_LEN;
+	if (buf_len > UINT32_MAX)
+		buf_len = UINT32_MAX;
+
+	uring_job *j = calloc(1, sizeof(uring_job));
+	if (!j)
+		return -1;
+
+	j->mem = malloc(2 * (size_t)queue_depth * buf_len);
+	if (!j->mem)
+	{
+		free(j);
+		return -1;
+	}
+
+	j->in_fd = in_fd;
+	j->out_fd = out_fd;
+	j->depth = queue_depth;
+	j->buf_len = buf_len;
+	j->stats.queue_depth = queue_depth;
+
+	off_t in_pos = lseek(in_fd, 0, SEEK_CUR);
+	off_t out_pos = lseek(out_fd, 0, SEEK_CUR);
+	j->in_seekable = in_pos >= 0;
+	j->out_seekable = out_pos >= 0;
+	j->in_off = j->in_seekable ? (uint64_t)in_pos : 0;
+	j->out_off = j->out_seekable ? (uint64_t)out_pos : 0;
+
+	for (unsigned int i = 0; i < queue_depth; i++)
+	{
+		j->in[i].buf = j->mem + (size_t)i * buf_len;
+		j->out[i].buf = j->mem + ((size_t)queue_depth + i) * buf_len;
+	}
+
+	j->dec.frames = !(flags & LZ4_URING_RAW_BLOCK);
+	if (j->dec.frames)
+		lz4_frame_dec_init(&j->dec.frame);
+	else
+	{
+		lz4_dec_stream_init(&j->dec.raw);
+
+		//the block runs to the end of the file, if we can tell where that is
+		struct stat st;
+		if (j->in_seekable && !fstat(in_fd, &st) && S_ISREG(st.st_mode) && st.st_size >= in_pos)
+		{
+			lz4_dec_stream_begin_block(&j->dec.raw, (size_t)(st.st_size - in_pos));
+			j->dec.sized = 1;
+		}
+	}
+
+	int ret = 1;
+#if HAVE_URING
+	ret = uring_run(j);
+	if (!ret)
+	{
+		//leave the descriptors where plain reads and writes would have
+		if (j->in_seekable)
+			lseek(in_fd, in_pos + (off_t)j->stats.in_bytes, SEEK_SET);
+		if (j->out_seekable)
+			lseek(out_fd, out_pos + (off_t)j->stats.out_bytes, SEEK_SET);
+	}
+#endif
+	if (ret > 0)
+		ret = uring_run_serial(j);
+
+	if (stats)
+		*stats = j->stats;
+
+	free(j->mem);
+	free(j);
+	return ret;
+}
+
+int lz4_uring_dec_file(
+	const char *in_path, const char *out_path, unsigned int flags,
+	unsigned int queue_depth, size_t buf_len,
+	lz4_uring_stats *stats)
+{
+	int in_fd = open(in_path, O_RDONLY);
+	if (in_fd < 0)
+		return -1;
+
+	int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd < 0)
+	{
+		int e = errno;
+		close(in_fd);
+		errno = e;
+		return -1;
+	}
+
+	int ret = lz4_uring_dec_fd(in_fd, out_fd, flags, queue_depth, buf_len, stats);
+
+	int e = errno;
+	close(in_fd);
+	if (close(out_fd) && !ret)
+		ret = -1;
+	else
+		errno = e;
+
+	return ret;
+}